@@ -4,6 +4,7 @@
 #include <cmath>
 
 #include "harris_detector.h"
+#include "../utils/thread_pool.h"
 
 using namespace std;
 
@@ -70,17 +71,19 @@ Image structure_matrix(const Image& im2, float sigma) {
   if (im2.c == 1) im = im2;
   else im = im2.rgb_to_grayscale();
 
-  Image S(im.w, im.h, 3);
+  Image S = Image::uninitialized(im.w, im.h, 3);
   Image ix = convolve_image(im, make_gx_filter(), 0);
   Image iy = convolve_image(im, make_gy_filter(), 0);
 
-  for (int y = 0; y < im.h; y++) {
-    for (int x = 0; x < im.w; x++) {
-      S(x, y, 0) = ix(x, y, 0) * ix(x, y, 0);
-      S(x, y, 1) = iy(x, y, 0) * iy(x, y, 0);
-      S(x, y, 2) = ix(x, y, 0) * iy(x, y, 0);
+  parallel_for(0, im.h, 16, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = 0; x < im.w; x++) {
+        S(x, y, 0) = ix(x, y, 0) * ix(x, y, 0);
+        S(x, y, 1) = iy(x, y, 0) * iy(x, y, 0);
+        S(x, y, 2) = ix(x, y, 0) * iy(x, y, 0);
+      }
     }
-  }
+  });
 
   return convolve_image(S, make_gaussian_filter(sigma), 1);
 }
@@ -91,16 +94,19 @@ Image structure_matrix(const Image& im2, float sigma) {
 // returns: a response map of cornerness calculations.
 // int method: 0: det(S)/tr(S)    1 (optional) : exact 2nd eigenvalue
 Image cornerness_response(const Image& S, int method) {
-  Image R(S.w, S.h);
+  Image R = Image::uninitialized(S.w, S.h);
   // method==0: E(S) = det(S) / trace(S)
   // method==1 (optional): E(S) = exact 2nd eigenvalue (what is the formula??)
-  for (int y = 0; y < S.h; y++) {
-    for (int x = 0; x < S.w; x++) {
-      float det = (S(x, y, 0) * S(x, y, 1)) - (S(x, y, 2) * S(x, y, 2));
-      float trace = S(x, y, 0) + S(x, y, 1);
-      R(x, y, 0) = det/trace;
+  parallel_for(0, S.h, 16, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = 0; x < S.w; x++) {
+        float det = (S(x, y, 0) * S(x, y, 1)) - (S(x, y, 2) * S(x, y, 2));
+        float trace = S(x, y, 0) + S(x, y, 1);
+        // flat patches have no gradient at all, 0/0 would poison the normalization
+        R(x, y, 0) = trace == 0 ? 0 : det/trace;
+      }
     }
-  }
+  });
   return R;
 }
 
@@ -115,22 +121,24 @@ Image nms_image(const Image& im, int w) {
   //     for neighbors within w:
   //         if neighbor response greater than pixel response:
   //             set response to be very low (I use -999999 [why not 0??])
-  for (int y = 0; y < im.h; y++) {
-    for (int x = 0; x < im.w; x++) {
-      float curr_val = im.get_pixel(x, y, 0);
-      float surpressed = curr_val;
-      for (int dy = 0; dy < (w * 2) + 1; dy++) {
-        for (int dx = 0; dx < (w * 2) + 1; dx++) {
-          int x_prime = x - (w - dx);
-          int y_prime = y - (w - dy);
-          if (im.get_pixel(x_prime, y_prime, 0) > curr_val) {
-            surpressed = -999999;
+  parallel_for(0, im.h, 8, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = 0; x < im.w; x++) {
+        float curr_val = im.get_pixel(x, y, 0);
+        float surpressed = curr_val;
+        for (int dy = 0; dy < (w * 2) + 1; dy++) {
+          for (int dx = 0; dx < (w * 2) + 1; dx++) {
+            int x_prime = x - (w - dx);
+            int y_prime = y - (w - dy);
+            if (im.get_pixel(x_prime, y_prime, 0) > curr_val) {
+              surpressed = -999999;
+            }
           }
         }
+        r.set_pixel(x, y, 0, surpressed);
       }
-      r.set_pixel(x, y, 0, surpressed);
     }
-  }
+  });
   return r;
 }
 
@@ -8,22 +8,242 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <type_traits>
 
 using namespace std;
 
 
+class Image;
+
+// true for the nodes of a lazy pointwise expression, see image_expr.h
+template <class T> struct is_image_node : false_type {};
+
+
+// the filters of Image::resize, see resample.h
+enum ResampleFilter {
+  FILTER_NEAREST,
+  FILTER_BILINEAR,
+  FILTER_AREA,
+  FILTER_BICUBIC,     // Keys cubic with a = -0.5 (Catmull-Rom)
+  FILTER_MITCHELL,    // Mitchell-Netravali with B = C = 1/3
+  FILTER_LANCZOS3,    // sinc windowed by sinc over 3 lobes
+};
+
+
+/**
+ * @brief A non-owning window onto the pixels of an Image. A view records where
+ * its first pixel lives and how far apart rows, channels and neighbouring pixels
+ * are, so it can look at planar and interleaved images alike and a crop or a
+ * single channel of an Image can be handed to filters, resizes and savers
+ * without copying. The view is only valid while the Image it came from is alive
+ * and has not been reallocated.
+ * 
+ */
+struct ImageView
+{
+  // fields
+  float* data;
+  int w, h, c;
+  int stride;       // number of floats between the starts of two consecutive rows
+  size_t cstride;   // number of floats between the starts of two consecutive channels
+  int pstride;      // number of floats between two horizontally neighbouring pixels
+
+
+  /**
+   * @brief Constructs an empty view
+   * 
+   */
+  ImageView();
+
+
+  /**
+   * @brief Constructs a view from raw strided memory
+   * 
+   * @param data pointer to the first pixel of the first channel
+   * @param w width of the view
+   * @param h height of the view
+   * @param c number of channels of the view
+   * @param stride number of floats between consecutive rows
+   * @param cstride number of floats between consecutive channels
+   * @param pstride number of floats between neighbouring pixels of a row
+   */
+  ImageView(float* data, int w, int h, int c, int stride, size_t cstride, int pstride=1);
+
+
+  /**
+   * @brief Constructs a view covering the whole of an image
+   * 
+   * @param im the image to look at
+   */
+  ImageView(const Image& im);
+
+
+  /**
+   * @brief operator overload to access/set pixel value
+   * 
+   * @param x the x position of the pixel
+   * @param y the y position of the pixel
+   * @param ch the channel of the pixel
+   * @return float& a reference to the pixel value
+   */
+  float& operator()(int x, int y, int ch) const;
+
+
+  /**
+   * @brief Get the pixel value at the given point and channel, clamping
+   * coordinates that fall outside the view to its border
+   * 
+   * @param x the x position of the pixel
+   * @param y the y position of the pixel
+   * @param ch the channel of the pixel
+   * @return float the pixel value
+   */
+  float get_pixel(int x, int y, int ch) const;
+
+
+  /**
+   * @brief Set the pixel at the given point and channel, ignoring
+   * coordinates that fall outside the view
+   * 
+   * @param x the x position of the pixel
+   * @param y the y position of the pixel
+   * @param ch the channel of the pixel
+   * @param v the value for which to set the given pixel
+   */
+  void set_pixel(int x, int y, int ch, float v) const;
+
+
+  /**
+   * @brief Gets a pointer to a row of pixels in the given channel, pixels of the
+   * row are pstride floats apart
+   * 
+   * @param row the row desired in the view
+   * @param ch the channel of the row desired
+   * @return float* a float pointer to the first pixel of the row
+   */
+  float* RowPtr(int row, int ch) const;
+
+
+  /**
+   * @brief checks whether the pixels of the view are interleaved, i.e. whether
+   * the channels of one pixel sit next to each other in memory
+   * 
+   * @return true if the view is interleaved
+   * @return false if the view is planar
+   */
+  bool is_interleaved() const;
+
+
+  /**
+   * @brief Creates a view onto a rectangular region of this view
+   * 
+   * @param x the x position of the top left corner of the region
+   * @param y the y position of the top left corner of the region
+   * @param w the width of the region
+   * @param h the height of the region
+   * @return ImageView a view of the region sharing this view's pixels
+   */
+  ImageView crop(int x, int y, int w, int h) const;
+
+
+  /**
+   * @brief Creates a single channel view of one of this view's channels
+   * 
+   * @param ch the channel to look at
+   * @return ImageView a one channel view sharing this view's pixels
+   */
+  ImageView channel(int ch) const;
+
+
+  /**
+   * @brief Gets the value pixel a given floating point coordinate using nearest neighbour interpolation
+   * 
+   * @param x the x coordinate 
+   * @param y the y coordinate
+   * @param ch the channel from which to retrieve the pixel value
+   * @return float the value of the pixel which the coordinate maps to using nearest neighbour
+   */
+  float nn_interpolate(float x, float y, int ch) const;
+
+
+  /**
+   * @brief Gets the value of a pixel given floating point cooridnates using bilinear interpolation of the 
+   * surrounding pixels
+   * 
+   * @param x the x coordinate 
+   * @param y the y coordinate
+   * @param ch the channel from which to retrieve the pixel value
+   * @return float the value of the pixel which the coordinate maps to using bilinear interpolation
+   */
+  float bilinear_interpolate(float x, float y, int ch) const;
+
+
+  /**
+   * @brief Creates a resized image using nearest neighbour interpolation
+   * 
+   * @param w the new width of the image
+   * @param h the new height of the image
+   * @return Image a new resized image
+   */
+  Image nn_resize(int w, int h) const;
+
+
+  /**
+   * @brief Creates a resized image using bilinear interpolation
+   * 
+   * @param w the new width of the image
+   * @param h the new height of the image
+   * @return Image a new resized image
+   */
+  Image bilinear_resize(int w, int h) const;
+
+
+  /**
+   * @brief Creates a resized image where every pixel is the average of the
+   * area of the source it covers, which doesn't alias when shrinking
+   * 
+   * @param w the new width of the image
+   * @param h the new height of the image
+   * @return Image a new resized image
+   */
+  Image area_resize(int w, int h) const;
+
+
+  /**
+   * @brief Creates a resized image with any of the filters in resample.h
+   * (nearest, bilinear, area, bicubic, Mitchell or Lanczos3), using tables
+   * cached per size and filter
+   * 
+   * @param w the new width of the image
+   * @param h the new height of the image
+   * @param filter the filter to resample with
+   * @return Image a new resized image
+   */
+  Image resize(int w, int h, ResampleFilter filter) const;
+};
+
+
 class Image
 {
 
 private:
 
-
 public:
 
+  // how the channels of the image are laid out in memory
+  //   PLANAR:      every channel is its own plane, pixel (x,y,ch) is at ch*stride*h + y*stride + x
+  //   INTERLEAVED: the channels of a pixel are adjacent, pixel (x,y,ch) is at y*stride + x*c + ch
+  enum Layout { PLANAR, INTERLEAVED };
+
   // fields
   int w, h, c;
+  int stride;   // number of floats between the starts of two consecutive rows
+  Layout layout;
   float* data;
 
+  // alignment in bytes of the data buffer and, for padded images, of every row
+  static const int ALIGNMENT = 64;
+
   /**
    * @brief Constructs a new Image object
    * 
@@ -39,6 +259,72 @@ public:
    * @param c number of channels for the image
    */
   Image(int w, int h, int c=1);
+
+
+  /**
+   * @brief Constructs a new Image object whose rows are padded so that every
+   * row starts on an ALIGNMENT byte boundary
+   * 
+   * @param w width of the image
+   * @param h height of the image
+   * @param c number of channels for the image
+   * @param padded whether to round the row stride up to a multiple of ALIGNMENT bytes
+   */
+  Image(int w, int h, int c, bool padded);
+
+
+  /**
+   * @brief Constructs a new Image object with the given memory layout
+   * 
+   * @param w width of the image
+   * @param h height of the image
+   * @param c number of channels for the image
+   * @param layout whether the channels are stored as planes or interleaved per pixel
+   * @param padded whether to round the row stride up to a multiple of ALIGNMENT bytes
+   */
+  Image(int w, int h, int c, Layout layout, bool padded=false);
+
+
+  /**
+   * @brief Constructs a new Image object holding a copy of the pixels of a view
+   * 
+   * @param v the view to copy
+   */
+  explicit Image(const ImageView& v);
+
+
+  /**
+   * @brief Constructs a new Image object by evaluating a pointwise expression
+   * such as a + b * 0.5f in a single pass, see image_expr.h
+   * 
+   * @param e the expression to evaluate
+   */
+  template <class E, class = typename enable_if<is_image_node<E>::value>::type>
+  Image(const E& e);
+
+
+  /**
+   * @brief Constructs a new Image object whose pixels are left undefined. Skips
+   * zeroing the buffer so it is only for outputs that are fully overwritten
+   * before being read.
+   * 
+   * @param w width of the image
+   * @param h height of the image
+   * @param c number of channels for the image
+   * @param layout whether the channels are stored as planes or interleaved per pixel
+   * @param padded whether to round the row stride up to a multiple of ALIGNMENT bytes
+   * @return Image the new image
+   */
+  static Image uninitialized(int w, int h, int c=1, Layout layout=PLANAR, bool padded=false);
+
+
+  /**
+   * @brief rounds a row width up to the padded stride used by padded images
+   * 
+   * @param w the width of the row in pixels
+   * @return int the number of floats a padded row of that width occupies
+   */
+  static int padded_stride(int w);
   
 
   /**
@@ -82,6 +368,29 @@ public:
   Image& operator=(Image&& other);
 
 
+  /**
+   * @brief evaluates a pointwise expression into this image in a single pass,
+   * the image itself may be one of the operands
+   * 
+   * @param e the expression to evaluate
+   * @return Image& a reference to this instance
+   */
+  template <class E, class = typename enable_if<is_image_node<E>::value>::type>
+  Image& operator=(const E& e);
+
+
+  /**
+   * @brief in place pointwise arithmetic with an image, an expression or a scalar,
+   * done as one pass over this image
+   * 
+   * @param e the right hand side
+   * @return Image& a reference to this instance
+   */
+  template <class E> Image& operator+=(const E& e);
+  template <class E> Image& operator-=(const E& e);
+  template <class E> Image& operator*=(const E& e);
+
+
   /**
    * @brief compares whether the two images have the same data
    * 
@@ -221,7 +530,8 @@ public:
 
   
   /**
-   * @brief Gets a pointer to a row of pixels in the given channel
+   * @brief Gets a pointer to a row of pixels in the given channel. Pixels of the
+   * row are pixel_stride() floats apart, i.e. adjacent for planar images
    * 
    * @param row the row desired in the image
    * @param ch the channel of the row desired
@@ -231,7 +541,8 @@ public:
 
 
   /**
-   * @brief Gets a pointer to a row of pixels in the given channel
+   * @brief Gets a pointer to a row of pixels in the given channel. Pixels of the
+   * row are pixel_stride() floats apart, i.e. adjacent for planar images
    * 
    * @param row the row desired in the image
    * @param ch the channel of the row desired
@@ -240,6 +551,101 @@ public:
   float* RowPtr(int row, int ch);
   
 
+  /**
+   * @brief Creates a view covering the whole image
+   * 
+   * @return ImageView a view sharing this image's pixels
+   */
+  ImageView view() const;
+
+
+  /**
+   * @brief Creates a view onto a rectangular region of the image without copying
+   * 
+   * @param x the x position of the top left corner of the region
+   * @param y the y position of the top left corner of the region
+   * @param w the width of the region
+   * @param h the height of the region
+   * @return ImageView a view of the region sharing this image's pixels
+   */
+  ImageView crop(int x, int y, int w, int h) const;
+
+
+  /**
+   * @brief Creates a single channel view of one channel of the image without copying
+   * 
+   * @param ch the channel to look at
+   * @return ImageView a one channel view sharing this image's pixels
+   */
+  ImageView channel(int ch) const;
+
+
+  /**
+   * @brief Copies the pixels of a view into this image with its top left corner 
+   * at (x, y). Rows and columns that fall outside the image are dropped
+   * 
+   * @param v the view to copy from, it must have the same number of channels
+   * @param x the x position in this image of the view's left column
+   * @param y the y position in this image of the view's top row
+   */
+  void paste(const ImageView& v, int x, int y);
+
+
+  /**
+   * @brief gets the number of floats between the starts of two consecutive channels
+   * 
+   * @return size_t the channel stride in floats
+   */
+  size_t channel_stride() const;
+
+
+  /**
+   * @brief gets the number of floats between two horizontally neighbouring pixels
+   * 
+   * @return int 1 for planar images and c for interleaved images
+   */
+  int pixel_stride() const;
+
+
+  /**
+   * @brief checks whether the rows are stored back to back without padding
+   * so that the whole image can be walked as one flat array of size() floats
+   * 
+   * @return true if the row stride equals the width of a row in floats
+   * @return false if the rows are padded
+   */
+  bool is_contiguous() const;
+
+
+  /**
+   * @brief calls fn(ptr, n) on every run of adjacent floats that holds the
+   * pixels of channels [ch0, ch1): a whole plane or the whole buffer when the
+   * rows are not padded, one row at a time otherwise. Interleaved images can
+   * only be walked over all of their channels this way.
+   * 
+   * @param ch0 the first channel
+   * @param ch1 one past the last channel
+   * @param fn the function to call on each run
+   */
+  template <class F> void for_each_span(int ch0, int ch1, F fn) const;
+
+
+  /**
+   * @brief Creates a copy of the image with its channels interleaved per pixel
+   * 
+   * @return Image the interleaved copy
+   */
+  Image to_interleaved() const;
+
+
+  /**
+   * @brief Creates a copy of the image with every channel in its own plane
+   * 
+   * @return Image the planar copy
+   */
+  Image to_planar() const;
+
+
   /**
    * @brief checks whether a given coordinate point exists in the image
    * 
@@ -263,7 +669,9 @@ public:
   
 
   /**
-   * @brief checks that a given patch of size 2*w centred at (x,y) is non-empty
+   * @brief checks that a given patch of size 2*w centred at (x,y) is non-empty,
+   * looking at every pixel until one isn't 0. To check many patches of the same
+   * image in constant time each see IntegralImage::nonzero.
    * 
    * @param x the x position
    * @param y the y position
@@ -293,6 +701,30 @@ public:
   Image bilinear_resize(int w, int h) const;
 
 
+  /**
+   * @brief Creates a resized image where every pixel is the average of the
+   * area of the source it covers, which doesn't alias when shrinking
+   * 
+   * @param w the new width of the image
+   * @param h the new height of the image
+   * @return Image a new resized image
+   */
+  Image area_resize(int w, int h) const;
+
+
+  /**
+   * @brief Creates a resized image with any of the filters in resample.h
+   * (nearest, bilinear, area, bicubic, Mitchell or Lanczos3), using tables
+   * cached per size and filter
+   * 
+   * @param w the new width of the image
+   * @param h the new height of the image
+   * @param filter the filter to resample with
+   * @return Image a new resized image
+   */
+  Image resize(int w, int h, ResampleFilter filter) const;
+
+
   /**
    * @brief Gets the value pixel a given floating point coordinate using nearest neighbour interpolation
    * 
@@ -324,6 +756,15 @@ public:
   int size() const;
 
 
+  /**
+   * @brief gets the number of floats allocated for the image including
+   * any row padding
+   * 
+   * @return size_t the number of floats in the data buffer
+   */
+  size_t buffer_size() const;
+
+
   /**
    * @brief clears the image setting all pixel values to 0
    * 
@@ -461,7 +902,9 @@ public:
   
 
   /**
-   * @brief Serializes the data in this image
+   * @brief Serializes the data in this image with its layout and strides
+   * in the binary format described in image_file.h, which MappedImage can
+   * map without reading
    * 
    * @param file the path to the file for which to serialize the data to
    */
@@ -469,15 +912,87 @@ public:
   
   
   /**
-   * @brief Deserializes the data in a file into an image
+   * @brief Deserializes the data in a file written by save into an image
+   * with the layout the file was saved with
    * 
    * @param file the path to the file for which to try deserialize the data from
    * @return Image the resulting image from the file
    */
   static Image load(const string& file);
 
+
+private:
+
+  struct NoInit {};
+
+  // allocates the data buffer but leaves its content undefined
+  Image(int w, int h, int c, Layout layout, bool padded, NoInit);
+
 };
 
+
+template <class F>
+void Image::for_each_span(int ch0, int ch1, F fn) const {
+  if (layout == INTERLEAVED) {
+    assert(ch0 == 0 && ch1 == c && "interleaved images can only be walked over all channels");
+    if (is_contiguous()) fn(data, (size_t)w*h*c);
+    else for (int row = 0; row < h; row++) fn(data + (size_t)row*stride, (size_t)w*c);
+    return;
+  }
+  for (int ch = ch0; ch < ch1; ch++) {
+    float* plane = data + ch*channel_stride();
+    if (is_contiguous()) fn(plane, (size_t)w*h);
+    else for (int row = 0; row < h; row++) fn(plane + (size_t)row*stride, (size_t)w);
+  }
+}
+
 Image load_image(const string& filename);
-void save_png(const Image& im, const string& name);
-void save_image(const Image& im, const string& name);
\ No newline at end of file
+Image load_image(const string& filename, Image::Layout layout);
+
+
+/**
+ * @brief Loads an image shrunk by 2, 4 or 8 so that it fits within max_w x
+ * max_h, or as close as a factor of 8 gets. Jpegs are decoded at that scale
+ * with reduced idcts, down to the dc coefficient alone for 1/8, so most of
+ * the decode and the full size image are skipped. Other stb formats are
+ * decoded at full size and blocks of pixels averaged in 8 bit straight away,
+ * and qoi, pfm, ppm and pgm are loaded and area resized. A size of 0 or less
+ * leaves that side unconstrained.
+ * 
+ * @param filename the path of the image to load
+ * @param max_w the largest width wanted
+ * @param max_h the largest height wanted
+ * @param layout the layout of the returned image
+ * @return Image the image at the picked scale, (w + s - 1)/s by (h + s - 1)/s
+ */
+Image load_image(const string& filename, int max_w, int max_h, Image::Layout layout=Image::PLANAR);
+
+
+/**
+ * @brief the factor, 1, 2, 4 or 8, load_image shrinks a w x h image by to fit max_w x max_h
+ * 
+ * @param w the width of the image
+ * @param h the height of the image
+ * @param max_w the largest width wanted, 0 or less for any
+ * @param max_h the largest height wanted, 0 or less for any
+ * @return int the scale factor
+ */
+int load_scale_for(int w, int h, int max_w, int max_h);
+
+
+/**
+ * @brief Reads the size of an image file from its header without decoding it,
+ * for picking the max_w and max_h to load it with, any format load_image reads
+ * 
+ * @param filename the path of the image
+ * @param w set to the width of the image
+ * @param h set to the height of the image
+ * @return true if stb recognized the file
+ */
+bool image_file_size(const string& filename, int* w, int* h);
+
+void save_png(const ImageView& im, const string& name);
+void save_image(const ImageView& im, const string& name);
+
+
+#include "image_expr.h"
@@ -0,0 +1,233 @@
+// Lazy pointwise arithmetic on images
+//
+// Arithmetic on images builds a small tree of expression nodes instead of
+// computing anything. The tree is evaluated when it is assigned to an Image, in
+// one pass that writes every output pixel once, so
+//
+//   lk.error = (lk.warped - lk.pyramid1[0]).abs();
+//
+// allocates a single image and reads each input once. When every image in the
+// expression has the same geometry as the output the pass runs over the raw
+// buffers and vectorizes, otherwise it walks the pixels of each row.
+//
+// Nodes keep references to the images they read, so evaluate an expression in
+// the statement that builds it rather than holding on to it with auto.
+//
+// This header is included at the end of image.h.
+
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+
+#include "../../utils/thread_pool.h"
+
+
+// MARK: - Nodes
+
+template <class E> struct AbsExpr;
+template <class E> struct ClampExpr;
+
+// adds the chaining methods shared by every node
+template <class E>
+struct ExprOps {
+  const E& self() const { return static_cast<const E&>(*this); }
+
+  // |x| for every pixel
+  AbsExpr<E> abs() const;
+
+  // every pixel limited to [lo, hi]
+  ClampExpr<E> clamp(float lo=0.f, float hi=1.f) const;
+};
+
+
+// an Image read by an expression
+struct ImageLeaf : ExprOps<ImageLeaf> {
+  const Image& im;
+  const float* data;
+  size_t cstride;
+  int stride, pstride;
+
+  explicit ImageLeaf(const Image& im) : im(im), data(im.data), cstride(im.channel_stride()), stride(im.stride), pstride(im.pixel_stride()) {}
+
+  const Image& geometry() const { return im; }
+  bool matches(int w, int h, int c) const { return im.w == w && im.h == h && im.c == c; }
+  bool flat_with(const Image& out) const { return im.stride == out.stride && im.layout == out.layout && im.h == out.h && im.c == out.c; }
+
+  float flat(size_t i) const { return data[i]; }
+  float at(int x, int y, int ch) const { return data[ch*cstride + (size_t)y*stride + x*pstride]; }
+};
+
+
+// a constant used as an operand
+struct ScalarLeaf {
+  float v;
+
+  explicit ScalarLeaf(float v) : v(v) {}
+
+  bool matches(int, int, int) const { return true; }
+  bool flat_with(const Image&) const { return true; }
+
+  float flat(size_t) const { return v; }
+  float at(int, int, int) const { return v; }
+};
+
+
+struct AddOp { static float apply(float a, float b) { return a + b; } };
+struct SubOp { static float apply(float a, float b) { return a - b; } };
+struct MulOp { static float apply(float a, float b) { return a * b; } };
+struct DivOp { static float apply(float a, float b) { return a / b; } };
+
+
+// the image that gives a binary node its size and layout, a scalar never does
+template <class L, class R> const Image& geometry_of(const L& l, const R&)        { return l.geometry(); }
+template <class R>          const Image& geometry_of(const ScalarLeaf&, const R& r) { return r.geometry(); }
+
+
+template <class Op, class L, class R>
+struct BinaryExpr : ExprOps<BinaryExpr<Op, L, R>> {
+  L l;
+  R r;
+
+  BinaryExpr(const L& l, const R& r) : l(l), r(r) {}
+
+  const Image& geometry() const { return geometry_of(l, r); }
+  bool matches(int w, int h, int c) const { return l.matches(w, h, c) && r.matches(w, h, c); }
+  bool flat_with(const Image& out) const { return l.flat_with(out) && r.flat_with(out); }
+
+  float flat(size_t i) const { return Op::apply(l.flat(i), r.flat(i)); }
+  float at(int x, int y, int ch) const { return Op::apply(l.at(x, y, ch), r.at(x, y, ch)); }
+};
+
+
+template <class E>
+struct AbsExpr : ExprOps<AbsExpr<E>> {
+  E e;
+
+  explicit AbsExpr(const E& e) : e(e) {}
+
+  const Image& geometry() const { return e.geometry(); }
+  bool matches(int w, int h, int c) const { return e.matches(w, h, c); }
+  bool flat_with(const Image& out) const { return e.flat_with(out); }
+
+  float flat(size_t i) const { return fabsf(e.flat(i)); }
+  float at(int x, int y, int ch) const { return fabsf(e.at(x, y, ch)); }
+};
+
+
+template <class E>
+struct ClampExpr : ExprOps<ClampExpr<E>> {
+  E e;
+  float lo, hi;
+
+  ClampExpr(const E& e, float lo, float hi) : e(e), lo(lo), hi(hi) {}
+
+  const Image& geometry() const { return e.geometry(); }
+  bool matches(int w, int h, int c) const { return e.matches(w, h, c); }
+  bool flat_with(const Image& out) const { return e.flat_with(out); }
+
+  float flat(size_t i) const { return fminf(hi, fmaxf(lo, e.flat(i))); }
+  float at(int x, int y, int ch) const { return fminf(hi, fmaxf(lo, e.at(x, y, ch))); }
+};
+
+
+template <class E> AbsExpr<E> ExprOps<E>::abs() const                   { return AbsExpr<E>(self()); }
+template <class E> ClampExpr<E> ExprOps<E>::clamp(float lo, float hi) const { return ClampExpr<E>(self(), lo, hi); }
+
+
+template <class Op, class L, class R> struct is_image_node<BinaryExpr<Op, L, R>> : true_type {};
+template <class E> struct is_image_node<AbsExpr<E>> : true_type {};
+template <class E> struct is_image_node<ClampExpr<E>> : true_type {};
+template <> struct is_image_node<ImageLeaf> : true_type {};
+
+
+// anything that can be an operand: an Image or a node
+template <class T> struct is_image_expr : is_image_node<T> {};
+template <> struct is_image_expr<Image> : true_type {};
+
+
+// Images are wrapped in a leaf when they become an operand, nodes are copied as they are
+template <class T> struct expr_node { typedef T type; static const T& wrap(const T& t) { return t; } };
+template <> struct expr_node<Image> { typedef ImageLeaf type; static ImageLeaf wrap(const Image& im) { return ImageLeaf(im); } };
+
+
+// MARK: - Operators
+
+#define IMAGE_EXPR_OPERATOR(OP, NAME)                                                                      \
+template <class L, class R>                                                                                \
+typename enable_if<is_image_expr<L>::value && is_image_expr<R>::value,                                     \
+                   BinaryExpr<NAME, typename expr_node<L>::type, typename expr_node<R>::type>>::type       \
+operator OP(const L& a, const R& b) {                                                                      \
+  return BinaryExpr<NAME, typename expr_node<L>::type, typename expr_node<R>::type>(                       \
+    expr_node<L>::wrap(a), expr_node<R>::wrap(b));                                                         \
+}                                                                                                          \
+template <class L>                                                                                         \
+typename enable_if<is_image_expr<L>::value, BinaryExpr<NAME, typename expr_node<L>::type, ScalarLeaf>>::type \
+operator OP(const L& a, float b) {                                                                         \
+  return BinaryExpr<NAME, typename expr_node<L>::type, ScalarLeaf>(expr_node<L>::wrap(a), ScalarLeaf(b));  \
+}                                                                                                          \
+template <class R>                                                                                         \
+typename enable_if<is_image_expr<R>::value, BinaryExpr<NAME, ScalarLeaf, typename expr_node<R>::type>>::type \
+operator OP(float a, const R& b) {                                                                         \
+  return BinaryExpr<NAME, ScalarLeaf, typename expr_node<R>::type>(ScalarLeaf(a), expr_node<R>::wrap(b));  \
+}
+
+IMAGE_EXPR_OPERATOR(+, AddOp)
+IMAGE_EXPR_OPERATOR(-, SubOp)
+IMAGE_EXPR_OPERATOR(*, MulOp)
+IMAGE_EXPR_OPERATOR(/, DivOp)
+
+#undef IMAGE_EXPR_OPERATOR
+
+
+// MARK: - Evaluation
+
+// writes every pixel of an expression into an image of the same size
+template <class E>
+void evaluate(Image& out, const E& e) {
+  assert(e.matches(out.w, out.h, out.c) && "images in an expression must have the same size");
+
+  // same geometry everywhere, run over the whole buffer padding included, in
+  // blocks so buffers of 2^31 floats and more are indexed with size_t
+  if (e.flat_with(out)) {
+    const size_t n = out.buffer_size();
+    const size_t block = 1 << 14;
+    float* dst = out.data;
+    parallel_for(0, (int)((n + block - 1)/block), 1, [dst, &e, n, block](int a, int b) {
+      for (size_t i = (size_t)a*block, end = min(n, (size_t)b*block); i < end; i++) dst[i] = e.flat(i);
+    });
+    return;
+  }
+
+  const int ps = out.pixel_stride();
+  parallel_for(0, out.c*out.h, 16, [&out, &e, ps](int a, int b) {
+    for (int q = a; q < b; q++) {
+      int ch = q / out.h;
+      int y = q % out.h;
+      float* dst = out.RowPtr(y, ch);
+      for (int x = 0; x < out.w; x++) dst[x*ps] = e.at(x, y, ch);
+    }
+  });
+}
+
+
+// the output takes the layout and padding of the first image in the expression
+template <class E, class>
+Image::Image(const E& e) : Image(e.geometry().w, e.geometry().h, e.geometry().c, e.geometry().layout, !e.geometry().is_contiguous(), NoInit()) {
+  evaluate(*this, e);
+}
+
+
+// every pixel is read before it is written so the target may appear in the expression
+template <class E, class>
+Image& Image::operator=(const E& e) {
+  const Image& g = e.geometry();
+  if (g.w != w || g.h != h || g.c != c) return *this = Image(e);
+  evaluate(*this, e);
+  return *this;
+}
+
+
+template <class E> Image& Image::operator+=(const E& e) { return *this = *this + e; }
+template <class E> Image& Image::operator-=(const E& e) { return *this = *this - e; }
+template <class E> Image& Image::operator*=(const E& e) { return *this = *this * e; }
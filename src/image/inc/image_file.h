@@ -0,0 +1,145 @@
+// Binary image files that can be mapped straight into memory
+//
+// Image::save writes a 64 byte header followed by the image buffer exactly as
+// it is laid out in memory, padding included:
+//
+//   offset  size  field
+//        0     4  magic "DDIM"
+//        4     4  format version, IMAGE_FILE_VERSION when written
+//        8     4  pixel type, one of ImageFileDtype
+//       12     4  layout, Image::PLANAR or Image::INTERLEAVED
+//       16    16  width, height, channels and row stride in elements
+//       32     8  channel stride in elements
+//       40     8  offset of the pixels from the start of the file
+//       48     8  size of the pixels in bytes
+//       56     8  reserved, zero
+//
+// Fields are stored in the byte order of the machine that wrote them. The
+// pixels start on a 64 byte boundary, so a mapped file gives rows with the same
+// alignment as an Image in memory. Files written before the header existed
+// (width, height and channels followed by planar floats) still load with
+// Image::load.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "image.h"
+
+using namespace std;
+
+
+static const uint32_t IMAGE_FILE_VERSION = 1;
+
+
+enum ImageFileDtype : uint32_t {
+  DTYPE_F32 = 0,
+  DTYPE_U8 = 1,
+  DTYPE_U16 = 2,
+  DTYPE_F16 = 3,
+};
+
+
+struct ImageFileHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t dtype;
+  uint32_t layout;
+  int32_t w, h, c;
+  int32_t stride;
+  uint64_t cstride;
+  uint64_t data_offset;
+  uint64_t data_bytes;
+  uint64_t reserved;
+};
+
+static_assert(sizeof(ImageFileHeader) == 64, "the image file header must stay 64 bytes");
+
+
+/**
+ * @brief Checks a header against the size of its file: a known version of a
+ * float image whose strides keep every pixel inside the pixel data, which has
+ * to be inside the file. Image::load and MappedImage exit with the message.
+ *
+ * @param hd the header
+ * @param file_bytes the size of the file the header was read from
+ * @return const char* what is wrong, nullptr for a header that can be loaded
+ */
+const char* image_file_problem(const ImageFileHeader& hd, uint64_t file_bytes);
+
+
+/**
+ * @brief A float image file saved by Image::save and mapped into memory
+ * instead of read. Opening it costs a couple of system calls whatever the size
+ * of the image, pages are read from disk (or the page cache) the first time
+ * they are touched.
+ *
+ * The mapping is private: the pixels can be written through the view but the
+ * writes land in copies of the touched pages and never reach the file. Copies
+ * of a MappedImage share the mapping, which is released with the last of them,
+ * so views must not outlive every MappedImage they came from.
+ *
+ */
+class MappedImage
+{
+
+public:
+
+  /**
+   * @brief Constructs an empty mapping with an empty view
+   *
+   */
+  MappedImage();
+
+
+  /**
+   * @brief Maps a file written by Image::save. Exits with a message when the
+   * file can't be opened or isn't a float image of a known version.
+   *
+   * @param file the path of the file to map
+   */
+  explicit MappedImage(const string& file);
+
+
+  /**
+   * @brief gets the header of the mapped file
+   *
+   * @return const ImageFileHeader& the header
+   */
+  const ImageFileHeader& header() const;
+
+
+  /**
+   * @brief gets a view of the pixels, valid as long as the mapping is held
+   *
+   * @return ImageView the view of the mapped pixels
+   */
+  ImageView view() const;
+
+
+  /**
+   * @brief Copies the pixels into an Image that owns its buffer
+   *
+   * @return Image the copy
+   */
+  Image copy() const;
+
+
+  /**
+   * @brief checks whether a file is mapped
+   *
+   * @return true if a file is mapped
+   * @return false if this is an empty mapping
+   */
+  bool valid() const;
+
+
+private:
+
+  struct Mapping;
+  shared_ptr<Mapping> mapping;
+
+};
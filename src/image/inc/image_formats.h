@@ -0,0 +1,118 @@
+// Fast uncompressed and lossless image formats for intermediate results
+//
+// PNG through stb is slow to encode at large sizes, which makes it a poor fit
+// for checkpoints between pipeline stages. These formats cost little more than
+// a copy:
+//
+//   .qoi  8 bit rgb(a), lossless with a fast byte oriented compression
+//   .pfm  32 bit float, grey (Pf) or rgb (PF), keeps float images exactly
+//   .ppm  binary rgb (P6), 8 or 16 bit
+//   .pgm  binary grey (P5), 8 or 16 bit
+//
+// The format is picked from the extension of the file name. load_image and
+// load_image_u8 read these formats as well, any other extension still goes
+// through stb. As with stb, an alpha channel is dropped on load.
+
+#pragma once
+
+#include <string>
+
+#include "image.h"
+#include "typed_image.h"
+
+using namespace std;
+
+
+enum ImageFormat {
+  FORMAT_UNKNOWN,
+  FORMAT_JPG,
+  FORMAT_PNG,
+  FORMAT_QOI,
+  FORMAT_PFM,
+  FORMAT_PPM,
+  FORMAT_PGM,
+};
+
+
+/**
+ * @brief Picks the format of a file from its extension, ignoring case
+ *
+ * @param filename the name of the file
+ * @return ImageFormat the format, FORMAT_UNKNOWN for anything not listed above
+ */
+ImageFormat image_format_for(const string& filename);
+
+
+/**
+ * @brief checks whether a format is read and written by this module rather than by stb
+ *
+ * @param format the format
+ * @return true for qoi, pfm, ppm and pgm
+ */
+bool is_fast_format(ImageFormat format);
+
+
+/**
+ * @brief Loads a qoi, pfm, ppm or pgm file. Exits with a message when the file
+ * can't be read.
+ *
+ * @param filename the path of the file, its extension picks the format
+ * @param layout the layout of the returned image
+ * @return Image the loaded image, 8 and 16 bit samples are scaled to [0, 1]
+ */
+Image load_image_fast(const string& filename, Image::Layout layout=Image::PLANAR);
+
+
+/**
+ * @brief Loads a qoi, ppm or pgm file keeping 8 bit samples, 16 bit ones are
+ * rounded and pfm values are clamped to [0, 1] and rounded. Exits with a
+ * message when the file can't be read.
+ *
+ * @param filename the path of the file, its extension picks the format
+ * @return ImageU8 the loaded image
+ */
+ImageU8 load_image_fast_u8(const string& filename);
+
+
+/**
+ * @brief Reads the size of a qoi, pfm, ppm or pgm file from its header
+ *
+ * @param filename the path of the file, its extension picks the format
+ * @param w set to the width of the image
+ * @param h set to the height of the image
+ * @return true if the header could be read
+ */
+bool fast_image_size(const string& filename, int* w, int* h);
+
+
+/**
+ * @brief Saves an image in the format given by the extension of the file name,
+ * which is used as is. .jpg and .png go through stb. Values are rounded to 8
+ * bit the same way save_image does for every format but pfm. Grey images are
+ * saved as rgb in qoi, and rgb images are saved in pgm as grey with the
+ * weights of rgb_to_grayscale. Two channel images get a third channel of 0 in
+ * pfm, ppm and qoi, and keep their first channel in pgm.
+ *
+ * @param im the image to save, 1 to 3 channels
+ * @param filename the path to save to, including the extension
+ */
+void save_image_file(const ImageView& im, const string& filename);
+
+
+/**
+ * @brief Saves an 8 bit image in the format given by the extension of the file name
+ *
+ * @param im the image to save, 1 to 3 channels
+ * @param filename the path to save to, including the extension
+ */
+void save_image_file(const ImageU8& im, const string& filename);
+
+
+/**
+ * @brief Converts an image of any layout to interleaved 8 bit samples, rounding
+ * the way save_image does
+ *
+ * @param im the image to convert, at most 4 channels take the fast paths
+ * @param data receives w*h*c bytes
+ */
+void to_interleaved_u8(const ImageView& im, unsigned char* data);
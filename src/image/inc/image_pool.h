@@ -0,0 +1,102 @@
+// Recycling of Image data buffers
+
+#pragma once
+
+#include <cstddef>
+
+using namespace std;
+
+
+/**
+ * @brief An opt-in cache of freed Image buffers. Pipelines that create many
+ * short lived images of the same size (pyramid levels, structure matrices,
+ * transposes) pay for calloc/free and for the kernel zero filling fresh pages
+ * on every frame. With the pool enabled a freed buffer is parked in a size
+ * bucket and handed to the next image that needs a buffer of that bucket.
+ * 
+ * Each thread keeps a small private cache so the common case takes no lock,
+ * buffers that don't fit in it spill into a shared cache guarded by a mutex,
+ * and a thread's cache is handed to the shared one when the thread exits.
+ * trim drops the shared cache and the calling thread's at once, every other
+ * thread drops its own the next time it acquires or releases a buffer.
+ * 
+ * The pool is off by default. It can be turned on with set_enabled or by
+ * setting the DDIMG_IMAGE_POOL environment variable to 1.
+ * 
+ */
+class ImagePool
+{
+
+public:
+
+  /**
+   * @brief Turns the pool on or off. Turning it off releases every cached buffer
+   * 
+   * @param enabled whether freed buffers should be recycled
+   */
+  static void set_enabled(bool enabled);
+
+
+  /**
+   * @brief checks whether freed buffers are currently recycled
+   * 
+   * @return true if the pool is on
+   * @return false if buffers go straight back to the system
+   */
+  static bool enabled();
+
+
+  /**
+   * @brief Sets how many bytes the shared cache may hold before freed
+   * buffers are returned to the system instead
+   * 
+   * @param bytes the capacity of the shared cache
+   */
+  static void set_capacity(size_t bytes);
+
+
+  /**
+   * @brief Gets an aligned buffer of at least the requested size, its content is undefined
+   * 
+   * @param bytes the number of bytes needed
+   * @return void* a buffer aligned to Image::ALIGNMENT bytes
+   */
+  static void* acquire(size_t bytes);
+
+
+  /**
+   * @brief Returns a buffer obtained from acquire. The size must be the one it was acquired with
+   * 
+   * @param ptr the buffer
+   * @param bytes the number of bytes it was acquired with
+   */
+  static void release(void* ptr, size_t bytes);
+
+
+  /**
+   * @brief Frees every buffer held in the shared cache and in the calling
+   * thread's cache. The caches of other threads are freed when those threads
+   * next acquire or release a buffer, or exit.
+   * 
+   */
+  static void trim();
+
+
+  /**
+   * @brief gets the number of bytes currently parked in the shared cache and
+   * the calling thread's cache
+   * 
+   * @return size_t the number of cached bytes
+   */
+  static size_t cached_bytes();
+
+
+  /**
+   * @brief rounds a request up to the size of the bucket it is served from
+   * 
+   * @param bytes the number of bytes requested
+   * @return size_t the number of bytes actually allocated
+   */
+  static size_t bucket_size(size_t bytes);
+
+};
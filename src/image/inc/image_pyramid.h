@@ -0,0 +1,110 @@
+// Multi-resolution pyramids built on demand
+//
+// A pyramid holds an image at a number of resolutions, each level smaller than
+// the one before by a constant factor. Levels are only made when first asked
+// for and kept afterwards, so code that needs the coarse levels of a frame
+// more than once (optical flow between consecutive frames uses every frame
+// twice) pays for them once. Copies of an ImagePyramid share their levels.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "image.h"
+
+using namespace std;
+
+
+/**
+ * @brief Gaussian and Laplacian levels of an image. Level 0 of the Gaussian
+ * pyramid is the image itself and level l is level l-1 smoothed with a
+ * Gaussian of sigma factor/1.5 and shrunk by factor, see smooth_resize.
+ * Safe to read from several threads.
+ *
+ */
+class ImagePyramid
+{
+
+public:
+
+  /**
+   * @brief An empty pyramid without levels
+   *
+   */
+  ImagePyramid();
+
+
+  /**
+   * @brief Makes a pyramid over an image, no level but the first is built yet
+   *
+   * @param base the full resolution image, copied
+   * @param factor the ratio of sizes between successive levels, more than 1
+   * @param levels the number of levels, 0 for as many as it takes to reach a
+   * side of 1 pixel
+   */
+  ImagePyramid(const Image& base, float factor=2, int levels=0);
+
+
+  /**
+   * @brief Makes a pyramid over an image that is moved in as level 0 instead
+   * of copied
+   *
+   * @param base the full resolution image, moved
+   * @param factor the ratio of sizes between successive levels, more than 1
+   * @param levels the number of levels, 0 for as many as it takes to reach a
+   * side of 1 pixel
+   */
+  ImagePyramid(Image&& base, float factor=2, int levels=0);
+
+
+  /**
+   * @brief Gets a level of the Gaussian pyramid, building it and the levels
+   * above it if needed
+   *
+   * @param level the level, 0 is the full resolution
+   * @return const Image& the level, valid as long as a copy of the pyramid is alive
+   */
+  const Image& gaussian(int level) const;
+  const Image& operator[](int level) const { return gaussian(level); }
+
+
+  /**
+   * @brief Gets a level of the Laplacian pyramid: the Gaussian level minus the
+   * next one bilinear resized back up to its size. The last level is the last
+   * Gaussian level so the image can be rebuilt from the Laplacian levels.
+   *
+   * @param level the level, 0 is the full resolution
+   * @return const Image& the level, valid as long as a copy of the pyramid is alive
+   */
+  const Image& laplacian(int level) const;
+
+
+  /**
+   * @brief Builds every Gaussian level and copies them out
+   *
+   * @return vector<Image> the levels from full resolution down
+   */
+  vector<Image> gaussian_levels() const;
+
+
+  int levels() const;
+  float factor() const { return scale; }
+  bool empty() const   { return levels() == 0; }
+
+
+private:
+
+  struct Levels {
+    mutex lock;
+    vector<Image> gaussian;
+    vector<Image> laplacian;
+    vector<bool> has_gaussian;
+    vector<bool> has_laplacian;
+  };
+
+  float scale;
+  shared_ptr<Levels> cache;
+
+};
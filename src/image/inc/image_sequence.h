@@ -0,0 +1,189 @@
+// Loading numbered frame sequences
+//
+// Frames are named by a printf style pattern with a single integer conversion,
+// e.g. "frames_train/frame%04d.jpg". load_image_sequence decodes a whole range
+// at once on the shared thread pool. SequenceReader streams a range instead,
+// decoding a bounded window of frames ahead of the one being processed so
+// decoding overlaps the processing and at most window frames are held at once.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+#include "image.h"
+#include "typed_image.h"
+
+using namespace std;
+
+
+/**
+ * @brief A half open range of frame numbers [begin, end)
+ *
+ */
+struct FrameRange
+{
+  int begin, end;
+
+  FrameRange(int begin, int end) : begin(begin), end(end) {}
+
+  int size() const { return end > begin ? end - begin : 0; }
+};
+
+
+/**
+ * @brief Builds the name of one frame of a sequence
+ *
+ * @param pattern printf style pattern with one integer conversion
+ * @param index the frame number
+ * @return string the file name of the frame
+ */
+string sequence_filename(const string& pattern, int index);
+
+
+/**
+ * @brief Loads every frame of a range, decoding up to n_threads frames at a time
+ *
+ * @param pattern printf style pattern with one integer conversion
+ * @param range the frame numbers to load
+ * @param n_threads the most frames decoded at once, 0 for one per pool thread
+ * @return vector<Image> the frames in order
+ */
+vector<Image> load_image_sequence(const string& pattern, FrameRange range, int n_threads=0);
+
+
+/**
+ * @brief Same as load_image_sequence but keeps the frames as 8 bit pixels
+ *
+ * @param pattern printf style pattern with one integer conversion
+ * @param range the frame numbers to load
+ * @param n_threads the most frames decoded at once, 0 for one per pool thread
+ * @return vector<ImageU8> the frames in order
+ */
+vector<ImageU8> load_image_sequence_u8(const string& pattern, FrameRange range, int n_threads=0);
+
+
+/**
+ * @brief Reads the frames of a range in order while the following ones are
+ * decoded on the shared thread pool. Up to window frames are loaded or being
+ * loaded ahead of the consumer, and a slot is only refilled once next() has
+ * handed its frame over, which caps the memory held by the reader.
+ *
+ * When next() gets to a frame whose decode no worker has started, it decodes
+ * the frame itself and the queued task does nothing, so a reader can be used
+ * from inside pool work even when every worker is busy.
+ *
+ * Instantiated for Image and ImageU8, see ImageSequenceReader and
+ * ImageSequenceReaderU8.
+ *
+ */
+template <class T>
+class SequenceReader
+{
+
+public:
+
+  typedef function<T(const string&)> Loader;
+
+
+  /**
+   * @brief Starts decoding the first window frames of the range
+   *
+   * @param pattern printf style pattern with one integer conversion
+   * @param range the frame numbers to read
+   * @param window the most frames decoded ahead of the consumer, at least 1
+   * @param load the decoder run on each file name
+   */
+  SequenceReader(const string& pattern, FrameRange range, int window, Loader load);
+
+
+  /**
+   * @brief Cancels the decodes no worker has started and waits for the ones
+   * being run, their results are dropped
+   *
+   */
+  ~SequenceReader();
+
+
+  /**
+   * @brief Takes the next frame of the range, decoding it on this thread if
+   * no worker has started it, or waiting for the worker that has
+   *
+   * @param frame receives the frame
+   * @return true if a frame was returned
+   * @return false if the range is exhausted
+   */
+  bool next(T& frame);
+
+
+  /**
+   * @brief the frame number the next call to next() returns
+   *
+   * @return int the frame number, range.end once exhausted
+   */
+  int position() const { return cursor; }
+
+
+private:
+
+  enum SlotState { EMPTY, QUEUED, RUNNING, READY };
+
+  struct Slot {
+    T frame;
+    int index;        // the frame the slot holds or is waiting for
+    SlotState state;
+  };
+
+  // everything the queued decodes touch, they keep it alive past the reader
+  struct Shared {
+    string pattern;
+    FrameRange range;
+    Loader load;
+    vector<Slot> slots;
+    mutex lock;
+    condition_variable changed;
+
+    Shared(const string& pattern, FrameRange range, int window, Loader load)
+      : pattern(pattern), range(range), load(load), slots(window) {}
+
+    Slot& slot_for(int index) { return slots[(index - range.begin) % slots.size()]; }
+  };
+
+  shared_ptr<Shared> shared;
+  FrameRange range;
+  int cursor;       // next frame handed to the consumer
+  int scheduled;    // next frame to start decoding
+
+  void schedule(unique_lock<mutex>& guard);
+  static void decode(Shared& shared, Slot& slot, unique_lock<mutex>& guard);
+
+  SequenceReader(const SequenceReader&) = delete;
+  SequenceReader& operator=(const SequenceReader&) = delete;
+
+};
+
+
+/**
+ * @brief Streams float frames decoded with load_image
+ *
+ */
+class ImageSequenceReader : public SequenceReader<Image>
+{
+public:
+  ImageSequenceReader(const string& pattern, FrameRange range, int window=8);
+};
+
+
+/**
+ * @brief Streams 8 bit frames decoded with load_image_u8
+ *
+ */
+class ImageSequenceReaderU8 : public SequenceReader<ImageU8>
+{
+public:
+  ImageSequenceReaderU8(const string& pattern, FrameRange range, int window=8);
+};
@@ -0,0 +1,129 @@
+// Saving images in the background
+//
+// save_image and save_png encode on the calling thread, which turns the output
+// of a long sequence into a serial phase of its own. ImageWriter takes a copy
+// of each image into a bounded queue and encodes it on its own threads, so the
+// caller can carry on computing the next frame while earlier ones are written.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "image.h"
+#include "typed_image.h"
+
+using namespace std;
+
+
+/**
+ * @brief A queue of images waiting to be encoded and the threads encoding
+ * them. Adding an image blocks while capacity images are already waiting or
+ * being encoded, which caps the memory held by the queue. Files are written
+ * in no particular order.
+ *
+ */
+class ImageWriter
+{
+
+public:
+
+  /**
+   * @brief Starts the encoding threads
+   *
+   * @param capacity the most images queued or being encoded at once, at least 1
+   * @param n_threads the number of encoding threads, 0 for half the thread pool
+   */
+  explicit ImageWriter(int capacity=16, int n_threads=0);
+
+
+  /**
+   * @brief Writes everything still queued and stops the threads
+   *
+   */
+  ~ImageWriter();
+
+
+  /**
+   * @brief Queues a copy of an image to be saved as a jpg, see save_image
+   *
+   * @param im the image to save
+   * @param name the path to save to without the extension
+   */
+  void save_image(const ImageView& im, const string& name);
+
+
+  /**
+   * @brief Queues a copy of an image to be saved as a png, see save_png
+   *
+   * @param im the image to save
+   * @param name the path to save to without the extension
+   */
+  void save_png(const ImageView& im, const string& name);
+
+
+  /**
+   * @brief Queues an 8 bit image to be saved as a jpg, pass an rvalue to skip the copy
+   *
+   * @param im the image to save
+   * @param name the path to save to without the extension
+   */
+  void save_image(ImageU8 im, const string& name);
+
+
+  /**
+   * @brief Queues an 8 bit image to be saved as a png, pass an rvalue to skip the copy
+   *
+   * @param im the image to save
+   * @param name the path to save to without the extension
+   */
+  void save_png(ImageU8 im, const string& name);
+
+
+  /**
+   * @brief Waits until every image queued so far has been written
+   *
+   */
+  void flush();
+
+
+  /**
+   * @brief gets the number of images queued or being encoded
+   *
+   * @return int the number of unfinished images
+   */
+  int pending();
+
+
+private:
+
+  struct Job {
+    Image im;
+    ImageU8 im8;
+    bool u8;
+    bool png;
+    string name;
+  };
+
+  deque<Job> jobs;
+  vector<thread> workers;
+  int capacity;
+  int unfinished;   // queued plus being encoded
+  bool stopping;
+
+  mutex lock;
+  condition_variable has_job;
+  condition_variable has_room;
+  condition_variable drained;
+
+  void push(Job&& job);
+  void run();
+
+  ImageWriter(const ImageWriter&) = delete;
+  ImageWriter& operator=(const ImageWriter&) = delete;
+
+};
@@ -0,0 +1,115 @@
+// Summed area tables
+//
+// An IntegralImage holds, for every position, the sum of the pixels above and
+// to the left of it, so the sum over any rectangle is four lookups whatever its
+// size. Box filters, the window sums of Lucas-Kanade and tests of whether a
+// patch has anything in it then cost the same for a window of 3 pixels as for
+// one of 300. Sums are kept in doubles, which hold the sum of a whole frame of
+// floats without the cancellation a float table suffers from when two large
+// corner sums are subtracted.
+
+#pragma once
+
+#include <vector>
+
+#include "image.h"
+
+using namespace std;
+
+
+/**
+ * @brief The summed area table of every channel of an image, optionally over
+ * the image extended past its borders by repeating the edge pixels, the way
+ * the filters in filter_image.h clamp. Built in parallel, read only after.
+ *
+ */
+class IntegralImage
+{
+
+public:
+
+  /**
+   * @brief An empty table over a 0x0 image
+   *
+   */
+  IntegralImage() {}
+
+
+  /**
+   * @brief Builds the table of an image, the rows and then the columns on the
+   * thread pool
+   *
+   * @param im the image, any layout
+   * @param pad how far past every border the table reaches, the pixels out
+   * there repeat the nearest edge pixel
+   */
+  explicit IntegralImage(const ImageView& im, int pad=0);
+
+
+  /**
+   * @brief The table of the number of channels that aren't 0 at every pixel,
+   * with a single channel, for checking many patches for content
+   *
+   * @param im the image
+   * @return IntegralImage the table of the counts
+   */
+  static IntegralImage nonzero(const ImageView& im);
+
+
+  /**
+   * @brief Sums the pixels x0 <= x < x1, y0 <= y < y1 of a channel. The corners
+   * can be anywhere from -pad to the size plus pad, an empty or inverted
+   * rectangle sums to 0.
+   *
+   * @param x0 the first column
+   * @param y0 the first row
+   * @param x1 one past the last column
+   * @param y1 one past the last row
+   * @param ch the channel
+   * @return double the sum
+   */
+  double box_sum(int x0, int y0, int x1, int y1, int ch=0) const {
+    if (x1 <= x0 || y1 <= y0) return 0;
+    const double* t = &table[(size_t)ch*plane];
+    const size_t a = (size_t)(y0 + pad)*stride, b = (size_t)(y1 + pad)*stride;
+    return t[b + x1 + pad] - t[b + x0 + pad] - t[a + x1 + pad] + t[a + x0 + pad];
+  }
+
+
+  /**
+   * @brief A row of the table for walking along it, row(y, ch)[x] is the sum of
+   * the pixels left of x and above y
+   *
+   * @param y the row, from -pad to h + pad
+   * @param ch the channel
+   * @return const double* the entry of x = 0, readable from -pad to w + pad
+   */
+  const double* row(int y, int ch=0) const { return &table[(size_t)ch*plane + (size_t)(y + pad)*stride + pad]; }
+
+
+  /**
+   * @brief Whether the patch of side 2*r+1 centred on (x, y) of the image a
+   * nonzero() table was built from has a nonzero pixel, the same answer as
+   * Image::is_nonempty_patch(x, y, r)
+   *
+   * @param x the x position
+   * @param y the y position
+   * @param r the offset from (x, y) to check in all directions
+   * @return true if some pixel of the patch isn't 0
+   */
+  bool is_nonempty_patch(int x, int y, int r=0) const;
+
+
+  int w = 0;    // the size of the image the table is over
+  int h = 0;
+  int c = 0;
+  int pad = 0;
+
+
+private:
+
+  size_t stride = 0;      // w + 2*pad + 1
+  size_t plane = 0;       // stride*(h + 2*pad + 1)
+  vector<double> table;   // table[(y + pad)*stride + x + pad] sums the pixels left of x and above y
+
+};
@@ -0,0 +1,72 @@
+// Vectorized building blocks of the filters, resamplers, matchers and loaders
+//
+// Like the pointwise kernels these come in SSE4.2, AVX2 and AVX-512 versions
+// picked at run time with a scalar fallback. All but the reductions (dot and
+// l1_distance) give the same result on every cpu; the reductions sum in a
+// different order per instruction set and may differ in the last bits.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Sum of a[i]*b[i].
+float kernel_dot(const float* a, const float* b, int n);
+
+
+// Sum of |a[i] - b[i]|.
+float kernel_l1_distance(const float* a, const float* b, int n);
+
+
+// y[i] = y[i] + a*x[i]
+void kernel_axpy(float* y, const float* x, int n, float a);
+
+
+// out[i] = a[i]*wa + b[i]*wb, out may be a or b
+void kernel_blend_rows(float* out, const float* a, const float* b, float wa, float wb, int n);
+
+
+
+// out[i] = sum over k < taps of src[index[k*n + i]]*weight[k*n + i], added in
+// tap order. The tables hold n entries per tap.
+void kernel_resample_row(float* out, const float* src, const int* index, const float* weight, int taps, int n);
+
+
+// out[x] = out[x] + sum over j < fh, i < fw of taps[j*fw + i]*rows[j][x + i],
+// adding one product at a time in that order. Every rows[j] must be readable
+// up to n + fw - 1 floats.
+void kernel_convolve_row(float* out, const float* const* rows, const float* taps, int fw, int fh, int n);
+
+// out[i] = 0.299*r[i] + 0.587*g[i] + 0.114*b[i]
+void kernel_rgb_to_gray(float* out, const float* r, const float* g, const float* b, int n);
+
+
+// Converts n pixels from rgb to hsv in place, same as rgb2hsv in colourspaces.h.
+void kernel_rgb_to_hsv(float* r, float* g, float* b, int n);
+
+
+// Converts n pixels from hsv to rgb in place, same as hsv2rgb in colourspaces.h.
+void kernel_hsv_to_rgb(float* h, float* s, float* v, int n);
+
+
+// Writes the transpose of the rows x cols block at src into dst, which must
+// not overlap it. Strides are in floats.
+void kernel_transpose(float* dst, size_t dst_stride, const float* src, size_t src_stride, int rows, int cols);
+
+
+// dst[i] = src[i]/255
+void kernel_u8_to_float(float* dst, const uint8_t* src, int n);
+
+
+// Splits n pixels of c interleaved bytes into the first nplanes float planes,
+// dividing by 255.
+void kernel_u8_deinterleave(float* const* planes, int nplanes, const uint8_t* src, int c, int n);
+
+
+// dst[i] = roundf(255*src[i]), values outside [0, 1] wrap around like a cast
+void kernel_float_to_u8(uint8_t* dst, const float* src, int n);
+
+
+// Interleaves n pixels of c float planes into bytes, rounding like kernel_float_to_u8.
+void kernel_float_interleave_u8(uint8_t* dst, int c, const float* const* planes, int n);
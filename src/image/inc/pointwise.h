@@ -0,0 +1,35 @@
+// Vectorized kernels over contiguous runs of floats
+//
+// Every kernel has an SSE4.2, AVX2 and AVX-512 version and picks the widest
+// one the cpu supports at run time (see cpu_dispatch.h), with a scalar
+// fallback for other cpus. The Image methods that touch every pixel (shift,
+// scale, clamp, abs and the normalizations) call these on each contiguous
+// span of the image.
+
+#pragma once
+
+#include <cstddef>
+
+
+// p[i] += v
+void pointwise_add(float* p, size_t n, float v);
+
+
+// p[i] = p[i]*a + b
+void pointwise_affine(float* p, size_t n, float a, float b);
+
+
+// p[i] = min(max(p[i], lo), hi)
+void pointwise_clamp(float* p, size_t n, float lo, float hi);
+
+
+// dst[i] = |src[i]|, dst may be src
+void pointwise_abs(float* dst, const float* src, size_t n);
+
+
+// Finds the smallest and largest value in one pass. n must be at least 1.
+void pointwise_min_max(const float* p, size_t n, float* min, float* max);
+
+
+// Sum of the values.
+float pointwise_sum(const float* p, size_t n);
@@ -0,0 +1,130 @@
+// Separable resampling with precomputed tables
+//
+// A resize is split into a horizontal and a vertical pass. Along each axis
+// every output sample is a weighted sum of a few source samples; which ones
+// and with what weights depends only on the two sizes, so it is worked out
+// once into a ResampleAxis instead of per pixel. The horizontal pass gathers
+// through the column table into a band of rows, the vertical pass blends whole
+// rows of that band, both with the vectorized kernels, and bands of output
+// rows run on the thread pool.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "image.h"
+
+using namespace std;
+
+
+/**
+ * @brief The source samples and weights of every output sample along one axis
+ *
+ */
+struct ResampleAxis
+{
+  int src = 0;            // the size of the source along this axis
+  int dst = 0;            // the size of the output along this axis
+  int taps = 0;           // the number of source samples per output sample
+  vector<int> index;      // taps*dst source indices, tap major, clamped to [0, src)
+  vector<float> weight;   // taps*dst weights in the same order
+};
+
+
+/**
+ * @brief The tables of a nearest neighbour resize, the same samples nn_interpolate picks
+ *
+ * @param src the size of the source along the axis
+ * @param dst the size of the output along the axis
+ * @return ResampleAxis one tap of weight 1 per output sample
+ */
+ResampleAxis nn_axis(int src, int dst);
+
+
+/**
+ * @brief The tables of a bilinear resize with the weights of bilinear_interpolate
+ *
+ * @param src the size of the source along the axis
+ * @param dst the size of the output along the axis
+ * @return ResampleAxis two taps per output sample
+ */
+ResampleAxis bilinear_axis(int src, int dst);
+
+
+/**
+ * @brief The tables of an area resize: every output sample averages the part of
+ * the source it covers, each source sample weighted by how much of it is covered
+ *
+ * @param src the size of the source along the axis
+ * @param dst the size of the output along the axis
+ * @return ResampleAxis about src/dst + 1 taps per output sample when shrinking
+ */
+ResampleAxis area_axis(int src, int dst);
+
+
+/**
+ * @brief The tables of a resize with a windowed filter (bicubic, Mitchell or
+ * Lanczos3). When shrinking the filter is stretched by the scale so every
+ * source sample contributes and the result doesn't alias. The weights of
+ * every output sample sum to 1.
+ *
+ * @param src the size of the source along the axis
+ * @param dst the size of the output along the axis
+ * @param filter one of the windowed filters
+ * @return ResampleAxis 2*radius*max(1, src/dst) taps per output sample, rounded up
+ */
+ResampleAxis windowed_axis(int src, int dst, ResampleFilter filter);
+
+
+/**
+ * @brief The tables of a resize with any filter from a cache keyed by the sizes
+ * and the filter, so resizing many frames of the same size works the weights
+ * out once. Safe to call from several threads.
+ *
+ * @param src the size of the source along the axis
+ * @param dst the size of the output along the axis
+ * @param filter the filter
+ * @return shared_ptr<const ResampleAxis> the tables, stays valid after the cache drops them
+ */
+shared_ptr<const ResampleAxis> cached_axis(int src, int dst, ResampleFilter filter);
+
+
+/**
+ * @brief Folds a 1d filter applied to the source before resampling into the
+ * tables, so filtering and resampling happen in one pass. The filter is
+ * centred on each sample and clamped at the borders like the filters in
+ * filter_image.h.
+ *
+ * @param axis the tables of the resampling
+ * @param taps the filter, an odd number of taps
+ * @return ResampleAxis tables giving the resampled filtered source
+ */
+ResampleAxis filtered_axis(const ResampleAxis& axis, const vector<float>& taps);
+
+
+/**
+ * @brief Resamples an image with a table per axis. The output is interleaved
+ * when the image is packed interleaved and planar otherwise.
+ *
+ * @param im the image to resample
+ * @param cols the tables for the columns, cols.src must be im.w
+ * @param rows the tables for the rows, rows.src must be im.h
+ * @return Image a new image of cols.dst by rows.dst
+ */
+Image resample(const ImageView& im, const ResampleAxis& cols, const ResampleAxis& rows);
+
+
+/**
+ * @brief Smooths with fast_smooth_image(im, sigma, SMOOTH_FIR) and bilinear resizes in a
+ * single pass without the full size intermediate image, which is how the
+ * levels of an image pyramid are made. The result matches the two steps up to
+ * rounding.
+ *
+ * @param im the image to shrink
+ * @param sigma the standard deviation of the Gaussian
+ * @param w the new width
+ * @param h the new height
+ * @return Image a new resized image
+ */
+Image smooth_resize(const ImageView& im, float sigma, int w, int h);
@@ -385,6 +385,10 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
+// decodes a jpeg file at 1/2^scale_log2 of its size, scale_log2 0 to 3, with
+// reduced idcts (dc only for 1/8) so the full size image is never made. The
+// size is rounded up. Fails on anything but a jpeg, ignores vertical flipping.
+STBIDEF stbi_uc *stbi_load_jpeg_scaled(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int scale_log2);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
@@ -1767,6 +1771,8 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // blocks decode to (8 >> scale_shift) pixels square
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2723,7 +2729,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+(z->img_comp[n].w2*j+i)*(8 >> z->scale_shift), z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2747,8 +2753,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*(8 >> z->scale_shift);
+                        int y2 = (j*z->img_comp[n].v + y)*(8 >> z->scale_shift);
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
@@ -2848,7 +2854,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+(z->img_comp[n].w2*j+i)*(8 >> z->scale_shift), z->img_comp[n].w2, data);
             }
          }
       }
@@ -3078,8 +3084,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // a scaled decode keeps the coefficients of every block but only
+      // 8 >> scale_shift pixels of it on each side
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3089,10 +3097,9 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3547,9 +3554,85 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+// reduced idcts: every n x n group of the 8 x 8 pixels of a block set to the
+// mean of the group, straight from the coefficients, which is the block
+// average of the full idct without computing it. The weight of coefficient u
+// for group x is c(u)/2 * the mean of cos((2X+1) u pi / 16) over the X of the
+// group, c(0) = 1/sqrt(2), c(u) = 1; groups mirrored about the centre share
+// the even weights and negate the odd ones, so each pass sums both halves once.
+#define STBI__R_C0  0.35355339f
+
+// 8 coefficients to 4 group sums, o[0..3]
+#define STBI__IDCT_R4(o, d0,d1,d2,d3,d5,d6,d7) { \
+   float e0 = STBI__R_C0*(d0) + 0.32664074f*(d2) - 0.13529903f*(d6); \
+   float e1 = STBI__R_C0*(d0) - 0.32664074f*(d2) + 0.13529903f*(d6); \
+   float o0 = 0.45306372f*(d1) + 0.15909482f*(d3) - 0.10630376f*(d5) - 0.09011998f*(d7); \
+   float o1 = 0.18766514f*(d1) - 0.38408888f*(d3) + 0.25663998f*(d5) - 0.03732892f*(d7); \
+   o[0] = e0 + o0; o[3] = e0 - o0; \
+   o[1] = e1 + o1; o[2] = e1 - o1; \
+   }
+
+// 8 coefficients to 2 group sums, o[0..1]; the even weights past dc are 0
+#define STBI__IDCT_R2(o, d0,d1,d3,d5,d7) { \
+   float e = STBI__R_C0*(d0); \
+   float od = 0.32036443f*(d1) - 0.11249703f*(d3) + 0.07516811f*(d5) - 0.06372445f*(d7); \
+   o[0] = e + od; o[1] = e - od; \
+   }
+
+static void stbi__idct_reduced_4(stbi_uc *out, int out_stride, short data[64])
+{
+   float rows[8][4], col[4];
+   int v, x, y;
+   for (v=0; v < 8; ++v) {
+      const short *d = data + v*8;
+      float *r = rows[v];
+      // most rows are dc only or empty
+      if (d[1]==0 && d[2]==0 && d[3]==0 && d[5]==0 && d[6]==0 && d[7]==0) {
+         r[0] = r[1] = r[2] = r[3] = STBI__R_C0 * d[0];
+      } else
+         STBI__IDCT_R4(r, d[0],d[1],d[2],d[3],d[5],d[6],d[7])
+   }
+   for (x=0; x < 4; ++x) {
+      STBI__IDCT_R4(col, rows[0][x],rows[1][x],rows[2][x],rows[3][x],rows[5][x],rows[6][x],rows[7][x])
+      for (y=0; y < 4; ++y) {
+         float sum = col[y] + 128.5f;
+         out[y*out_stride + x] = stbi__clamp(sum < 0 ? 0 : (int) sum);
+      }
+   }
+}
+
+static void stbi__idct_reduced_2(stbi_uc *out, int out_stride, short data[64])
+{
+   float rows[8][2], col[2], s0, s1;
+   int v, x;
+   for (v=0; v < 8; ++v) {
+      const short *d = data + v*8;
+      STBI__IDCT_R2(rows[v], d[0],d[1],d[3],d[5],d[7])
+   }
+   for (x=0; x < 2; ++x) {
+      STBI__IDCT_R2(col, rows[0][x],rows[1][x],rows[3][x],rows[5][x],rows[7][x])
+      s0 = col[0] + 128.5f;
+      s1 = col[1] + 128.5f;
+      out[x] = stbi__clamp(s0 < 0 ? 0 : (int) s0);
+      out[out_stride + x] = stbi__clamp(s1 < 0 ? 0 : (int) s1);
+   }
+}
+
+#undef STBI__IDCT_R4
+#undef STBI__IDCT_R2
+#undef STBI__R_C0
+
+static void stbi__idct_reduced_1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   float sum = data[0] * 0.125f + 128.5f;
+   out[0] = stbi__clamp(sum < 0 ? 0 : (int) sum);
+}
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   j->scale_shift = 0;
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3603,6 +3686,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // the blocks were decoded scaled, everything after works on the scaled size
+   if (z->scale_shift) {
+      int k, round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale_shift;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3796,6 +3890,34 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    STBI_FREE(j);
    return result;
 }
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_jpeg_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int scale_log2)
+{
+   static void (*const reduced[4])(stbi_uc *, int, short[64]) = { NULL, stbi__idct_reduced_4, stbi__idct_reduced_2, stbi__idct_reduced_1 };
+   stbi__context s;
+   stbi__jpeg *j;
+   stbi_uc *result;
+   FILE *f;
+   if (scale_log2 < 0 || scale_log2 > 3) return stbi__errpuc("bad scale", "Internal error");
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s, f);
+   if (!stbi__jpeg_test(&s)) { fclose(f); return stbi__errpuc("not JPEG", "Image not of a jpeg type"); }
+   j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) { fclose(f); return stbi__errpuc("outofmem", "Out of memory"); }
+   j->s = &s;
+   stbi__setup_jpeg(j);
+   if (scale_log2) {
+      j->scale_shift = scale_log2;
+      j->idct_block_kernel = reduced[scale_log2];
+   }
+   result = load_jpeg_image(j, x, y, comp, req_comp);
+   STBI_FREE(j);
+   fclose(f);
+   return result;
+}
+#endif
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
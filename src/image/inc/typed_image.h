@@ -0,0 +1,251 @@
+// Images stored with a pixel type other than float
+
+#pragma once
+
+#include <cstdint>
+
+#include "image.h"
+
+using namespace std;
+
+
+/**
+ * @brief 16 bit IEEE 754 half precision float used purely as a storage type.
+ * Arithmetic is done by converting to float.
+ *
+ */
+struct half {
+  uint16_t bits;
+
+  half() : bits(0) {}
+  explicit half(float v);
+  operator float() const;
+};
+
+
+/**
+ * @brief converts a float to the bit pattern of the nearest half, rounding ties to even
+ *
+ * @param v the value to convert
+ * @return uint16_t the half precision bit pattern
+ */
+uint16_t float_to_half(float v);
+
+
+/**
+ * @brief converts the bit pattern of a half to a float, this is exact
+ *
+ * @param h the half precision bit pattern
+ * @return float the value it represents
+ */
+float half_to_float(uint16_t h);
+
+
+inline half::half(float v) : bits(float_to_half(v)) {}
+inline half::operator float() const { return half_to_float(bits); }
+
+
+/**
+ * @brief Describes how a storage type maps onto the [0,1] float range used by Image.
+ * Integer types store v*max rounded to the nearest integer and clamped, float
+ * types store the value as is.
+ *
+ */
+template <class T> struct pixel_traits;
+
+template <> struct pixel_traits<uint8_t> {
+  static float to_float(uint8_t v)   { return v * (1.f/255.f); }
+  static uint8_t from_float(float v) { return (uint8_t)roundf(fmaxf(0.f, fminf(1.f, v)) * 255.f); }
+};
+
+template <> struct pixel_traits<uint16_t> {
+  static float to_float(uint16_t v)   { return v * (1.f/65535.f); }
+  static uint16_t from_float(float v) { return (uint16_t)roundf(fmaxf(0.f, fminf(1.f, v)) * 65535.f); }
+};
+
+template <> struct pixel_traits<half> {
+  static float to_float(half v)   { return (float)v; }
+  static half from_float(float v) { return half(v); }
+};
+
+template <> struct pixel_traits<float> {
+  static float to_float(float v)   { return v; }
+  static float from_float(float v) { return v; }
+};
+
+
+/**
+ * @brief A planar image whose pixels are stored as T. It has the same channel
+ * major layout as Image without padding: pixel (x,y,ch) lives at ch*w*h + y*w + x.
+ * Conversions to and from Image are explicit so the cost of widening to float
+ * is always visible at the call site.
+ *
+ */
+template <class T>
+struct TypedImage {
+  int w, h, c;
+  vector<T> data;
+
+  TypedImage() : w(0), h(0), c(0) {}
+  TypedImage(int w, int h, int c=1) : w(w), h(h), c(c), data((size_t)w*h*c) {}
+
+        T& operator()(int x, int y, int ch)       { assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0); return data[((size_t)ch*h + y)*w + x]; }
+  const T& operator()(int x, int y, int ch) const { assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0); return data[((size_t)ch*h + y)*w + x]; }
+
+        T* RowPtr(int row, int ch)       { return data.data() + ((size_t)ch*h + row)*w; }
+  const T* RowPtr(int row, int ch) const { return data.data() + ((size_t)ch*h + row)*w; }
+
+  // value of the pixel in float with out of bounds coordinates clamped to the border
+  float get_pixel(int x, int y, int ch) const {
+    x = x >= w ? w-1 : x;
+    x = x < 0 ? 0 : x;
+    y = y >= h ? h-1 : y;
+    y = y < 0 ? 0 : y;
+    return pixel_traits<T>::to_float(data[((size_t)ch*h + y)*w + x]);
+  }
+
+  int size() const { return w*h*c; }
+
+  // widens every pixel to float
+  Image to_float() const {
+    Image im(w, h, c);
+    for (int ch = 0; ch < c; ch++) {
+      for (int row = 0; row < h; row++) {
+        const T* src = RowPtr(row, ch);
+        float* dst = im.RowPtr(row, ch);
+        for (int col = 0; col < w; col++) dst[col] = pixel_traits<T>::to_float(src[col]);
+      }
+    }
+    return im;
+  }
+
+  // narrows every pixel of a float image to T
+  static TypedImage from_float(const ImageView& im) {
+    TypedImage ret(im.w, im.h, im.c);
+    for (int ch = 0; ch < im.c; ch++) {
+      for (int row = 0; row < im.h; row++) {
+        const float* src = im.RowPtr(row, ch);
+        T* dst = ret.RowPtr(row, ch);
+        for (int col = 0; col < im.w; col++) dst[col] = pixel_traits<T>::from_float(src[col*im.pstride]);
+      }
+    }
+    return ret;
+  }
+};
+
+
+typedef TypedImage<uint8_t>  ImageU8;
+typedef TypedImage<uint16_t> ImageU16;
+typedef TypedImage<half>     ImageF16;
+typedef TypedImage<float>    ImageF32;
+
+
+/**
+ * @brief converts an image between two storage types going through float
+ *
+ * @param im the image to convert
+ * @return TypedImage<D> the converted image
+ */
+template <class D, class S>
+TypedImage<D> convert_image(const TypedImage<S>& im) {
+  TypedImage<D> ret(im.w, im.h, im.c);
+  for (size_t i = 0; i < im.data.size(); i++) {
+    ret.data[i] = pixel_traits<D>::from_float(pixel_traits<S>::to_float(im.data[i]));
+  }
+  return ret;
+}
+
+
+/**
+ * @brief converts an rgb image of any storage type to a float grayscale image,
+ * accumulating in float as it reads so no float copy of the input is made
+ *
+ * @param im the rgb image
+ * @return Image a grayscaled float image
+ */
+template <class T>
+Image rgb_to_grayscale(const TypedImage<T>& im) {
+  assert(im.c == 3);
+  Image gray(im.w, im.h);
+  for (int row = 0; row < im.h; row++) {
+    const T* r = im.RowPtr(row, 0);
+    const T* g = im.RowPtr(row, 1);
+    const T* b = im.RowPtr(row, 2);
+    float* dst = gray.RowPtr(row, 0);
+    for (int col = 0; col < im.w; col++) {
+      dst[col] = (0.299f * pixel_traits<T>::to_float(r[col]))
+               + (0.587f * pixel_traits<T>::to_float(g[col]))
+               + (0.114f * pixel_traits<T>::to_float(b[col]));
+    }
+  }
+  return gray;
+}
+
+
+/**
+ * @brief resizes an image of any storage type with bilinear interpolation into
+ * a float image, sampling exactly like Image::bilinear_resize
+ *
+ * @param im the image to resize
+ * @param w the new width of the image
+ * @param h the new height of the image
+ * @return Image a new resized float image
+ */
+template <class T>
+Image bilinear_resize(const TypedImage<T>& im, int w, int h) {
+  float col_scale = (float)im.w/(float)w;
+  float row_scale = (float)im.h/(float)h;
+  Image resized(w, h, im.c);
+  for (int ch = 0; ch < im.c; ch++) {
+    for (int row = 0; row < h; row++) {
+      float y = row_scale * ((float)row + 0.5f) - 0.5f;
+      int lower_y = floor(y);
+      for (int col = 0; col < w; col++) {
+        float x = col_scale * ((float)col + 0.5f) - 0.5f;
+        int lower_x = floor(x);
+        float q1 = im.get_pixel(lower_x, lower_y, ch) * (lower_x + 1 - x) + im.get_pixel(lower_x + 1, lower_y, ch) * (x - lower_x);
+        float q2 = im.get_pixel(lower_x, lower_y + 1, ch) * (lower_x + 1 - x) + im.get_pixel(lower_x + 1, lower_y + 1, ch) * (x - lower_x);
+        resized(col, row, ch) = q1 * (lower_y + 1 - y) + q2 * (y - lower_y);
+      }
+    }
+  }
+  return resized;
+}
+
+
+/**
+ * @brief loads an image keeping the 8 bit samples stb decodes instead of widening them to float
+ *
+ * @param filename the path of the image to load
+ * @return ImageU8 the loaded image
+ */
+ImageU8 load_image_u8(const string& filename);
+
+
+/**
+ * @brief loads an 8 bit image shrunk by 2, 4 or 8 to fit within max_w x max_h, see load_image
+ *
+ * @param filename the path of the image to load
+ * @param max_w the largest width wanted, 0 or less for any
+ * @param max_h the largest height wanted, 0 or less for any
+ * @return ImageU8 the image at the picked scale
+ */
+ImageU8 load_image_u8(const string& filename, int max_w, int max_h);
+
+
+/**
+ * @brief saves an 8 bit image as a jpg without going through float
+ *
+ * @param im the image to save
+ * @param name the path to save to without the extension
+ */
+void save_image(const ImageU8& im, const string& name);
+
+
+/**
+ * @brief saves an 8 bit image as a png without going through float
+ *
+ * @param im the image to save
+ * @param name the path to save to without the extension
+ */
+void save_png(const ImageU8& im, const string& name);
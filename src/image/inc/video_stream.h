@@ -0,0 +1,185 @@
+// Uncompressed video streams over files and pipes
+//
+// Frames can be streamed in and out of the library as YUV4MPEG2 (.y4m) or as
+// bare rgb24 frames (ffmpeg's -f rawvideo -pix_fmt rgb24) without encoding
+// every frame to an image file, e.g.
+//
+//   ffmpeg -i in.mp4 -f yuv4mpegpipe - | VideoStabilizer - - | ffmpeg -i - out.mp4
+//
+// A path of "-" reads from stdin or writes to stdout. Y4M input is recognised
+// by its signature, anything else is read as rgb24 frames of a size given up
+// front. Y4M streams are converted with the BT.601 matrix, limited range unless
+// the header says XCOLORRANGE=FULL; 4:2:0, 4:2:2, 4:4:4 and mono chroma are read
+// and 4:2:0 is written.
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "typed_image.h"
+
+using namespace std;
+
+
+enum StreamFormat {
+  STREAM_Y4M,
+  STREAM_RGB24,
+};
+
+
+/**
+ * @brief picks the format to write a stream in from its path: rgb24 for names
+ * ending in .rgb or .raw, Y4M for anything else including "-"
+ *
+ * @param path the path of the stream
+ * @return StreamFormat the format to write
+ */
+StreamFormat stream_format_for(const string& path);
+
+
+/**
+ * @brief Reads the frames of a Y4M or rgb24 stream one at a time
+ *
+ */
+class FrameReader
+{
+
+public:
+
+  /**
+   * @brief Opens a stream and reads its header. Y4M streams carry their size,
+   * for rgb24 streams it must be given. Exits with a message when the file
+   * can't be opened or an rgb24 stream has no size.
+   *
+   * @param path the file to read, "-" for stdin
+   * @param w the width of the frames of an rgb24 stream
+   * @param h the height of the frames of an rgb24 stream
+   */
+  explicit FrameReader(const string& path, int w=0, int h=0);
+
+
+  /**
+   * @brief Closes the stream unless it is stdin
+   *
+   */
+  ~FrameReader();
+
+
+  /**
+   * @brief Reads the next frame as an 8 bit rgb image
+   *
+   * @param frame receives the frame
+   * @return true if a whole frame was read
+   * @return false at the end of the stream
+   */
+  bool read(ImageU8& frame);
+
+
+  /**
+   * @brief Reads the next frame as a planar float rgb image with values in [0, 1]
+   *
+   * @param frame receives the frame
+   * @return true if a whole frame was read
+   * @return false at the end of the stream
+   */
+  bool read(Image& frame);
+
+
+  StreamFormat format() const { return fmt; }
+  int width() const           { return w; }
+  int height() const          { return h; }
+  int fps_num() const         { return fps_n; }
+  int fps_den() const         { return fps_d; }
+
+
+private:
+
+  enum Chroma { CHROMA_420, CHROMA_422, CHROMA_444, CHROMA_MONO };
+
+  FILE* file;
+  StreamFormat fmt;
+  int w, h;
+  int fps_n, fps_d;
+  Chroma chroma;
+  bool full_range;
+  vector<unsigned char> raw;
+  string peeked;    // bytes read while looking for the Y4M signature
+
+  size_t read_bytes(void* dst, size_t n);
+  bool read_frame();
+  void parse_header(const string& header);
+  void yuv_row(float* r, float* g, float* b, int row) const;
+
+  FrameReader(const FrameReader&) = delete;
+  FrameReader& operator=(const FrameReader&) = delete;
+
+};
+
+
+/**
+ * @brief Writes frames to a Y4M or rgb24 stream. Values outside [0, 1] are
+ * clamped.
+ *
+ * Writing to "-" takes stdout over: the frames go to the original stdout and
+ * anything the program prints to stdout afterwards goes to stderr instead, so
+ * progress messages can't corrupt the stream.
+ *
+ */
+class FrameWriter
+{
+
+public:
+
+  /**
+   * @brief Opens a stream, the header is written with the first frame
+   *
+   * @param path the file to write, "-" for stdout
+   * @param format the format to write
+   * @param fps_num numerator of the frame rate written to a Y4M header
+   * @param fps_den denominator of the frame rate written to a Y4M header
+   */
+  FrameWriter(const string& path, StreamFormat format, int fps_num=30, int fps_den=1);
+
+
+  /**
+   * @brief Flushes and closes the stream
+   *
+   */
+  ~FrameWriter();
+
+
+  /**
+   * @brief Appends a frame. Every frame must have the size of the first and 3 channels
+   *
+   * @param frame the frame to write
+   */
+  void write(const ImageView& frame);
+
+
+  /**
+   * @brief Appends an 8 bit frame. Every frame must have the size of the first and 3 channels
+   *
+   * @param frame the frame to write
+   */
+  void write(const ImageU8& frame);
+
+
+private:
+
+  FILE* file;
+  StreamFormat fmt;
+  int w, h;
+  int fps_n, fps_d;
+  vector<unsigned char> raw;
+  vector<float> rgb;
+
+  void start(int w, int h);
+  void write_rgb();
+
+  FrameWriter(const FrameWriter&) = delete;
+  FrameWriter& operator=(const FrameWriter&) = delete;
+
+};
@@ -0,0 +1,213 @@
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <algorithm>
+
+#include "../inc/fft.h"
+#include "../../utils/thread_pool.h"
+
+using namespace std;
+
+typedef complex<float> cf;
+
+
+// std::complex multiplication checks for infinities on every product
+static inline cf cmul(cf a, cf b) {
+  return cf(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+
+// MARK: - FFTPlan
+
+FFTPlan::FFTPlan(int n) : n(n) {
+  assert(n >= 1);
+  twiddles.resize(n);
+  for (int k = 0; k < n; k++) {
+    double a = -2*M_PI*k/n;
+    twiddles[k] = cf((float)cos(a), (float)sin(a));
+  }
+  for (int left = n; left > 1;) {
+    int p = left % 4 == 0 ? 4 : left % 2 == 0 ? 2 : left % 3 == 0 ? 3 : left % 5 == 0 ? 5 : 0;
+    assert(p && "fft sizes can only have the prime factors 2, 3 and 5");
+    left /= p;
+    factors.push_back(p);
+    factors.push_back(left);
+  }
+}
+
+
+// One pass of a decimation in time transform: splits the input in p
+// subsequences of m, transforms each and joins them with radix p butterflies.
+// fstride is how far apart the twiddles of this pass are.
+void FFTPlan::pass(cf* out, const cf* in, size_t fstride, int stride, const int* f, bool inverse) const {
+  const int p = f[0], m = f[1];
+  if (m == 1) {
+    for (int k = 0; k < p; k++) out[k] = in[(size_t)k*fstride*stride];
+  } else {
+    for (int k = 0; k < p; k++) pass(out + k*m, in + (size_t)k*fstride*stride, fstride*p, stride, f + 2, inverse);
+  }
+
+  auto tw = [&](size_t k) { return inverse ? conj(twiddles[k]) : twiddles[k]; };
+  switch (p) {
+    case 2:
+      for (int u = 0; u < m; u++) {
+        cf t = cmul(out[u + m], tw(u*fstride));
+        out[u + m] = out[u] - t;
+        out[u] += t;
+      }
+      break;
+
+    case 4:
+      for (int u = 0; u < m; u++) {
+        cf s0 = cmul(out[u + m], tw(u*fstride));
+        cf s1 = cmul(out[u + 2*m], tw(2*u*fstride));
+        cf s2 = cmul(out[u + 3*m], tw(3*u*fstride));
+        cf s5 = out[u] - s1;
+        out[u] += s1;
+        cf s3 = s0 + s2;
+        cf s4 = s0 - s2;
+        out[u + 2*m] = out[u] - s3;
+        out[u] += s3;
+        // s4 times -i, or +i for the inverse
+        cf r = inverse ? cf(-s4.imag(), s4.real()) : cf(s4.imag(), -s4.real());
+        out[u + m] = s5 + r;
+        out[u + 3*m] = s5 - r;
+      }
+      break;
+
+    default: {
+      // radix 3 and 5: a plain dft of p values, the twiddles of the pass folded in
+      cf scratch[5];
+      for (int u = 0; u < m; u++) {
+        for (int q = 0; q < p; q++) scratch[q] = out[u + q*m];
+        for (int q = 0; q < p; q++) {
+          int k = u + q*m;
+          size_t t = 0;
+          cf acc = scratch[0];
+          for (int r = 1; r < p; r++) {
+            t += fstride*k;
+            if (t >= (size_t)n) t -= n;
+            acc += cmul(scratch[r], tw(t));
+          }
+          out[k] = acc;
+        }
+      }
+    }
+  }
+}
+
+
+void FFTPlan::transform(cf* out, const cf* in, int stride, bool inverse) const {
+  if (n == 1) {
+    out[0] = in[0];
+    return;
+  }
+  pass(out, in, 1, stride, factors.data(), inverse);
+}
+
+
+int fft_good_size(int n) {
+  for (int size = max(n, 1);; size++) {
+    int left = size;
+    for (int p : {2, 3, 5}) while (left % p == 0) left /= p;
+    if (left == 1) return size;
+  }
+}
+
+
+shared_ptr<const FFTPlan> fft_plan(int n) {
+  static mutex lock;
+  static map<int, shared_ptr<const FFTPlan>> plans;
+  lock_guard<mutex> guard(lock);
+  shared_ptr<const FFTPlan>& plan = plans[n];
+  if (!plan) plan = make_shared<FFTPlan>(n);
+  return plan;
+}
+
+
+// MARK: - Convolution
+
+// transforms a w x h block of values in place, rows then columns
+static void fft_2d(cf* data, int w, int h, const FFTPlan& rows, const FFTPlan& cols, vector<cf>& scratch, bool inverse) {
+  scratch.resize(max(w, h));
+  for (int y = 0; y < h; y++) {
+    rows.transform(scratch.data(), data + (size_t)y*w, 1, inverse);
+    copy(scratch.begin(), scratch.begin() + w, data + (size_t)y*w);
+  }
+  for (int x = 0; x < w; x++) {
+    cols.transform(scratch.data(), data + x, w, inverse);
+    for (int y = 0; y < h; y++) data[(size_t)y*w + x] = scratch[y];
+  }
+}
+
+
+Image convolve_image_fft(const ImageView& im, const Image& filter, int preserve) {
+  assert(filter.c == 1 || filter.c == im.c);
+  const int fw = filter.w, fh = filter.h;
+
+  // tiles a few filters wide keep most of every transform, but no bigger than needed
+  const int tw = fft_good_size(min(max(4*fw, 128), im.w + fw - 1));
+  const int th = fft_good_size(min(max(4*fh, 128), im.h + fh - 1));
+  const int bw = tw - fw + 1;
+  const int bh = th - fh + 1;
+  shared_ptr<const FFTPlan> row_plan = fft_plan(tw);
+  shared_ptr<const FFTPlan> col_plan = fft_plan(th);
+
+  // a correlation multiplies by the conjugate, the inverse transform isn't scaled
+  vector<cf> spectrum((size_t)tw*th, cf(0, 0));
+  vector<cf> scratch;
+  for (int j = 0; j < fh; j++) for (int i = 0; i < fw; i++) spectrum[(size_t)j*tw + i] = filter.get_pixel(i, j, 0);
+  fft_2d(spectrum.data(), tw, th, *row_plan, *col_plan, scratch, false);
+  const float scale = 1.f/((float)tw*th);
+  for (cf& s : spectrum) s = conj(s)*scale;
+
+  Image ret = Image::uninitialized(im.w, im.h, im.c);
+  const int nx = (im.w + bw - 1)/bw;
+  const int ny = (im.h + bh - 1)/bh;
+  const int tiles = im.c*nx*ny;
+
+  // two tiles per transform, the first as the real part and the second as the imaginary part
+  parallel_for(0, (tiles + 1)/2, 1, [&](int a, int b) {
+    vector<cf> buf((size_t)tw*th);
+    vector<cf> scratch;
+    vector<int> xs(tw);
+    for (int pair = a; pair < b; pair++) {
+      fill(buf.begin(), buf.end(), cf(0, 0));
+      for (int half = 0; half < 2 && 2*pair + half < tiles; half++) {
+        int t = 2*pair + half;
+        int c = t/(nx*ny), ox = (t % nx)*bw, oy = (t/nx % ny)*bh;
+        for (int u = 0; u < tw; u++) xs[u] = min(max(ox - fw/2 + u, 0), im.w - 1)*im.pstride;
+        for (int v = 0; v < th; v++) {
+          const float* src = im.RowPtr(min(max(oy - fh/2 + v, 0), im.h - 1), c);
+          cf* dst = &buf[(size_t)v*tw];
+          if (half == 0) for (int u = 0; u < tw; u++) dst[u] = cf(src[xs[u]], 0);
+          else for (int u = 0; u < tw; u++) dst[u] = cf(dst[u].real(), src[xs[u]]);
+        }
+      }
+
+      fft_2d(buf.data(), tw, th, *row_plan, *col_plan, scratch, false);
+      for (size_t k = 0; k < buf.size(); k++) buf[k] = cmul(buf[k], spectrum[k]);
+      fft_2d(buf.data(), tw, th, *row_plan, *col_plan, scratch, true);
+
+      for (int half = 0; half < 2 && 2*pair + half < tiles; half++) {
+        int t = 2*pair + half;
+        int c = t/(nx*ny), ox = (t % nx)*bw, oy = (t/nx % ny)*bh;
+        for (int v = 0; v < min(bh, im.h - oy); v++) {
+          float* dst = ret.RowPtr(oy + v, c) + ox;
+          const cf* src = &buf[(size_t)v*tw];
+          for (int u = 0; u < min(bw, im.w - ox); u++) dst[u] = half == 0 ? src[u].real() : src[u].imag();
+        }
+      }
+    }
+  });
+
+  if (preserve || im.c == 1) return ret;
+  Image summed(im.w, im.h, 1);
+  for (int c = 0; c < im.c; c++) for (int y = 0; y < im.h; y++) {
+    float* dst = summed.RowPtr(y, 0);
+    const float* src = ret.RowPtr(y, c);
+    for (int x = 0; x < im.w; x++) dst[x] += src[x];
+  }
+  return summed;
+}
@@ -5,11 +5,17 @@
 #include <vector>
 #include <string>
 #include <chrono>
-#include <thread>
 #include <mutex>
+#include <algorithm>
+#include <complex>
 
 #include "../inc/filter_image.h"
+#include "../inc/pointwise.h"
+#include "../inc/kernels.h"
+#include "../inc/fft.h"
+#include "../inc/integral_image.h"
 #include "../../utils/utils.h"
+#include "../../utils/thread_pool.h"
 
 using namespace std;
 
@@ -17,28 +23,231 @@ using namespace std;
 // Helper methods to construct some basic filters and apply them
 
 
-Image convolve_image(const Image& im, const Image& filter, int preserve) {
+// columns per tile, the source rows a tile reads stay in cache over the rows of a band
+static const int CONVOLVE_TILE = 1024;
+
+
+Image convolve_image_direct(const ImageView& im, const Image& filter, int preserve) {
   assert(filter.c == 1 || filter.c == im.c);
   Image ret = Image(im.w, im.h, preserve ? im.c : 1);
-  for (int c = 0; c < im.c; c++) {
-    for (int y = 0; y < im.h; y++) {
-      for (int x = 0; x < im.w; x++) {
+  if (im.pstride != 1) {
+    // the engine wants unit stride rows
+    Image planar = Image::uninitialized(im.w, im.h, im.c);
+    for (int c = 0; c < im.c; c++) for (int y = 0; y < im.h; y++) {
+      const float* src = im.RowPtr(y, c);
+      float* dst = planar.RowPtr(y, c);
+      for (int x = 0; x < im.w; x++) dst[x] = src[x*im.pstride];
+    }
+    return convolve_image_direct(planar, filter, preserve);
+  }
 
-        // now loop the filter
-        int filter_c = filter.c ? 0 : c;
-        for (int j = 0; j < filter.h; j++) {
-          for(int i = 0; i < filter.w; i++) {
-            float value = (filter.get_pixel(i, j, filter_c) * im.get_pixel(x + (i - filter.w/2), y + (j - filter.h/2), c));
-            ret.set_pixel(x, y, preserve ? c : 0, ret.get_pixel(x, y, preserve ? c : 0) + value);
+  // Every output pixel adds its products one at a time to the value it holds,
+  // channel by channel, filter row by filter row and column by column, so it
+  // is the same sum on every cpu and however the image is split up. Pixels
+  // more than half a filter from the left and right edges go through the
+  // vectorized kernel, the rest clamp their source column. Every channel is
+  // filtered with channel 0 of the filter.
+  vector<float> taps(filter.w * filter.h);
+  for (int j = 0; j < filter.h; j++) for (int i = 0; i < filter.w; i++) taps[j*filter.w + i] = filter.get_pixel(i, j, 0);
+  const int x0 = min(filter.w/2, im.w);
+  const int x1 = max(x0, im.w - (filter.w - 1 - filter.w/2));
+
+  parallel_for(0, im.h, 8, [&](int y0, int y1) {
+    vector<const float*> rows(filter.h);
+    for (int t0 = x0; t0 < max(x1, x0 + 1); t0 += CONVOLVE_TILE) {
+      int t1 = min(t0 + CONVOLVE_TILE, x1);
+      for (int c = 0; c < im.c; c++) {
+        for (int y = y0; y < y1; y++) {
+          float* out = ret.RowPtr(y, preserve ? c : 0);
+          for (int j = 0; j < filter.h; j++) rows[j] = im.RowPtr(min(max(y + (j - filter.h/2), 0), im.h - 1), c);
+
+          // the borders are done with the first tile
+          auto border = [&](int x) {
+            float a = out[x];
+            for (int j = 0; j < filter.h; j++) for (int i = 0; i < filter.w; i++) {
+              a = a + taps[j*filter.w + i] * rows[j][min(max(x + (i - filter.w/2), 0), im.w - 1)];
+            }
+            out[x] = a;
+          };
+          if (t0 == x0) {
+            for (int x = 0; x < x0; x++) border(x);
+            for (int x = x1; x < im.w; x++) border(x);
+          }
+          if (t1 > t0) {
+            for (int j = 0; j < filter.h; j++) rows[j] += t0 - filter.w/2;
+            kernel_convolve_row(out + t0, rows.data(), taps.data(), filter.w, filter.h, t1 - t0);
           }
         }
       }
     }
-  }
+  });
   return ret;
 }
 
 
+// MARK: - Box filters
+
+Image box_filter_image(const ImageView& im, int fw, int fh) {
+  assert(fw >= 1 && fh >= 1);
+  // windows start fw/2 left of the pixel like in convolve_image, the table reaches them
+  IntegralImage sums(im, max(fw - fw/2, fh - fh/2));
+  Image ret = Image::uninitialized(im.w, im.h, im.c);
+  const double scale = 1.0/((double)fw*fh);
+  parallel_for(0, im.c*im.h, 16, [&](int a, int b) {
+    for (int q = a; q < b; q++) {
+      const int c = q/im.h;
+      const int y0 = q % im.h - fh/2;
+      const double* top = sums.row(y0, c) - fw/2;
+      const double* bottom = sums.row(y0 + fh, c) - fw/2;
+      float* out = ret.RowPtr(q % im.h, c);
+      for (int x = 0; x < im.w; x++) out[x] = (float)(((bottom[x + fw] - top[x + fw]) - (bottom[x] - top[x]))*scale);
+    }
+  });
+  return ret;
+}
+
+
+static bool is_box_filter(const Image& filter) {
+  const float tap = filter.get_pixel(0, 0, 0);
+  for (int j = 0; j < filter.h; j++) for (int i = 0; i < filter.w; i++) if (filter.get_pixel(i, j, 0) != tap) return false;
+  return tap != 0;
+}
+
+
+static Image sum_channels(const Image& im) {
+  Image summed(im.w, im.h, 1);
+  for (int c = 0; c < im.c; c++) for (int y = 0; y < im.h; y++) kernel_axpy(summed.RowPtr(y, 0), im.RowPtr(y, c), im.w, 1.f);
+  return summed;
+}
+
+
+// MARK: - Separable filters
+
+// Eigen decomposition of the symmetric n x n matrix a by cyclic Jacobi
+// rotations, a is destroyed. Eigenvalues go to values, eigenvectors to the
+// columns of vectors.
+static void symmetric_eigen(vector<double>& a, int n, vector<double>& values, vector<double>& vectors) {
+  vectors.assign(n*n, 0.0);
+  for (int i = 0; i < n; i++) vectors[i*n + i] = 1;
+  for (int sweep = 0; sweep < 64; sweep++) {
+    double off = 0;
+    for (int p = 0; p < n; p++) for (int q = p + 1; q < n; q++) off += a[p*n + q]*a[p*n + q];
+    if (off < 1e-30) break;
+    for (int p = 0; p < n; p++) for (int q = p + 1; q < n; q++) {
+      if (fabs(a[p*n + q]) < 1e-300) continue;
+      double theta = (a[q*n + q] - a[p*n + p])/(2*a[p*n + q]);
+      double t = (theta >= 0 ? 1 : -1)/(fabs(theta) + sqrt(theta*theta + 1));
+      double c = 1/sqrt(t*t + 1), s = t*c;
+      for (int k = 0; k < n; k++) {
+        double akp = a[k*n + p], akq = a[k*n + q];
+        a[k*n + p] = c*akp - s*akq;
+        a[k*n + q] = s*akp + c*akq;
+      }
+      for (int k = 0; k < n; k++) {
+        double apk = a[p*n + k], aqk = a[q*n + k];
+        a[p*n + k] = c*apk - s*aqk;
+        a[q*n + k] = s*apk + c*aqk;
+      }
+      for (int k = 0; k < n; k++) {
+        double vkp = vectors[k*n + p], vkq = vectors[k*n + q];
+        vectors[k*n + p] = c*vkp - s*vkq;
+        vectors[k*n + q] = s*vkp + c*vkq;
+      }
+    }
+  }
+  values.resize(n);
+  for (int i = 0; i < n; i++) values[i] = a[i*n + i];
+}
+
+
+int separate_filter(const Image& filter, vector<vector<float>>& cols, vector<vector<float>>& rows) {
+  const int w = filter.w, h = filter.h;
+  cols.clear();
+  rows.clear();
+  vector<double> f(w*h);
+  double largest = 0;
+  for (int j = 0; j < h; j++) for (int i = 0; i < w; i++) {
+    f[j*w + i] = filter.get_pixel(i, j, 0);
+    largest = max(largest, fabs(f[j*w + i]));
+  }
+  if (largest == 0) return 0;
+
+  // A separable filter is its largest row scaled, split that way its taps
+  // stay exact: zeros stay zero and the halves of a derivative filter cancel.
+  int pj = 0, pi = 0;
+  for (int j = 0; j < h; j++) for (int i = 0; i < w; i++) if (fabs(f[j*w + i]) > fabs(f[pj*w + pi])) { pj = j; pi = i; }
+  vector<float> col(h), row(w);
+  for (int i = 0; i < w; i++) row[i] = f[pj*w + i];
+  for (int j = 0; j < h; j++) col[j] = f[j*w + pi]/f[pj*w + pi];
+  double err = 0;
+  for (int j = 0; j < h; j++) for (int i = 0; i < w; i++) err = max(err, fabs((double)col[j]*row[i] - f[j*w + i]));
+  if (err <= 1e-6*largest) {
+    cols.push_back(col);
+    rows.push_back(row);
+    return 1;
+  }
+
+  // otherwise the right singular vectors of f are the eigenvectors of f'f, the
+  // left ones scaled by the singular values are f times them
+  vector<double> ftf(w*w, 0.0), values, vectors;
+  for (int p = 0; p < w; p++) for (int q = 0; q < w; q++) for (int j = 0; j < h; j++) ftf[p*w + q] += f[j*w + p]*f[j*w + q];
+  symmetric_eigen(ftf, w, values, vectors);
+  vector<int> order(w);
+  for (int i = 0; i < w; i++) order[i] = i;
+  sort(order.begin(), order.end(), [&](int a, int b) { return values[a] > values[b]; });
+
+  // add terms until they give the filter back to float precision
+  vector<double> residual = f;
+  for (int k = 0; k < min(w, h); k++) {
+    err = 0;
+    for (double r : residual) err = max(err, fabs(r));
+    if (err <= 1e-6*largest) break;
+    int e = order[k];
+    for (int i = 0; i < w; i++) row[i] = vectors[i*w + e];
+    for (int j = 0; j < h; j++) {
+      double u = 0;
+      for (int i = 0; i < w; i++) u += f[j*w + i]*vectors[i*w + e];
+      col[j] = u;
+    }
+    for (int j = 0; j < h; j++) for (int i = 0; i < w; i++) residual[j*w + i] -= (double)col[j]*row[i];
+    cols.push_back(col);
+    rows.push_back(row);
+  }
+  return cols.size();
+}
+
+
+Image convolve_image(const ImageView& im, const Image& filter, int preserve) {
+  // a filter of equal taps is a box, four lookups a pixel for any size
+  if (filter.w*filter.h >= BOX_FILTER_TAPS && is_box_filter(filter)) {
+    Image ret = box_filter_image(im, filter.w, filter.h);
+    float gain = filter.get_pixel(0, 0, 0)*filter.w*filter.h;
+    if (gain != 1) ret *= gain;
+    return preserve || ret.c == 1 ? ret : sum_channels(ret);
+  }
+
+  vector<vector<float>> cols, rows;
+  int rank = separate_filter(filter, cols, rows);
+  int direct = filter.w*filter.h;
+  int separable = rank == 0 ? direct : rank*(filter.w + filter.h);
+  if (min(direct, separable) >= FFT_CONVOLVE_CROSSOVER) return convolve_image_fft(im, filter, preserve);
+  if (separable >= direct) return convolve_image_direct(im, filter, preserve);
+
+  // a row pass then a column pass per term, clamping at the borders the same
+  // way the full filter does
+  Image ret;
+  for (int k = 0; k < rank; k++) {
+    Image horizontal(filter.w, 1, 1), vertical(1, filter.h, 1);
+    for (int i = 0; i < filter.w; i++) horizontal(i, 0, 0) = rows[k][i];
+    for (int j = 0; j < filter.h; j++) vertical(0, j, 0) = cols[k][j];
+    Image term = convolve_image_direct(convolve_image_direct(im, horizontal, 1), vertical, 1);
+    if (k == 0) ret = term;
+    else ret += term;
+  }
+  return preserve || ret.c == 1 ? ret : sum_channels(ret);
+}
+
+
 Image make_box_filter(int w) {
   Image box_filter(w, w);
   for (int row = 0; row < w; row++) {
@@ -107,8 +316,16 @@ Image make_1d_gaussian(float sigma) {
 }
 
 
-Image smooth_image(const Image& im, float sigma) {
+Image smooth_image(const ImageView& im, float sigma, SmoothMethod method) {
   Image horizontal = make_1d_gaussian(sigma);
+  if (method == SMOOTH_IIR || (method == SMOOTH_AUTO && sigma >= RECURSIVE_SMOOTH_SIGMA)) {
+    // the taps of make_1d_gaussian don't sum to 1, scale by what both passes would
+    float sum = 0;
+    for (int x = 0; x < horizontal.w; x++) sum += horizontal(x, 0, 0);
+    Image result = recursive_smooth_image(im, sigma);
+    result *= sum*sum;
+    return result;
+  }
   Image vertical(1, horizontal.w, 1);
   for(int x = 0; x < horizontal.w; x++) {
     vertical(0, x, 0) = horizontal(x, 0, 0);
@@ -121,7 +338,7 @@ Image smooth_image(const Image& im, float sigma) {
 }
 
 
-Image fast_smooth_image(const Image& im, float sigma) {
+vector<float> fast_gaussian_taps(float sigma) {
   assert(sigma>=0.f);
   int w=roundf(sigma*6);
   if(w%2==0)w++;
@@ -129,33 +346,35 @@ Image fast_smooth_image(const Image& im, float sigma) {
   vector<float> g(w);
   float*gf=g.data()+w/2;
   
-  {
   float sum=0;
   for(int q1=-w/2;q1<=w/2;q1++)gf[q1]=expf(-(q1*q1)/(2.f*sigma*sigma));
   for(int q1=-w/2;q1<=w/2;q1++)sum+=gf[q1];
   for(int q1=-w/2;q1<=w/2;q1++)gf[q1]/=sum;
-  }
+  return g;
+}
+
+
+Image fast_smooth_image(const ImageView& im, float sigma, SmoothMethod method) {
+  if(method==SMOOTH_IIR || (method==SMOOTH_AUTO && sigma>=RECURSIVE_SMOOTH_SIGMA))return recursive_smooth_image(im,sigma);
   
+  vector<float> g=fast_gaussian_taps(sigma);
+  int w=g.size();
+  float*gf=g.data()+w/2;
   
-  auto do_one=[gf,w](const Image& im) {
-    Image expand(im.w+w-1,im.h,im.c);
-    for(int c=0;c<im.c;c++)
-    for(int q2=0;q2<expand.h;q2++)for(int q1=0;q1<expand.w;q1++)
-      expand(q1,q2,c)=im.get_pixel(q1-w/2,q2,c);
-    
-    Image ret(im.w,im.h,im.c);
+  
+  auto do_one=[gf,w](const ImageView& im) {
+    Image expand=Image::uninitialized(im.w+w-1,im.h,im.c);
+    Image ret=Image::uninitialized(im.w,im.h,im.c);
     
-    int Nthreads=8;
     int total=im.h*im.c;
-    vector<thread> th;
-    for(int t=0;t<Nthreads;t++)th.push_back(thread([&](int a,int b){
+    parallel_for(0,total,8,[&](int a,int b){
       for(int q=a;q<b;q++){
         int c=q/im.h;
         int q2=q%im.h;
+        for(int q1=0;q1<expand.w;q1++)expand(q1,q2,c)=im.get_pixel(q1-w/2,q2,c);
         for(int q1=0;q1<im.w;q1++)ret(q1,q2,c)=dot_product(&expand(q1,q2,c),gf-w/2,w);
       }
-    },t*total/Nthreads,(t+1)*total/Nthreads));
-    for(auto&e1:th)e1.join();
+    });
     
     return ret;
   };
@@ -168,6 +387,139 @@ Image fast_smooth_image(const Image& im, float sigma) {
 }
 
 
+// MARK: - Recursive Gaussian
+
+// rows of a column strip are this many floats, the strips run on the thread pool
+static const int RECURSIVE_STRIP = 256;
+
+
+// Deriche's fourth order approximation of a Gaussian. The response for
+// n >= 0 is a sum of two damped cosines and sines of n/sigma, each one a
+// second order section run causally, y[n] = b0*x[n] + b1*x[n-1] - a1*y[n-1] - a2*y[n-2],
+// and the mirror image without the centre sample run anticausally,
+// y[n] = c0*x[n+1] + c1*x[n+2] - a1*y[n+1] - a2*y[n+2]. The output is the sum
+// of all four. Second order sections keep the poles close to 1 of large
+// sigmas accurate in floats where a single fourth order filter drifts.
+struct RecursiveGaussian {
+  struct Section {
+    float b[2], c[2], a[2];
+    float causal;       // the output over a constant input of 1
+    float anticausal;
+  };
+  Section sections[2];
+};
+
+
+static RecursiveGaussian recursive_gaussian(float sigma) {
+  assert(sigma >= 0.5f);
+  // amplitudes of the cosine and the sine, damping and frequency
+  const double fit[2][4] = {{1.6800, 3.7350, 1.7830, 0.6318}, {-0.6803, -0.2598, 1.7230, 1.9970}};
+
+  double b[2][2], c[2][2], a[2][2], causal[2], anticausal[2];
+  double total = 0;
+  for (int k = 0; k < 2; k++) {
+    complex<double> amplitude(fit[k][0], -fit[k][1]);
+    complex<double> pole = exp(complex<double>(-fit[k][2], fit[k][3])/(double)sigma);
+    // rounded first so the gains below are those of the filter that runs
+    a[k][0] = (float)(-2*pole.real());
+    a[k][1] = (float)norm(pole);
+    b[k][0] = amplitude.real();
+    b[k][1] = -(amplitude*conj(pole)).real();
+    c[k][0] = b[k][1] - a[k][0]*b[k][0];
+    c[k][1] = -a[k][1]*b[k][0];
+    causal[k] = (b[k][0] + b[k][1])/(1 + a[k][0] + a[k][1]);
+    anticausal[k] = (c[k][0] + c[k][1])/(1 + a[k][0] + a[k][1]);
+    total += causal[k] + anticausal[k];
+  }
+
+  RecursiveGaussian g;
+  for (int k = 0; k < 2; k++) {
+    RecursiveGaussian::Section& s = g.sections[k];
+    for (int i = 0; i < 2; i++) {
+      s.b[i] = (float)(b[k][i]/total);
+      s.c[i] = (float)(c[k][i]/total);
+      s.a[i] = (float)a[k][i];
+    }
+    s.causal = (float)(causal[k]/total);
+    s.anticausal = (float)(anticausal[k]/total);
+  }
+  return g;
+}
+
+
+// Runs the recursive filter down the columns of im, which has unit pixel
+// stride, into ret, a whole row at a time. Rows past the top and the bottom
+// repeat the first and the last, so every section starts in its steady state.
+static void recursive_columns(const ImageView& im, Image& ret, const RecursiveGaussian& g) {
+  const int h = im.h;
+  const int strips = (im.w + RECURSIVE_STRIP - 1)/RECURSIVE_STRIP;
+
+  parallel_for(0, im.c*strips, 1, [&](int a, int b) {
+    // the output of one section, 2 steady rows before the first and after the last
+    vector<float> section((size_t)(h + 4)*RECURSIVE_STRIP);
+    const float* rows[4];
+    for (int t = a; t < b; t++) {
+      const int c = t/strips;
+      const int x0 = (t % strips)*RECURSIVE_STRIP;
+      const int n = min(RECURSIVE_STRIP, im.w - x0);
+      auto in = [&](int y) -> const float* { return im.RowPtr(min(max(y, 0), h - 1), c) + x0; };
+      auto out = [&](int y) -> float* { return ret.RowPtr(y, c) + x0; };
+      auto row = [&](int y) -> float* { return &section[(size_t)(y + 2)*RECURSIVE_STRIP]; };
+
+      for (int y = 0; y < h; y++) fill(out(y), out(y) + n, 0.f);
+      for (const RecursiveGaussian::Section& s : g.sections) {
+        const float causal_taps[4] = {s.b[0], s.b[1], -s.a[0], -s.a[1]};
+        const float anticausal_taps[4] = {s.c[0], s.c[1], -s.a[0], -s.a[1]};
+
+        for (int y = -2; y < 0; y++) for (int x = 0; x < n; x++) row(y)[x] = s.causal*in(0)[x];
+        for (int y = 0; y < h; y++) {
+          rows[0] = in(y);
+          rows[1] = in(y - 1);
+          rows[2] = row(y - 1);
+          rows[3] = row(y - 2);
+          fill(row(y), row(y) + n, 0.f);
+          kernel_convolve_row(row(y), rows, causal_taps, 1, 4, n);
+          kernel_axpy(out(y), row(y), n, 1.f);
+        }
+
+        for (int y = h; y < h + 2; y++) for (int x = 0; x < n; x++) row(y)[x] = s.anticausal*in(h - 1)[x];
+        for (int y = h - 1; y >= 0; y--) {
+          rows[0] = in(y + 1);
+          rows[1] = in(y + 2);
+          rows[2] = row(y + 1);
+          rows[3] = row(y + 2);
+          fill(row(y), row(y) + n, 0.f);
+          kernel_convolve_row(row(y), rows, anticausal_taps, 1, 4, n);
+          kernel_axpy(out(y), row(y), n, 1.f);
+        }
+      }
+    }
+  });
+}
+
+
+Image recursive_smooth_image(const ImageView& im, float sigma) {
+  if (im.pstride != 1) {
+    Image planar = Image::uninitialized(im.w, im.h, im.c);
+    for (int c = 0; c < im.c; c++) for (int y = 0; y < im.h; y++) {
+      const float* src = im.RowPtr(y, c);
+      float* dst = planar.RowPtr(y, c);
+      for (int x = 0; x < im.w; x++) dst[x] = src[x*im.pstride];
+    }
+    return recursive_smooth_image(planar, sigma);
+  }
+
+  // columns, then the columns of the transpose, which are the rows
+  RecursiveGaussian g = recursive_gaussian(sigma);
+  Image vertical = Image::uninitialized(im.w, im.h, im.c);
+  recursive_columns(im, vertical, g);
+  Image turned = vertical.transpose();
+  Image horizontal = Image::uninitialized(turned.w, turned.h, turned.c);
+  recursive_columns(turned, horizontal, g);
+  return horizontal.transpose();
+}
+
+
 Image make_gaussian_filter(float sigma) {
   int dimension = 6 * sigma;
   dimension = dimension % 2 == 0 ? dimension + 1 : dimension;
@@ -185,29 +537,11 @@ Image make_gaussian_filter(float sigma) {
 
 
 Image add_image(const Image& a, const Image& b) {
-  assert(a.w == b.w && a.h == b.h && a.c == b.c);
-  Image ret = Image(a.w, a.h, a.c);
-  for (int c = 0; c < a.c; c++) {
-    for (int j = 0; j < a.h; j++) {
-      for (int i = 0; i < a.w; i++) {
-        ret(i, j, c) = a(i, j, c) + b(i, j, c);
-      }
-    }
-  }
-  return ret;
+  return a + b;
 }
 
 Image sub_image(const Image& a, const Image& b) {
-  assert(a.w == b.w && a.h == b.h && a.c == b.c);
-  Image ret = Image(a.w, a.h, a.c);
-  for (int c = 0; c < a.c; c++) {
-    for (int j = 0; j < a.h; j++) {
-      for (int i = 0; i < a.w; i++) {
-        ret(i, j, c) = a(i, j, c) - b(i, j, c);
-      }
-    }
-  }
-  return ret;
+  return a - b;
 }
 
 
@@ -241,18 +575,20 @@ Image make_gy_filter() {
 }
 
 
-pair<Image,Image> sobel_image(const Image& im) {
+pair<Image,Image> sobel_image(const ImageView& im) {
   Image Mag(im.w,im.h);
   Image Theta(im.w,im.h);
 
   Image gx = convolve_image(im, make_gx_filter(), 0);
   Image gy = convolve_image(im, make_gy_filter(), 0);
-  for (int y = 0; y < im.h; y++) {
-    for (int x = 0; x < im.w; x++) {
-      Mag(x, y, 0) = sqrtf(powf(gx.get_pixel(x, y, 0), 2) + powf(gy.get_pixel(x, y, 0), 2));
-      Theta(x, y, 0) = atan2f(gy.get_pixel(x, y, 0), gx.get_pixel(x, y, 0));
+  parallel_for(0, im.h, 16, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = 0; x < im.w; x++) {
+        Mag(x, y, 0) = sqrtf(powf(gx.get_pixel(x, y, 0), 2) + powf(gy.get_pixel(x, y, 0), 2));
+        Theta(x, y, 0) = atan2f(gy.get_pixel(x, y, 0), gx.get_pixel(x, y, 0));
+      }
     }
-  }
+  });
 
   return {Mag,Theta};
 }
@@ -279,9 +615,10 @@ Image bilateral_filter(const Image& im, float sigma1, float sigma2) {
   Image ret = Image(im.w, im.h, im.c);
   int dimension = 3 * sigma1;
   dimension = dimension % 2 == 0 ? dimension + 1 : dimension;
-  float previous = 0;
-  for (int c = 0; c < im.c; c++) {
-    for (int y = 0; y < im.h; y++) {
+  parallel_for(0, im.c*im.h, 4, [&](int a, int b) {
+    for (int q = a; q < b; q++) {
+      int c = q / im.h;
+      int y = q % im.h;
       for (int x = 0; x < im.w; x++) {
         float normalized_factor = 0.0f;
         float value = 0.0f;
@@ -291,7 +628,6 @@ Image bilateral_filter(const Image& im, float sigma1, float sigma2) {
             int y_prime = y + (j - (dimension/2.0f)) + 0.5;
             float regular_gaussian = expf(-((powf(x_prime - x, 2) + powf(y_prime - y, 2))/(2 * powf(sigma1, 2)))) / (2 * M_PI * powf(sigma1, 2));
             float intensity_gaussian = expf(-(powf((im.get_pixel(x_prime, y_prime, c) - im.get_pixel(x, y, c)), 2))/(2 * powf(sigma2, 2))) / (2 * M_PI * powf(sigma2, 2));
-            previous = intensity_gaussian;
             value += (intensity_gaussian * regular_gaussian * im.get_pixel(x_prime, y_prime, c));
             normalized_factor += (regular_gaussian * intensity_gaussian);
           }
@@ -300,7 +636,7 @@ Image bilateral_filter(const Image& im, float sigma1, float sigma2) {
         ret(x, y, c) = value;
       }
     }
-  }
+  });
   save_image(ret, "output/bilateral");
   return ret;
 }
@@ -308,62 +644,56 @@ Image bilateral_filter(const Image& im, float sigma1, float sigma2) {
 
 // Image class filter specific instance methods 
 
-void Image::feature_normalize() {
-  for (int ch = 0; ch < c; ch++) {
-    float min = get_pixel(0, 0, 0);
-    float max = get_pixel(0, 0, 0);
-    for (int j = 0; j < h; j++) {
-      for (int i = 0; i < w; i++) {
-        float value = get_pixel(i, j, ch);
-        if (value < min) {
-          min = value;
-        }
-        if (value > max) {
-          max = value;
-        }
-      }
-    }
-    float diff = max - min;
-    for (int j = 0; j < h; j++) {
-      for (int i = 0; i < w; i++) {
-        if (diff == 0) {
-          set_pixel(i, j, ch, 0);
-        } else {
-          set_pixel(i, j, ch, (get_pixel(i, j, ch) - min)/diff);
-        }
-      }
+// rescales the pixels of channels [ch0, ch1) from [min, max] to [0, 1], or to 0 when they are all equal
+static void normalize_range(Image& im, int ch0, int ch1, float min, float max) {
+  float diff = max - min;
+  float a = diff == 0 ? 0.f : 1.f/diff;
+  float b = diff == 0 ? 0.f : -min/diff;
+  if (im.layout == Image::INTERLEAVED && ch1 - ch0 < im.c) {
+    for (int row = 0; row < im.h; row++) {
+      float* p = im.RowPtr(row, ch0);
+      for (int col = 0; col < im.w; col++) p[col*im.c] = p[col*im.c]*a + b;
     }
+    return;
   }
+  im.for_each_span(ch0, ch1, [a, b](float* p, size_t n) { pointwise_affine(p, n, a, b); });
 }
 
 
-void Image::feature_normalize_total() {
-  float min = get_pixel(0, 0, 0);
-  float max = get_pixel(0, 0, 0);
+void Image::feature_normalize() {
   for (int ch = 0; ch < c; ch++) {
-    for (int j = 0; j < h; j++) {
-      for (int i = 0; i < w; i++) {
-        float value = get_pixel(i, j, ch);
-        if (value < min) {
-          min = value;
-        }
-        if (value > max) {
-          max = value;
+    // the range of every channel is found in a single fused pass
+    float min = pixel(0, 0, ch);
+    float max = min;
+    if (layout == INTERLEAVED && c > 1) {
+      for (int row = 0; row < h; row++) {
+        const float* p = RowPtr(row, ch);
+        for (int col = 0; col < w; col++) {
+          min = fminf(min, p[col*c]);
+          max = fmaxf(max, p[col*c]);
         }
       }
+    } else {
+      for_each_span(ch, ch + 1, [&min, &max](float* p, size_t n) {
+        float lo, hi;
+        pointwise_min_max(p, n, &lo, &hi);
+        min = fminf(min, lo);
+        max = fmaxf(max, hi);
+      });
     }
+    normalize_range(*this, ch, ch + 1, min, max);
   }
+}
 
-  float diff = max - min;
-  for (int ch = 0; ch < c; ch++) {
-    for (int j = 0; j < h; j++) {
-      for (int i = 0; i < w; i++) {
-        if (diff == 0) {
-          set_pixel(i, j, ch, 0);
-        } else {
-          set_pixel(i, j, ch, (get_pixel(i, j, ch) - min)/diff);
-        }
-      }
-    }
-  }
-}
\ No newline at end of file
+
+void Image::feature_normalize_total() {
+  float min = pixel(0, 0, 0);
+  float max = min;
+  for_each_span(0, c, [&min, &max](float* p, size_t n) {
+    float lo, hi;
+    pointwise_min_max(p, n, &lo, &hi);
+    min = fminf(min, lo);
+    max = fmaxf(max, hi);
+  });
+  normalize_range(*this, 0, c, min, max);
+}
@@ -1,34 +1,91 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cassert>
 #include <cmath>
 #include <chrono>
-#include <thread>
 #include <mutex>
+#include <new>
 
 #include "../inc/image.h"
+#include "../inc/image_pool.h"
+#include "../inc/pointwise.h"
+#include "../inc/kernels.h"
 #include "../../utils/utils.h"
+#include "../../utils/thread_pool.h"
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
 
 using namespace std;
 
+// MARK: - Allocation
+
+// number of bytes backing a buffer of n floats
+static size_t buffer_bytes(size_t n) {
+  return (n*sizeof(float) + Image::ALIGNMENT - 1) / Image::ALIGNMENT * Image::ALIGNMENT;
+}
+
+
+// allocates a buffer of n floats aligned to Image::ALIGNMENT bytes, recycled 
+// from the image pool when it is enabled
+static float* alloc_image_buffer(size_t n) {
+  return (float*)ImagePool::acquire(buffer_bytes(n));
+}
+
+
+static void free_image_buffer(float* data, size_t n) {
+  ImagePool::release(data, buffer_bytes(n));
+}
+
+
 // MARK: - Constructor
 
 Image::Image() : Image(0, 0, 0) {}
 
 
-Image::Image(int w, int h, int c) : w(w), h(h), c(c), data(nullptr) {
-  // if there is data to be allocated then allocate a data zero'd out 
-  // data buffer to hold the image content 
+Image::Image(int w, int h, int c) : Image(w, h, c, false) {}
+
+
+Image::Image(int w, int h, int c, bool padded) : Image(w, h, c, PLANAR, padded) {}
+
+
+Image::Image(int w, int h, int c, Layout layout, bool padded) : Image(w, h, c, layout, padded, NoInit()) {
+  // zero out the data buffer so a new image starts blank
+  if (data) {
+    clear();
+  }
+}
+
+
+Image::Image(int w, int h, int c, Layout layout, bool padded, NoInit) : w(w), h(h), c(c), layout(layout), data(nullptr) {
+  int row = layout == PLANAR ? w : w*c;
+  stride = padded ? padded_stride(row) : row;
+
+  // if there is data to be allocated then allocate a data 
+  // buffer to hold the image content 
   if (w*h*c) {
-    data = (float*)calloc(w*h*c, sizeof(float));
+    data = alloc_image_buffer(buffer_size());
   }
 }
 
 
+Image Image::uninitialized(int w, int h, int c, Layout layout, bool padded) {
+  return Image(w, h, c, layout, padded, NoInit());
+}
+
+
+int Image::padded_stride(int w) {
+  const int floats_per_line = ALIGNMENT / sizeof(float);
+  return (w + floats_per_line - 1) / floats_per_line * floats_per_line;
+}
+
+
 // MARK: - Destructor
 
 Image::~Image() {
-  free(data);
+  free_image_buffer(data, buffer_size());
 }
 
   
@@ -51,17 +108,22 @@ Image& Image::operator=(const Image& other) {
     return *this;
   }
 
-  if (data) {
-    free(data);
+  // keep the current buffer when it is already the right size
+  if (data && buffer_bytes(buffer_size()) != buffer_bytes(other.buffer_size())) {
+    free_image_buffer(data, buffer_size());
     data = nullptr;
   }
 
   w = other.w;
   h = other.h;
   c = other.c;
+  stride = other.stride;
+  layout = other.layout;
 
-  data = (float*)calloc(w*h*c, sizeof(float));
-  memcpy(data, other.data, sizeof(float)*w*h*c);
+  if (buffer_size()) {
+    if (!data) data = alloc_image_buffer(buffer_size());
+    memcpy(data, other.data, sizeof(float)*buffer_size());
+  }
   return *this;
 }
 
@@ -72,16 +134,18 @@ Image& Image::operator=(Image&& other) {
   }
 
   if (data) {
-    free(data);
+    free_image_buffer(data, buffer_size());
   }
 
   w = other.w;
   h = other.h;
   c = other.c;
+  stride = other.stride;
+  layout = other.layout;
   data = other.data;
 
   other.data = nullptr;
-  other.w = other.h = other.c = 0;
+  other.w = other.h = other.c = other.stride = 0;
   return *this;
 }
 
@@ -92,9 +156,15 @@ bool Image::operator==(Image& other) {
     return 0;
   }
 
-  for(int i = 0; i < w*h*c; ++i) if(!within_eps(data[i], other.data[i])) {
-    printf("The value at %d %d %d should be %f, but it is %f! \n", i/(w*h), (i%(w*h))/h, (i%(w*h))%h, other.data[i], data[i]);
-    return 0;
+  const int ps = pixel_stride();
+  const int other_ps = other.pixel_stride();
+  for(int ch = 0; ch < c; ++ch) for(int y = 0; y < h; ++y) {
+    const float* row = RowPtr(y, ch);
+    const float* other_row = other.RowPtr(y, ch);
+    for(int x = 0; x < w; ++x) if(!within_eps(row[x*ps], other_row[x*other_ps])) {
+      printf("The value at %d %d %d should be %f, but it is %f! \n", ch, y, x, other_row[x*other_ps], row[x*ps]);
+      return 0;
+    }
   }
   return 1;
 }
@@ -102,25 +172,25 @@ bool Image::operator==(Image& other) {
 
 float& Image::operator()(int x, int y, int ch) {
   assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0);
-  return data[ch*w*h + y*w + x];
+  return data[ch*channel_stride() + y*stride + x*pixel_stride()];
 }
 
 
 float& Image::operator()(int x, int y) {
   assert(c==1 && x<w && x>=0 && y<h && y>=0);
-  return data[y*w + x];
+  return data[y*stride + x];
 }
 
 
 const float& Image::operator()(int x, int y, int ch) const {
   assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0);
-  return data[ch*w*h + y*w + x];
+  return data[ch*channel_stride() + y*stride + x*pixel_stride()];
 }
 
 
 const float& Image::operator()(int x, int y) const {
   assert(c==1 && x<w && x>=0 && y<h && y>=0);
-  return data[y*w + x];
+  return data[y*stride + x];
 }
 
 
@@ -136,7 +206,7 @@ float Image::get_pixel(int x, int y, int ch) const {
   x = x < 0 ? 0 : x;
   y = y >= h ? h-1 : y;
   y = y < 0 ? 0 : y;
-  return data[ch*h*w + y*w + x];
+  return data[ch*channel_stride() + y*stride + x*pixel_stride()];
 }
 
 
@@ -153,27 +223,39 @@ void Image::set_pixel(int x, int y, int ch, float v) {
   if(x<0)   return;
   if(y<0)   return;
   if(ch<0)  return;
-  data[ch*w*h + y*w + x] = v;
+  data[ch*channel_stride() + y*stride + x*pixel_stride()] = v;
 }
 
 
 void Image::set_channel(int ch, const Image& im) {
   assert(im.c==1 && ch<c && ch>=0);
-  assert(im.w==w && im.h==h);
-  memcpy(&pixel(0,0,ch),im.data,sizeof(float)*im.size());
+  assert(im.w==w && im.h==h && im.layout==PLANAR);
+  const int ps = pixel_stride();
+  for (int row = 0; row < h; row++) {
+    if (ps == 1) {
+      memcpy(RowPtr(row, ch), im.RowPtr(row, 0), sizeof(float)*w);
+    } else {
+      float* dst = RowPtr(row, ch);
+      const float* src = im.RowPtr(row, 0);
+      for (int col = 0; col < w; col++) dst[col*ps] = src[col];
+    }
+  }
 }
 
 
 Image Image::get_channel(int ch) const  {
   assert(ch<c && ch>=0);
-  Image im(w,h,1);
-  memcpy(im.data,&pixel(0,0,ch),sizeof(float)*im.size());
-  return im;
+  return Image(channel(ch));
 }
 
 
-const float* Image::RowPtr(int row, int ch) const  { return data + ch*w*h + row*w; }
-float* Image::RowPtr(int row, int ch)              { return data + ch*w*h + row*w; }
+const float* Image::RowPtr(int row, int ch) const  { return data + ch*channel_stride() + row*stride; }
+float* Image::RowPtr(int row, int ch)              { return data + ch*channel_stride() + row*stride; }
+
+
+size_t Image::channel_stride() const  { return layout == PLANAR ? (size_t)stride*h : 1; }
+int Image::pixel_stride() const       { return layout == PLANAR ? 1 : c; }
+bool Image::is_contiguous() const     { return stride == w*pixel_stride(); }
   
   
 bool Image::contains(float x, float y) const { 
@@ -193,37 +275,23 @@ bool Image::is_empty(int x, int y) const {
 
 
 bool Image::is_nonempty_patch(int x, int y, int w) const {
-  int channelFlag = 0;
   for (int xPos = x-w; xPos <= x+w; xPos++) {
     for (int yPos = y-w; yPos <= y+w; yPos++) {
       for (int ch = 0; ch < c; ch++) {
         if (get_pixel(xPos, yPos, ch)) {
-          channelFlag++;
+          return true;
         }
       }
     }
   }
-  return channelFlag != 0;
+  return false;
 }
 
 
 void Image::l1_normalize() {
   float sum = 0;
-  for (int ch=0; ch < c; ch++) {
-    for (int row=0; row < h; row++) {
-      for (int col=0; col < w; col++) {
-        sum += get_pixel(row, col, ch);
-      }
-    }
-  }
-
-  for (int ch=0; ch < c; ch++) {
-    for (int row=0; row < h; row++) {
-      for (int col=0; col < w; col++) {
-        set_pixel(row, col, ch, get_pixel(row, col, ch)/sum);
-      }
-    }
-  }
+  for_each_span(0, c, [&sum](float* p, size_t n) { sum += pointwise_sum(p, n); });
+  for_each_span(0, c, [sum](float* p, size_t n) { pointwise_affine(p, n, 1.f/sum, 0.f); });
 }
 
 
@@ -232,53 +300,53 @@ int Image::size() const {
 }
 
 
+size_t Image::buffer_size() const {
+  return layout == PLANAR ? channel_stride()*c : (size_t)stride*h;
+}
+
+
 void Image::clear() const { 
-  memset(data, 0, sizeof(float)*c*w*h); 
+  memset(data, 0, sizeof(float)*buffer_size()); 
 }
 
 
 Image Image::abs(void) const  {
-  Image ret=*this;
-  for(int q2=0;q2<h;q2++)for(int q1=0;q1<w;q1++) {
-    for(int q3=0;q3<c;q3++) {
-      float a=pixel(q1,q2,q3);
-      ret(q1,q2,q3)=fabsf(a);
-    }
-  }
+  Image ret=uninitialized(w,h,c,layout,!is_contiguous());
+  pointwise_abs(ret.data,data,buffer_size());
   return ret;
 }
 
 
+// transposes the columns [xbegin, xend) of one channel in square tiles, xbegin is a multiple of TSZ
 template <size_t TSZ>
-void TiledTranspose(Image& img_out, const Image& img_in, int c) {
-  const size_t w = img_in.w;
+void TiledTranspose(Image& img_out, const Image& img_in, int c, size_t xbegin, size_t xend) {
+  const size_t w = min(xend, (size_t)img_in.w);
   const size_t h = img_in.h;
-  const size_t BPP = sizeof(float);
-  
-  float d[TSZ][TSZ];
   
-  for(size_t xin = 0; xin < w; xin += TSZ) {
+  for(size_t xin = xbegin; xin < w; xin += TSZ) {
     for(size_t yin = 0; yin < h; yin += TSZ) {
       const size_t xspan = min(TSZ, w - xin);
       const size_t yspan = min(TSZ, h - yin);
-      const size_t dmin = min(xspan, yspan);
-      const size_t dmax = max(xspan, yspan);
-      const size_t xout = yin;
-      const size_t yout = xin;
-      
-      for(size_t y = 0; y < yspan; y++) {
-        memcpy(d[y], &img_in(xin, yin + y, c), xspan * BPP);
-      }
-      
-      for(size_t x = 0; x < dmin; x++) {
-        for(size_t y = x + 1; y < dmax; y++) {
-          swap(d[x][y], d[y][x]);
+      kernel_transpose(&img_out(yin, xin, c), img_out.stride, &img_in(xin, yin, c), img_in.stride, yspan, xspan);
+    }
+  }
+}
+
+
+// transposes whole pixels of the rows [ybegin, yend) of an interleaved image in square tiles, ybegin is a multiple of TSZ
+template <int TSZ>
+void TiledTransposeInterleaved(Image& img_out, const Image& img_in, int ybegin, int yend) {
+  const int c = img_in.c;
+  for(int yin = ybegin; yin < min(yend, img_in.h); yin += TSZ) {
+    for(int xin = 0; xin < img_in.w; xin += TSZ) {
+      const int xend = min(xin + TSZ, img_in.w);
+      const int yend = min(yin + TSZ, img_in.h);
+      for(int x = xin; x < xend; x++) {
+        float* out = img_out.RowPtr(x, 0);
+        for(int y = yin; y < yend; y++) {
+          memcpy(out + y*c, img_in.RowPtr(y, 0) + x*c, c*sizeof(float));
         }
       }
-      
-      for(size_t y = 0; y < xspan; y++) {
-        memcpy(&img_out(xout, yout + y,  c), d[y], yspan * BPP);
-      }
     }
   }
 }
@@ -286,37 +354,108 @@ void TiledTranspose(Image& img_out, const Image& img_in, int c) {
 
 Image Image::transpose(void) const {
   //TIME(1);
-  Image ret(h,w,c);
+  Image ret=uninitialized(h,w,c,layout,!is_contiguous());
   
-  if(c>1) {
-    vector<thread> th;
-    for(int c=0;c<this->c;c++)th.push_back(thread([&ret,this,c](){TiledTranspose<80>(ret,*this,c);}));
-    for(auto&e1:th)e1.join();
+  if(layout==INTERLEAVED) {
+    int tiles=(h+31)/32;
+    parallel_for(0,tiles,1,[&](int a,int b){TiledTransposeInterleaved<32>(ret,*this,a*32,b*32);});
+    return ret;
   }
-  else TiledTranspose<80>(ret,*this,0);
+  
+  // one task per column of tiles of every channel
+  int tiles=(w+79)/80;
+  parallel_for(0,c*tiles,1,[&](int a,int b){
+    for(int q=a;q<b;q++)TiledTranspose<80>(ret,*this,q/tiles,(q%tiles)*80,(q%tiles)*80+80);
+  });
   
   return ret;
 }
 
 
-void Image::save(const string& file) {
-  FILE* fn = fopen(file.c_str(),"wb");
-  fwrite(&w, sizeof(w), 1, fn);
-  fwrite(&h, sizeof(h), 1, fn);
-  fwrite(&c, sizeof(c), 1, fn);
-  fwrite(data, sizeof(float), size(), fn);
-  fclose(fn);
+// MARK: - Layout
+
+// scatters one row of 3 planes into an rgb interleaved row
+static void interleave_row3(float* dst, const float* r, const float* g, const float* b, int w) {
+  int x = 0;
+#ifdef __SSE2__
+  // transposing 4 pixels gives 4 registers of rgb plus junk, each store writes
+  // one float past its pixel which the next store overwrites so stop a pixel early
+  const __m128 zero = _mm_setzero_ps();
+  for (; x + 4 < w; x += 4) {
+    __m128 p0 = _mm_loadu_ps(r + x);
+    __m128 p1 = _mm_loadu_ps(g + x);
+    __m128 p2 = _mm_loadu_ps(b + x);
+    __m128 p3 = zero;
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    _mm_storeu_ps(dst + 3*x + 0, p0);
+    _mm_storeu_ps(dst + 3*x + 3, p1);
+    _mm_storeu_ps(dst + 3*x + 6, p2);
+    _mm_storeu_ps(dst + 3*x + 9, p3);
+  }
+#endif
+  for (; x < w; x++) {
+    dst[3*x + 0] = r[x];
+    dst[3*x + 1] = g[x];
+    dst[3*x + 2] = b[x];
+  }
 }
-  
 
-static Image load(const string& file) {
-  int w, h, c;
-  FILE* fn = fopen(file.c_str(), "rb");
-  fread(&w, sizeof(w), 1, fn);
-  fread(&h, sizeof(h), 1, fn);
-  fread(&c, sizeof(c), 1, fn);
-  Image im(w, h, c);
-  fread(im.data, sizeof(float), im.size(), fn);
-  fclose(fn);
-  return im;
-}
\ No newline at end of file
+
+// gathers an rgb interleaved row into 3 planes
+static void deinterleave_row3(float* r, float* g, float* b, const float* src, int w) {
+  int x = 0;
+#ifdef __SSE2__
+  // each load of a pixel reads the first channel of the next one so stop a pixel early
+  for (; x + 4 < w; x += 4) {
+    __m128 p0 = _mm_loadu_ps(src + 3*x + 0);
+    __m128 p1 = _mm_loadu_ps(src + 3*x + 3);
+    __m128 p2 = _mm_loadu_ps(src + 3*x + 6);
+    __m128 p3 = _mm_loadu_ps(src + 3*x + 9);
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    _mm_storeu_ps(r + x, p0);
+    _mm_storeu_ps(g + x, p1);
+    _mm_storeu_ps(b + x, p2);
+  }
+#endif
+  for (; x < w; x++) {
+    r[x] = src[3*x + 0];
+    g[x] = src[3*x + 1];
+    b[x] = src[3*x + 2];
+  }
+}
+
+
+Image Image::to_interleaved() const {
+  if (layout == INTERLEAVED) return *this;
+  Image ret = uninitialized(w, h, c, INTERLEAVED, !is_contiguous());
+  for (int row = 0; row < h; row++) {
+    float* dst = ret.RowPtr(row, 0);
+    if (c == 3) {
+      interleave_row3(dst, RowPtr(row, 0), RowPtr(row, 1), RowPtr(row, 2), w);
+    } else {
+      for (int ch = 0; ch < c; ch++) {
+        const float* src = RowPtr(row, ch);
+        for (int col = 0; col < w; col++) dst[col*c + ch] = src[col];
+      }
+    }
+  }
+  return ret;
+}
+
+
+Image Image::to_planar() const {
+  if (layout == PLANAR) return *this;
+  Image ret = uninitialized(w, h, c, PLANAR, !is_contiguous());
+  for (int row = 0; row < h; row++) {
+    const float* src = RowPtr(row, 0);
+    if (c == 3) {
+      deinterleave_row3(ret.RowPtr(row, 0), ret.RowPtr(row, 1), ret.RowPtr(row, 2), src, w);
+    } else {
+      for (int ch = 0; ch < c; ch++) {
+        float* dst = ret.RowPtr(row, ch);
+        for (int col = 0; col < w; col++) dst[col] = src[col*c + ch];
+      }
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,200 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../inc/image_file.h"
+
+using namespace std;
+
+
+// MARK: - Header
+
+static const char IMAGE_FILE_MAGIC[4] = {'D', 'D', 'I', 'M'};
+
+
+static bool has_magic(const ImageFileHeader& hd) {
+  return memcmp(hd.magic, IMAGE_FILE_MAGIC, sizeof(IMAGE_FILE_MAGIC)) == 0;
+}
+
+
+const char* image_file_problem(const ImageFileHeader& hd, uint64_t file_bytes) {
+  if (hd.version == 0 || hd.version > IMAGE_FILE_VERSION) return "unsupported format version";
+  if (hd.dtype != DTYPE_F32) return "pixels are not float";
+  if (hd.layout != Image::PLANAR && hd.layout != Image::INTERLEAVED) return "unknown layout";
+  if (hd.w < 0 || hd.h < 0 || hd.c < 0) return "negative size";
+  if (hd.data_offset % Image::ALIGNMENT) return "misaligned pixels";
+  if (hd.data_offset > file_bytes || hd.data_bytes > file_bytes - hd.data_offset) return "file is truncated";
+  if (hd.w == 0 || hd.h == 0 || hd.c == 0) return nullptr;
+
+  // the last pixel the strides reach has to be inside the pixels, worked out
+  // so that no product can wrap
+  const uint64_t ps = hd.layout == Image::PLANAR ? 1 : hd.c;
+  const uint64_t planes = hd.layout == Image::PLANAR ? hd.c : 1;
+  const uint64_t elements = hd.data_bytes/sizeof(float);
+  const uint64_t row = hd.w*ps;
+  if (hd.stride < 0 || (uint64_t)hd.stride < row) return "row stride is shorter than a row";
+  if (planes > 1 && hd.cstride < (uint64_t)hd.h*hd.stride) return "channel stride is shorter than a channel";
+  if (planes > 1 && hd.cstride > elements/(planes - 1)) return "channels reach past the pixels";
+  if ((planes - 1)*hd.cstride + (uint64_t)(hd.h - 1)*hd.stride + row > elements) return "rows reach past the pixels";
+  return nullptr;
+}
+
+
+// checks a header read from a file against its size, exits when it can't be loaded as a float image
+static void check_header(const ImageFileHeader& hd, uint64_t file_bytes, const string& file) {
+  const char* problem = image_file_problem(hd, file_bytes);
+  if (problem) {
+    fprintf(stderr, "Cannot load image \"%s\"\nReason: %s\n", file.c_str(), problem);
+    exit(0);
+  }
+}
+
+
+// MARK: - Save / Load
+
+static void read_failed(FILE* fn, const string& file) {
+  fclose(fn);
+  fprintf(stderr, "Cannot load image \"%s\"\nReason: file is truncated\n", file.c_str());
+  exit(0);
+}
+
+
+void Image::save(const string& file) {
+  FILE* fn = fopen(file.c_str(), "wb");
+  if (!fn) {
+    fprintf(stderr, "Cannot write image \"%s\"\n", file.c_str());
+    return;
+  }
+  ImageFileHeader hd;
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, IMAGE_FILE_MAGIC, sizeof(hd.magic));
+  hd.version = IMAGE_FILE_VERSION;
+  hd.dtype = DTYPE_F32;
+  hd.layout = layout;
+  hd.w = w;
+  hd.h = h;
+  hd.c = c;
+  hd.stride = stride;
+  hd.cstride = channel_stride();
+  hd.data_offset = sizeof(ImageFileHeader);
+  hd.data_bytes = sizeof(float)*buffer_size();
+  fwrite(&hd, sizeof(hd), 1, fn);
+  // the buffer goes out as it is, padding included, so a mapped file has the same strides
+  if (buffer_size()) fwrite(data, sizeof(float), buffer_size(), fn);
+  fclose(fn);
+}
+
+
+Image Image::load(const string& file) {
+  FILE* fn = fopen(file.c_str(), "rb");
+  if (!fn) {
+    fprintf(stderr, "Cannot load image \"%s\"\n", file.c_str());
+    exit(0);
+  }
+  fseek(fn, 0, SEEK_END);
+  uint64_t file_bytes = ftell(fn);
+  fseek(fn, 0, SEEK_SET);
+
+  ImageFileHeader hd;
+  memset(&hd, 0, sizeof(hd));
+  if (file_bytes < sizeof(hd) || fread(&hd, sizeof(hd), 1, fn) != 1 || !has_magic(hd)) {
+    // files from before the header: width, height, channels and planar floats
+    int size[3] = {0, 0, 0};
+    fseek(fn, 0, SEEK_SET);
+    bool ok = fread(size, sizeof(int), 3, fn) == 3 && size[0] >= 0 && size[1] >= 0 && size[2] >= 0;
+    ok = ok && (uint64_t)size[0]*size[1]*size[2] <= (file_bytes - sizeof(size))/sizeof(float);
+    if (!ok) read_failed(fn, file);
+    Image im(size[0], size[1], size[2]);
+    if (fread(im.data, sizeof(float), im.size(), fn) != (size_t)im.size()) read_failed(fn, file);
+    fclose(fn);
+    return im;
+  }
+  check_header(hd, file_bytes, file);
+
+  Layout layout = (Layout)hd.layout;
+  const int ps = layout == PLANAR ? 1 : hd.c;
+  Image im = uninitialized(hd.w, hd.h, hd.c, layout, hd.stride != hd.w*ps);
+  fseek(fn, hd.data_offset, SEEK_SET);
+  if (im.stride == hd.stride && im.channel_stride() == hd.cstride && sizeof(float)*im.buffer_size() <= hd.data_bytes) {
+    if (fread(im.data, sizeof(float), im.buffer_size(), fn) != im.buffer_size()) read_failed(fn, file);
+  } else {
+    // written with a different padding, read row by row
+    const int planes = layout == PLANAR ? hd.c : 1;
+    for (int ch = 0; ch < planes; ch++) {
+      for (int row = 0; row < hd.h; row++) {
+        fseek(fn, hd.data_offset + sizeof(float)*(ch*hd.cstride + (uint64_t)row*hd.stride), SEEK_SET);
+        if (fread(im.RowPtr(row, ch), sizeof(float), (size_t)hd.w*ps, fn) != (size_t)hd.w*ps) read_failed(fn, file);
+      }
+    }
+  }
+  fclose(fn);
+  return im;
+}
+
+
+// MARK: - MappedImage
+
+struct MappedImage::Mapping
+{
+  void* base;
+  size_t bytes;
+  ImageFileHeader header;
+
+  Mapping() : base(nullptr), bytes(0) { memset(&header, 0, sizeof(header)); }
+  ~Mapping() { if (base) munmap(base, bytes); }
+};
+
+
+MappedImage::MappedImage() : mapping(make_shared<Mapping>()) {}
+
+
+MappedImage::MappedImage(const string& file) : mapping(make_shared<Mapping>()) {
+  int fd = open(file.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Cannot map image \"%s\"\n", file.c_str());
+    exit(0);
+  }
+  if ((size_t)st.st_size < sizeof(ImageFileHeader)) {
+    fprintf(stderr, "Cannot map image \"%s\"\nReason: not an image file\n", file.c_str());
+    exit(0);
+  }
+
+  void* base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Cannot map image \"%s\"\n", file.c_str());
+    exit(0);
+  }
+  mapping->base = base;
+  mapping->bytes = st.st_size;
+  memcpy(&mapping->header, base, sizeof(ImageFileHeader));
+  if (!has_magic(mapping->header)) {
+    fprintf(stderr, "Cannot map image \"%s\"\nReason: not an image file\n", file.c_str());
+    exit(0);
+  }
+  check_header(mapping->header, st.st_size, file);
+}
+
+
+const ImageFileHeader& MappedImage::header() const { return mapping->header; }
+bool MappedImage::valid() const                    { return mapping->base != nullptr; }
+
+
+ImageView MappedImage::view() const {
+  if (!valid()) return ImageView();
+  const ImageFileHeader& hd = mapping->header;
+  float* pixels = (float*)((char*)mapping->base + hd.data_offset);
+  return ImageView(pixels, hd.w, hd.h, hd.c, hd.stride, hd.cstride, hd.layout == Image::PLANAR ? 1 : hd.c);
+}
+
+
+Image MappedImage::copy() const {
+  return Image(view());
+}
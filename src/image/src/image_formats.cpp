@@ -0,0 +1,547 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <cctype>
+#include <vector>
+#include <algorithm>
+
+#include "../inc/image_formats.h"
+#include "../inc/kernels.h"
+#include "../inc/stb_image_write.h"
+#include "../../utils/thread_pool.h"
+
+using namespace std;
+
+
+// MARK: - Helpers
+
+ImageFormat image_format_for(const string& filename) {
+  size_t dot = filename.rfind('.');
+  if (dot == string::npos || filename.find('/', dot) != string::npos) return FORMAT_UNKNOWN;
+  string ext = filename.substr(dot + 1);
+  for (char& ch : ext) ch = (char)tolower((unsigned char)ch);
+  if (ext == "jpg" || ext == "jpeg") return FORMAT_JPG;
+  if (ext == "png") return FORMAT_PNG;
+  if (ext == "qoi") return FORMAT_QOI;
+  if (ext == "pfm") return FORMAT_PFM;
+  if (ext == "ppm") return FORMAT_PPM;
+  if (ext == "pgm") return FORMAT_PGM;
+  return FORMAT_UNKNOWN;
+}
+
+
+bool is_fast_format(ImageFormat format) {
+  return format == FORMAT_QOI || format == FORMAT_PFM || format == FORMAT_PPM || format == FORMAT_PGM;
+}
+
+
+static void load_failed(const string& filename, const char* reason) {
+  fprintf(stderr, "Cannot load image \"%s\"\nReason: %s\n", filename.c_str(), reason);
+  exit(0);
+}
+
+
+static vector<unsigned char> read_file(const string& filename) {
+  FILE* fn = fopen(filename.c_str(), "rb");
+  if (!fn) load_failed(filename, "can't open file");
+  fseek(fn, 0, SEEK_END);
+  long size = ftell(fn);
+  fseek(fn, 0, SEEK_SET);
+  vector<unsigned char> bytes(size > 0 ? size : 0);
+  size_t got = fread(bytes.data(), 1, bytes.size(), fn);
+  fclose(fn);
+  if (got != bytes.size()) load_failed(filename, "short read");
+  return bytes;
+}
+
+
+static bool write_file(const string& filename, const void* data, size_t n) {
+  FILE* fn = fopen(filename.c_str(), "wb");
+  if (!fn) return false;
+  bool ok = fwrite(data, 1, n, fn) == n;
+  return fclose(fn) == 0 && ok;
+}
+
+
+void to_interleaved_u8(const ImageView& im, unsigned char* data) {
+  parallel_for(0, im.h, 16, [&](int j0, int j1) {
+    if (im.pstride == im.c) {
+      // already interleaved, rows convert straight across
+      for (int j = j0; j < j1; ++j) kernel_float_to_u8(data + (size_t)im.w*im.c*j, im.RowPtr(j, 0), im.w*im.c);
+    } else if (im.pstride == 1 && im.c <= 4) {
+      const float* planes[4];
+      for (int j = j0; j < j1; ++j) {
+        for (int k = 0; k < im.c; ++k) planes[k] = im.RowPtr(j, k);
+        kernel_float_interleave_u8(data + (size_t)im.w*im.c*j, im.c, planes, im.w);
+      }
+    } else {
+      for (int k = 0; k < im.c; ++k) for (int j = j0; j < j1; ++j) {
+        const float* row = im.RowPtr(j, k);
+        for (int i = 0; i < im.w; ++i) data[((size_t)i + (size_t)im.w*j)*im.c + k] = (unsigned char)roundf(255*row[i*im.pstride]);
+      }
+    }
+  });
+}
+
+
+// an interleaved 8 bit image as it comes out of a decoder
+struct Pixels8 {
+  int w, h, c;
+  vector<unsigned char> data;
+};
+
+
+// drops alpha and splits into planes
+static ImageU8 to_image_u8(const Pixels8& px) {
+  ImageU8 im(px.w, px.h, px.c == 4 ? 3 : px.c);
+  parallel_for(0, px.h, 16, [&](int j0, int j1) {
+    for (int k = 0; k < im.c; ++k) for (int j = j0; j < j1; ++j) {
+      uint8_t* row = im.RowPtr(j, k);
+      const unsigned char* src = px.data.data() + (size_t)j*px.w*px.c + k;
+      for (int i = 0; i < px.w; ++i) row[i] = src[i*px.c];
+    }
+  });
+  return im;
+}
+
+
+// drops alpha and widens to float the same way load_image does
+static Image to_image(const Pixels8& px, Image::Layout layout) {
+  int oc = px.c == 4 ? 3 : px.c;
+  Image im = Image::uninitialized(px.w, px.h, oc, layout);
+  parallel_for(0, px.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; ++j) {
+      const unsigned char* src = px.data.data() + (size_t)j*px.w*px.c;
+      if (layout == Image::INTERLEAVED) {
+        vector<float> row(px.c == oc ? 0 : (size_t)px.w*px.c);
+        if (px.c == oc) { kernel_u8_to_float(im.RowPtr(j, 0), src, px.w*px.c); continue; }
+        kernel_u8_to_float(row.data(), src, px.w*px.c);
+        float* dst = im.RowPtr(j, 0);
+        for (int i = 0; i < px.w; ++i) for (int k = 0; k < oc; ++k) dst[i*oc + k] = row[i*px.c + k];
+      } else {
+        float* planes[4];
+        for (int k = 0; k < oc; ++k) planes[k] = im.RowPtr(j, k);
+        kernel_u8_deinterleave(planes, oc, src, px.c, px.w);
+      }
+    }
+  });
+  return im;
+}
+
+
+// MARK: - QOI
+
+// the format is described at https://qoiformat.org/qoi-specification.pdf
+
+enum {
+  QOI_OP_INDEX = 0x00,
+  QOI_OP_DIFF  = 0x40,
+  QOI_OP_LUMA  = 0x80,
+  QOI_OP_RUN   = 0xc0,
+  QOI_OP_RGB   = 0xfe,
+  QOI_OP_RGBA  = 0xff,
+  QOI_MASK     = 0xc0,
+};
+
+static const unsigned char QOI_END[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+
+struct QoiPixel {
+  unsigned char r, g, b, a;
+  bool operator==(const QoiPixel& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+};
+
+
+static int qoi_hash(const QoiPixel& p) { return (p.r*3 + p.g*5 + p.b*7 + p.a*11) % 64; }
+
+
+static void put_u32(vector<unsigned char>& out, uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+
+// encodes interleaved rgb or rgba bytes
+static vector<unsigned char> qoi_encode(const unsigned char* px, int w, int h, int c) {
+  vector<unsigned char> out;
+  out.reserve(14 + (size_t)w*h*(c + 1) + sizeof(QOI_END));
+  out.insert(out.end(), {'q', 'o', 'i', 'f'});
+  put_u32(out, w);
+  put_u32(out, h);
+  out.push_back(c);
+  out.push_back(0);
+
+  QoiPixel index[64];
+  memset(index, 0, sizeof(index));
+  QoiPixel prev = {0, 0, 0, 255};
+  int run = 0;
+  const size_t n = (size_t)w*h;
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char* p = px + i*c;
+    QoiPixel cur = {p[0], p[1], p[2], c == 4 ? p[3] : (unsigned char)255};
+
+    if (cur == prev) {
+      run++;
+      if (run == 62 || i == n - 1) {
+        out.push_back(QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      out.push_back(QOI_OP_RUN | (run - 1));
+      run = 0;
+    }
+
+    int h = qoi_hash(cur);
+    if (index[h] == cur) {
+      out.push_back(QOI_OP_INDEX | h);
+    } else {
+      index[h] = cur;
+      if (cur.a == prev.a) {
+        signed char dr = cur.r - prev.r;
+        signed char dg = cur.g - prev.g;
+        signed char db = cur.b - prev.b;
+        signed char dr_dg = dr - dg;
+        signed char db_dg = db - dg;
+        if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+          out.push_back(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+          out.push_back(QOI_OP_LUMA | (dg + 32));
+          out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+        } else {
+          out.insert(out.end(), {(unsigned char)QOI_OP_RGB, cur.r, cur.g, cur.b});
+        }
+      } else {
+        out.insert(out.end(), {(unsigned char)QOI_OP_RGBA, cur.r, cur.g, cur.b, cur.a});
+      }
+    }
+    prev = cur;
+  }
+  out.insert(out.end(), QOI_END, QOI_END + sizeof(QOI_END));
+  return out;
+}
+
+
+static uint32_t get_u32(const unsigned char* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+
+static Pixels8 qoi_decode(const vector<unsigned char>& bytes, const string& filename) {
+  if (bytes.size() < 14 + sizeof(QOI_END) || memcmp(bytes.data(), "qoif", 4) != 0) load_failed(filename, "not a qoi file");
+  Pixels8 px;
+  px.w = get_u32(bytes.data() + 4);
+  px.h = get_u32(bytes.data() + 8);
+  px.c = bytes[12];
+  if (px.w <= 0 || px.h <= 0 || (px.c != 3 && px.c != 4)) load_failed(filename, "bad qoi header");
+  px.data.resize((size_t)px.w*px.h*px.c);
+
+  QoiPixel index[64];
+  memset(index, 0, sizeof(index));
+  QoiPixel cur = {0, 0, 0, 255};
+  int run = 0;
+  size_t pos = 14;
+  const size_t end = bytes.size() - sizeof(QOI_END);
+  const size_t n = (size_t)px.w*px.h;
+  for (size_t i = 0; i < n; i++) {
+    if (run > 0) {
+      run--;
+    } else if (pos < end) {
+      int b1 = bytes[pos++];
+      if (b1 == QOI_OP_RGB) {
+        cur.r = bytes[pos];
+        cur.g = bytes[pos + 1];
+        cur.b = bytes[pos + 2];
+        pos += 3;
+      } else if (b1 == QOI_OP_RGBA) {
+        cur.r = bytes[pos];
+        cur.g = bytes[pos + 1];
+        cur.b = bytes[pos + 2];
+        cur.a = bytes[pos + 3];
+        pos += 4;
+      } else if ((b1 & QOI_MASK) == QOI_OP_INDEX) {
+        cur = index[b1];
+      } else if ((b1 & QOI_MASK) == QOI_OP_DIFF) {
+        cur.r += ((b1 >> 4) & 0x03) - 2;
+        cur.g += ((b1 >> 2) & 0x03) - 2;
+        cur.b += (b1 & 0x03) - 2;
+      } else if ((b1 & QOI_MASK) == QOI_OP_LUMA) {
+        int b2 = bytes[pos++];
+        int dg = (b1 & 0x3f) - 32;
+        cur.r += dg - 8 + ((b2 >> 4) & 0x0f);
+        cur.g += dg;
+        cur.b += dg - 8 + (b2 & 0x0f);
+      } else {
+        run = b1 & 0x3f;
+      }
+      index[qoi_hash(cur)] = cur;
+    }
+    unsigned char* p = px.data.data() + i*px.c;
+    p[0] = cur.r;
+    p[1] = cur.g;
+    p[2] = cur.b;
+    if (px.c == 4) p[3] = cur.a;
+  }
+  return px;
+}
+
+
+// MARK: - PNM / PFM
+
+// reads the whitespace separated header fields of a netpbm file, skipping comments
+static bool pnm_fields(const vector<unsigned char>& bytes, size_t& pos, int count, vector<string>& fields) {
+  while ((int)fields.size() < count) {
+    while (pos < bytes.size() && (isspace(bytes[pos]) || bytes[pos] == '#')) {
+      if (bytes[pos] == '#') while (pos < bytes.size() && bytes[pos] != '\n') pos++;
+      else pos++;
+    }
+    if (pos >= bytes.size()) return false;
+    string field;
+    while (pos < bytes.size() && !isspace(bytes[pos])) field += (char)bytes[pos++];
+    fields.push_back(field);
+  }
+  // exactly one whitespace byte separates the header from the samples
+  pos++;
+  return pos <= bytes.size();
+}
+
+
+// a decoded netpbm or pfm file, samples interleaved as floats or integers up to maxval
+struct PnmPixels {
+  int w, h, c;
+  int maxval;                    // 0 for pfm
+  const unsigned char* samples;  // raw samples, rows top to bottom for pnm
+  bool big_endian;
+};
+
+
+static PnmPixels pnm_decode(const vector<unsigned char>& bytes, const string& filename) {
+  if (bytes.size() < 2 || bytes[0] != 'P') load_failed(filename, "not a pnm or pfm file");
+  PnmPixels px;
+  char kind = bytes[1];
+  size_t pos = 2;
+  vector<string> fields;
+  if (kind == '5' || kind == '6') {
+    if (!pnm_fields(bytes, pos, 3, fields)) load_failed(filename, "bad pnm header");
+    px.c = kind == '6' ? 3 : 1;
+    px.maxval = atoi(fields[2].c_str());
+    px.big_endian = true;
+    if (px.maxval <= 0 || px.maxval > 65535) load_failed(filename, "bad pnm maxval");
+  } else if (kind == 'F' || kind == 'f') {
+    if (!pnm_fields(bytes, pos, 3, fields)) load_failed(filename, "bad pfm header");
+    px.c = kind == 'F' ? 3 : 1;
+    px.maxval = 0;
+    px.big_endian = atof(fields[2].c_str()) > 0;
+  } else {
+    load_failed(filename, "only binary pgm, ppm and pfm files are supported");
+  }
+  px.w = atoi(fields[0].c_str());
+  px.h = atoi(fields[1].c_str());
+  size_t sample_bytes = px.maxval == 0 ? 4 : px.maxval > 255 ? 2 : 1;
+  if (px.w <= 0 || px.h <= 0 || pos + (size_t)px.w*px.h*px.c*sample_bytes > bytes.size()) load_failed(filename, "file is truncated");
+  px.samples = bytes.data() + pos;
+  return px;
+}
+
+
+static bool host_big_endian() {
+  const uint16_t one = 1;
+  return *(const unsigned char*)&one == 0;
+}
+
+
+// sample i of row (top to bottom) y as a float, ints are scaled by maxval
+static inline float pnm_sample(const PnmPixels& px, int y, size_t i) {
+  if (px.maxval == 0) {
+    // pfm rows are stored bottom to top
+    const unsigned char* p = px.samples + ((size_t)(px.h - 1 - y)*px.w*px.c + i)*4;
+    unsigned char b[4] = {p[0], p[1], p[2], p[3]};
+    if (px.big_endian != host_big_endian()) { swap(b[0], b[3]); swap(b[1], b[2]); }
+    float v;
+    memcpy(&v, b, 4);
+    return v;
+  }
+  size_t k = (size_t)y*px.w*px.c + i;
+  if (px.maxval > 255) return (float)(px.samples[2*k] << 8 | px.samples[2*k + 1]) / (float)px.maxval;
+  return (float)px.samples[k] / (float)px.maxval;
+}
+
+
+static Image pnm_to_image(const PnmPixels& px, Image::Layout layout) {
+  if (px.maxval == 255) {
+    // the common 8 bit case takes the same path as every other 8 bit format
+    Pixels8 p8 = {px.w, px.h, px.c, vector<unsigned char>(px.samples, px.samples + (size_t)px.w*px.h*px.c)};
+    return to_image(p8, layout);
+  }
+  Image im = Image::uninitialized(px.w, px.h, px.c, layout);
+  const int ps = im.pixel_stride();
+  parallel_for(0, px.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; ++j) {
+      for (int k = 0; k < px.c; ++k) {
+        float* row = im.RowPtr(j, k);
+        for (int i = 0; i < px.w; ++i) row[i*ps] = pnm_sample(px, j, (size_t)i*px.c + k);
+      }
+    }
+  });
+  return im;
+}
+
+
+// MARK: - Size
+
+bool fast_image_size(const string& filename, int* w, int* h) {
+  FILE* fn = fopen(filename.c_str(), "rb");
+  if (!fn) return false;
+  // the header fits in the start of the file unless its comments are huge
+  vector<unsigned char> head(4096);
+  head.resize(fread(head.data(), 1, head.size(), fn));
+  fclose(fn);
+  ImageFormat format = image_format_for(filename);
+  if (format == FORMAT_QOI) {
+    if (head.size() < 14 || memcmp(head.data(), "qoif", 4) != 0) return false;
+    *w = (int)get_u32(head.data() + 4);
+    *h = (int)get_u32(head.data() + 8);
+    return *w > 0 && *h > 0;
+  }
+  if (!is_fast_format(format) || head.size() < 2 || head[0] != 'P') return false;
+  size_t pos = 2;
+  vector<string> fields;
+  if (!pnm_fields(head, pos, 2, fields)) return false;
+  *w = atoi(fields[0].c_str());
+  *h = atoi(fields[1].c_str());
+  return *w > 0 && *h > 0;
+}
+
+
+// MARK: - Load
+
+Image load_image_fast(const string& filename, Image::Layout layout) {
+  ImageFormat format = image_format_for(filename);
+  vector<unsigned char> bytes = read_file(filename);
+  if (format == FORMAT_QOI) return to_image(qoi_decode(bytes, filename), layout);
+  if (format == FORMAT_PFM || format == FORMAT_PPM || format == FORMAT_PGM) return pnm_to_image(pnm_decode(bytes, filename), layout);
+  load_failed(filename, "not a qoi, pfm, ppm or pgm file");
+  return Image();
+}
+
+
+ImageU8 load_image_fast_u8(const string& filename) {
+  ImageFormat format = image_format_for(filename);
+  vector<unsigned char> bytes = read_file(filename);
+  if (format == FORMAT_QOI) return to_image_u8(qoi_decode(bytes, filename));
+  if (format == FORMAT_PFM || format == FORMAT_PPM || format == FORMAT_PGM) {
+    PnmPixels px = pnm_decode(bytes, filename);
+    if (px.maxval == 255) return to_image_u8({px.w, px.h, px.c, vector<unsigned char>(px.samples, px.samples + (size_t)px.w*px.h*px.c)});
+    ImageU8 im(px.w, px.h, px.c);
+    for (int k = 0; k < px.c; ++k) for (int j = 0; j < px.h; ++j) {
+      uint8_t* row = im.RowPtr(j, k);
+      for (int i = 0; i < px.w; ++i) row[i] = pixel_traits<uint8_t>::from_float(pnm_sample(px, j, (size_t)i*px.c + k));
+    }
+    return im;
+  }
+  load_failed(filename, "not a qoi, pfm, ppm or pgm file");
+  return ImageU8();
+}
+
+
+// MARK: - Save
+
+// writes interleaved 8 bit pixels with c channels in the given format
+static void save_u8(const unsigned char* data, int w, int h, int c, ImageFormat format, const string& filename) {
+  bool ok = false;
+  vector<unsigned char> converted;
+  // grey is repeated in every channel, a missing third channel is 0, rgb
+  // becomes grey with the weights of rgb_to_grayscale
+  if ((format == FORMAT_PGM && c != 1) || (format == FORMAT_PPM && c != 3) || (format == FORMAT_QOI && c < 3)) {
+    int oc = format == FORMAT_PGM ? 1 : 3;
+    converted.resize((size_t)w*h*oc);
+    for (size_t i = 0; i < (size_t)w*h; i++) for (int k = 0; k < oc; k++) {
+      const unsigned char* p = data + i*c;
+      if (oc == 1 && c >= 3) converted[i] = (unsigned char)(0.299f*p[0] + 0.587f*p[1] + 0.114f*p[2] + 0.5f);
+      else converted[i*oc + k] = c == 1 ? p[0] : k < c ? p[k] : 0;
+    }
+    data = converted.data();
+    c = oc;
+  }
+
+  switch (format) {
+    case FORMAT_QOI: {
+      vector<unsigned char> out = qoi_encode(data, w, h, c);
+      ok = write_file(filename, out.data(), out.size());
+      break;
+    }
+    case FORMAT_PPM:
+    case FORMAT_PGM: {
+      char header[64];
+      int n = snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", format == FORMAT_PGM ? '5' : '6', w, h);
+      vector<unsigned char> out(header, header + n);
+      out.insert(out.end(), data, data + (size_t)w*h*c);
+      ok = write_file(filename, out.data(), out.size());
+      break;
+    }
+    case FORMAT_PNG: ok = stbi_write_png(filename.c_str(), w, h, c, data, w*c) != 0; break;
+    case FORMAT_JPG: ok = stbi_write_jpg(filename.c_str(), w, h, c, data, 100) != 0; break;
+    default: fprintf(stderr, "Unknown image format for %s\n", filename.c_str()); return;
+  }
+  if (!ok) fprintf(stderr, "Failed to write image %s\n", filename.c_str());
+}
+
+
+// writes little endian floats, rows bottom to top, the third channel of a two
+// channel image as 0
+static void save_pfm(const ImageView& im, const string& filename) {
+  int c = im.c == 1 ? 1 : 3;
+  char header[64];
+  int n = snprintf(header, sizeof(header), "P%c\n%d %d\n%s\n", c == 3 ? 'F' : 'f', im.w, im.h, host_big_endian() ? "1.0" : "-1.0");
+  vector<float> samples((size_t)im.w*im.h*c);
+  parallel_for(0, im.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; ++j) {
+      float* dst = samples.data() + (size_t)(im.h - 1 - j)*im.w*c;
+      for (int k = 0; k < c; ++k) {
+        if (k >= im.c) {
+          for (int i = 0; i < im.w; ++i) dst[i*c + k] = 0.f;
+          continue;
+        }
+        const float* row = im.RowPtr(j, k);
+        for (int i = 0; i < im.w; ++i) dst[i*c + k] = row[i*im.pstride];
+      }
+    }
+  });
+  vector<unsigned char> out(header, header + n);
+  out.insert(out.end(), (const unsigned char*)samples.data(), (const unsigned char*)(samples.data() + samples.size()));
+  if (!write_file(filename, out.data(), out.size())) fprintf(stderr, "Failed to write image %s\n", filename.c_str());
+}
+
+
+void save_image_file(const ImageView& im, const string& filename) {
+  ImageFormat format = image_format_for(filename);
+  if (format == FORMAT_PFM) {
+    save_pfm(im, filename);
+    return;
+  }
+  vector<unsigned char> data((size_t)im.w*im.h*im.c);
+  to_interleaved_u8(im, data.data());
+  save_u8(data.data(), im.w, im.h, im.c, format, filename);
+}
+
+
+void save_image_file(const ImageU8& im, const string& filename) {
+  ImageFormat format = image_format_for(filename);
+  if (format == FORMAT_PFM) {
+    Image widened = im.to_float();
+    save_pfm(widened, filename);
+    return;
+  }
+  vector<unsigned char> data((size_t)im.w*im.h*im.c);
+  for (int k = 0; k < im.c; ++k) for (int j = 0; j < im.h; ++j) {
+    const uint8_t* row = im.RowPtr(j, k);
+    unsigned char* dst = data.data() + (size_t)j*im.w*im.c + k;
+    for (int i = 0; i < im.w; ++i) dst[i*im.c] = row[i];
+  }
+  save_u8(data.data(), im.w, im.h, im.c, format, filename);
+}
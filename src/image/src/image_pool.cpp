@@ -0,0 +1,189 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+#include "../inc/image.h"
+#include "../inc/image_pool.h"
+
+using namespace std;
+
+
+typedef map<size_t, vector<void*>> Buckets;
+
+// buffers parked per thread before they spill into the shared cache
+static const size_t LOCAL_CAPACITY = 64 << 20;
+
+
+static bool env_enabled() {
+  const char* env = getenv("DDIMG_IMAGE_POOL");
+  return env && atoi(env) != 0;
+}
+
+
+static atomic<bool> pool_enabled(env_enabled());
+static atomic<size_t> global_capacity(512 << 20);
+// bumped by trim, a thread cache from an older generation is freed on its next use
+static atomic<unsigned> generation(0);
+
+static mutex global_mutex;
+static Buckets global_buckets;
+static size_t global_bytes = 0;
+
+
+static void* system_alloc(size_t bytes) {
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, Image::ALIGNMENT, bytes)) {
+    throw bad_alloc();
+  }
+  return ptr;
+}
+
+
+static void free_all(Buckets& buckets) {
+  for (auto& bucket : buckets) {
+    for (void* ptr : bucket.second) free(ptr);
+  }
+  buckets.clear();
+}
+
+
+// parks a buffer in the shared cache or frees it if the cache is full or the
+// pool is off
+static void global_release(void* ptr, size_t bytes) {
+  {
+    lock_guard<mutex> lock(global_mutex);
+    if (pool_enabled && global_bytes + bytes <= global_capacity) {
+      global_buckets[bytes].push_back(ptr);
+      global_bytes += bytes;
+      return;
+    }
+  }
+  free(ptr);
+}
+
+
+struct LocalCache {
+  Buckets buckets;
+  size_t bytes = 0;
+  unsigned generation = 0;
+
+  // a finishing thread hands its buffers to the shared cache, unless they
+  // were trimmed since
+  ~LocalCache() {
+    if (generation != ::generation) {
+      free_all(buckets);
+      return;
+    }
+    for (auto& bucket : buckets) {
+      for (void* ptr : bucket.second) global_release(ptr, bucket.first);
+    }
+  }
+};
+
+
+// the calling thread's cache, emptied first if the pool was trimmed since the
+// thread last used it
+static LocalCache& local_cache() {
+  static thread_local LocalCache cache;
+  unsigned current = generation;
+  if (cache.generation != current) {
+    free_all(cache.buckets);
+    cache.bytes = 0;
+    cache.generation = current;
+  }
+  return cache;
+}
+
+
+static void* take(Buckets& buckets, size_t bytes) {
+  auto it = buckets.find(bytes);
+  if (it == buckets.end() || it->second.empty()) return nullptr;
+  void* ptr = it->second.back();
+  it->second.pop_back();
+  return ptr;
+}
+
+
+// MARK: - ImagePool
+
+size_t ImagePool::bucket_size(size_t bytes) {
+  // eight buckets per power of two so at most 1/8th of a buffer goes unused
+  size_t size = Image::ALIGNMENT;
+  while (size*2 <= bytes) size *= 2;
+  size_t step = max((size_t)Image::ALIGNMENT, size/8);
+  return (bytes + step - 1) / step * step;
+}
+
+
+void ImagePool::set_enabled(bool enabled) {
+  pool_enabled = enabled;
+  if (!enabled) trim();
+}
+
+
+bool ImagePool::enabled() { return pool_enabled; }
+
+
+void ImagePool::set_capacity(size_t bytes) { global_capacity = bytes; }
+
+
+void* ImagePool::acquire(size_t bytes) {
+  // always allocate whole buckets so buffers acquired while the pool was off
+  // can be recycled once it is turned on
+  bytes = bucket_size(bytes);
+  LocalCache& local = local_cache();
+  if (!pool_enabled) return system_alloc(bytes);
+
+  void* ptr = take(local.buckets, bytes);
+  if (ptr) {
+    local.bytes -= bytes;
+    return ptr;
+  }
+
+  {
+    lock_guard<mutex> lock(global_mutex);
+    ptr = take(global_buckets, bytes);
+    if (ptr) global_bytes -= bytes;
+  }
+  return ptr ? ptr : system_alloc(bytes);
+}
+
+
+void ImagePool::release(void* ptr, size_t bytes) {
+  if (!ptr) return;
+  LocalCache& local = local_cache();
+  if (!pool_enabled) {
+    free(ptr);
+    return;
+  }
+
+  bytes = bucket_size(bytes);
+  if (local.bytes + bytes <= LOCAL_CAPACITY) {
+    local.buckets[bytes].push_back(ptr);
+    local.bytes += bytes;
+    return;
+  }
+  global_release(ptr, bytes);
+}
+
+
+void ImagePool::trim() {
+  // the other threads see the new generation the next time they touch the pool
+  generation++;
+  local_cache();
+
+  lock_guard<mutex> lock(global_mutex);
+  free_all(global_buckets);
+  global_bytes = 0;
+}
+
+
+size_t ImagePool::cached_bytes() {
+  lock_guard<mutex> lock(global_mutex);
+  return global_bytes + local_cache().bytes;
+}
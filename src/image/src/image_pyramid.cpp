@@ -0,0 +1,75 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "../inc/image_pyramid.h"
+#include "../inc/resample.h"
+
+using namespace std;
+
+
+// MARK: - ImagePyramid
+
+ImagePyramid::ImagePyramid() : scale(2), cache(make_shared<Levels>()) {}
+
+
+ImagePyramid::ImagePyramid(const Image& base, float factor, int levels) : ImagePyramid(Image(base), factor, levels) {}
+
+
+ImagePyramid::ImagePyramid(Image&& base, float factor, int levels) : scale(factor), cache(make_shared<Levels>()) {
+  assert(factor > 1 && levels >= 0);
+  if (levels == 0) {
+    levels = 1;
+    for (int w = base.w, h = base.h; min(w, h) > 1; levels++) {
+      w = max(1, (int)(w/factor));
+      h = max(1, (int)(h/factor));
+    }
+  }
+  cache->gaussian.resize(levels);
+  cache->laplacian.resize(levels);
+  cache->has_gaussian.assign(levels, false);
+  cache->has_laplacian.assign(levels, false);
+  cache->gaussian[0] = move(base);
+  cache->has_gaussian[0] = true;
+}
+
+
+int ImagePyramid::levels() const { return cache->gaussian.size(); }
+
+
+const Image& ImagePyramid::gaussian(int level) const {
+  assert(level >= 0 && level < levels());
+  lock_guard<mutex> guard(cache->lock);
+  int first = level;
+  while (!cache->has_gaussian[first]) first--;
+  for (int l = first + 1; l <= level; l++) {
+    const Image& prev = cache->gaussian[l - 1];
+    int w = max(1, (int)(prev.w/scale));
+    int h = max(1, (int)(prev.h/scale));
+    cache->gaussian[l] = smooth_resize(prev, scale/1.5f, w, h);
+    cache->has_gaussian[l] = true;
+  }
+  return cache->gaussian[level];
+}
+
+
+const Image& ImagePyramid::laplacian(int level) const {
+  assert(level >= 0 && level < levels());
+  const Image& g = gaussian(level);
+  if (level == levels() - 1) return g;
+  const Image& next = gaussian(level + 1);
+
+  lock_guard<mutex> guard(cache->lock);
+  if (!cache->has_laplacian[level]) {
+    cache->laplacian[level] = g - next.bilinear_resize(g.w, g.h);
+    cache->has_laplacian[level] = true;
+  }
+  return cache->laplacian[level];
+}
+
+
+vector<Image> ImagePyramid::gaussian_levels() const {
+  vector<Image> out;
+  for (int l = 0; l < levels(); l++) out.push_back(gaussian(l));
+  return out;
+}
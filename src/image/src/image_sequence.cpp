@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+
+#include "../inc/image_sequence.h"
+#include "../../utils/thread_pool.h"
+
+using namespace std;
+
+
+// MARK: - Names
+
+string sequence_filename(const string& pattern, int index) {
+  int n = snprintf(nullptr, 0, pattern.c_str(), index);
+  vector<char> buf(max(n, 0) + 1);
+  snprintf(buf.data(), buf.size(), pattern.c_str(), index);
+  return string(buf.data());
+}
+
+
+// MARK: - Batch loading
+
+// decodes every frame of the range, at most n_threads at a time
+template <class T>
+static vector<T> load_sequence(const string& pattern, FrameRange range, int n_threads, T (*load)(const string&)) {
+  vector<T> frames(range.size());
+  if (n_threads <= 0) n_threads = num_threads();
+  n_threads = min(n_threads, (int)frames.size());
+
+  // one task per decoding thread, each pulls the next frame until none are left
+  atomic<int> next(0);
+  parallel_for(0, n_threads, 1, [&](int a, int b) {
+    for (int t = a; t < b; t++) {
+      for (int i = next++; i < (int)frames.size(); i = next++) {
+        frames[i] = load(sequence_filename(pattern, range.begin + i));
+      }
+    }
+  });
+  return frames;
+}
+
+
+static Image load_planar(const string& filename) { return load_image(filename); }
+static ImageU8 load_u8(const string& filename)    { return load_image_u8(filename); }
+
+
+vector<Image> load_image_sequence(const string& pattern, FrameRange range, int n_threads) {
+  return load_sequence<Image>(pattern, range, n_threads, load_planar);
+}
+
+
+vector<ImageU8> load_image_sequence_u8(const string& pattern, FrameRange range, int n_threads) {
+  return load_sequence<ImageU8>(pattern, range, n_threads, load_u8);
+}
+
+
+// MARK: - SequenceReader
+
+template <class T>
+SequenceReader<T>::SequenceReader(const string& pattern, FrameRange range, int window, Loader load)
+  : shared(make_shared<Shared>(pattern, range, max(1, window), load)), range(range), cursor(range.begin), scheduled(range.begin) {
+  for (Slot& slot : shared->slots) slot.state = EMPTY;
+  unique_lock<mutex> guard(shared->lock);
+  schedule(guard);
+}
+
+
+template <class T>
+SequenceReader<T>::~SequenceReader() {
+  // queued decodes find their slot empty and return, only the running ones
+  // are waited for, their threads are making progress
+  unique_lock<mutex> guard(shared->lock);
+  for (Slot& slot : shared->slots) if (slot.state == QUEUED) slot.state = EMPTY;
+  shared->changed.wait(guard, [this]() {
+    for (const Slot& slot : shared->slots) if (slot.state == RUNNING) return false;
+    return true;
+  });
+}
+
+
+// decodes the frame of a queued slot with the lock dropped, on whichever
+// thread claims it first
+template <class T>
+void SequenceReader<T>::decode(Shared& shared, Slot& slot, unique_lock<mutex>& guard) {
+  slot.state = RUNNING;
+  string filename = sequence_filename(shared.pattern, slot.index);
+  guard.unlock();
+  T frame = shared.load(filename);
+  guard.lock();
+  slot.frame = move(frame);
+  slot.state = READY;
+  shared.changed.notify_all();
+}
+
+
+// starts decoding frames until the window ahead of the cursor is full. The
+// lock is dropped while submitting since a pool without workers runs the
+// decode right away on this thread.
+template <class T>
+void SequenceReader<T>::schedule(unique_lock<mutex>& guard) {
+  vector<int> indices;
+  while (scheduled < range.end && scheduled < cursor + (int)shared->slots.size()) {
+    Slot& slot = shared->slot_for(scheduled);
+    slot.index = scheduled;
+    slot.state = QUEUED;
+    indices.push_back(scheduled++);
+  }
+  guard.unlock();
+  for (int index : indices) {
+    shared_ptr<Shared> keep = shared;
+    ThreadPool::instance().submit([keep, index]() {
+      unique_lock<mutex> guard(keep->lock);
+      Slot& slot = keep->slot_for(index);
+      // next() took the decode over, or the reader was dropped
+      if (slot.index != index || slot.state != QUEUED) return;
+      decode(*keep, slot, guard);
+    });
+  }
+}
+
+
+template <class T>
+bool SequenceReader<T>::next(T& frame) {
+  unique_lock<mutex> guard(shared->lock);
+  if (cursor >= range.end) return false;
+  Slot& slot = shared->slot_for(cursor);
+  if (slot.state == QUEUED) decode(*shared, slot, guard);
+  shared->changed.wait(guard, [&slot]() { return slot.state == READY; });
+  frame = move(slot.frame);
+  slot.frame = T();
+  slot.state = EMPTY;
+  cursor++;
+  schedule(guard);
+  return true;
+}
+
+
+template class SequenceReader<Image>;
+template class SequenceReader<ImageU8>;
+
+
+ImageSequenceReader::ImageSequenceReader(const string& pattern, FrameRange range, int window)
+  : SequenceReader<Image>(pattern, range, window, load_planar) {}
+
+
+ImageSequenceReaderU8::ImageSequenceReaderU8(const string& pattern, FrameRange range, int window)
+  : SequenceReader<ImageU8>(pattern, range, window, load_u8) {}
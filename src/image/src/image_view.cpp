@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+
+#include "../inc/image.h"
+
+using namespace std;
+
+// MARK: - Constructor
+
+ImageView::ImageView() : data(nullptr), w(0), h(0), c(0), stride(0), cstride(0), pstride(1) {}
+
+
+ImageView::ImageView(float* data, int w, int h, int c, int stride, size_t cstride, int pstride) 
+  : data(data), w(w), h(h), c(c), stride(stride), cstride(cstride), pstride(pstride) {}
+
+
+ImageView::ImageView(const Image& im) 
+  : data(im.data), w(im.w), h(im.h), c(im.c), stride(im.stride), cstride(im.channel_stride()), pstride(im.pixel_stride()) {}
+
+
+// MARK: - Access
+
+float& ImageView::operator()(int x, int y, int ch) const {
+  assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0);
+  return data[ch*cstride + y*stride + x*pstride];
+}
+
+
+float ImageView::get_pixel(int x, int y, int ch) const {
+  assert(ch<c && ch>=0);
+  x = x >= w ? w-1 : x;
+  x = x < 0 ? 0 : x;
+  y = y >= h ? h-1 : y;
+  y = y < 0 ? 0 : y;
+  return data[ch*cstride + y*stride + x*pstride];
+}
+
+
+void ImageView::set_pixel(int x, int y, int ch, float v) const {
+  if(x>=w)  return;
+  if(y>=h)  return;
+  if(ch>=c) return;
+  if(x<0)   return;
+  if(y<0)   return;
+  if(ch<0)  return;
+  data[ch*cstride + y*stride + x*pstride] = v;
+}
+
+
+float* ImageView::RowPtr(int row, int ch) const { return data + ch*cstride + row*stride; }
+bool ImageView::is_interleaved() const          { return pstride != 1; }
+
+
+// MARK: - Sub views
+
+ImageView ImageView::crop(int x, int y, int w, int h) const {
+  assert(x>=0 && y>=0 && w>=0 && h>=0 && x+w<=this->w && y+h<=this->h);
+  return ImageView(data + y*stride + x*pstride, w, h, c, stride, cstride, pstride);
+}
+
+
+ImageView ImageView::channel(int ch) const {
+  assert(ch<c && ch>=0);
+  return ImageView(data + ch*cstride, w, h, 1, stride, cstride, pstride);
+}
+
+
+// MARK: - Image view helpers
+
+// interleaved views keep their layout when copied, a single channel picked out
+// of an interleaved image is copied out as a plane
+static Image::Layout view_layout(const ImageView& v) {
+  return v.is_interleaved() && v.pstride == v.c ? Image::INTERLEAVED : Image::PLANAR;
+}
+
+
+Image::Image(const ImageView& v) : Image(v.w, v.h, v.c, view_layout(v), false, NoInit()) {
+  if (layout == INTERLEAVED) {
+    for (int row = 0; row < h; row++) {
+      memcpy(RowPtr(row, 0), v.RowPtr(row, 0), sizeof(float)*w*c);
+    }
+    return;
+  }
+  for (int ch = 0; ch < c; ch++) {
+    for (int row = 0; row < h; row++) {
+      float* dst = RowPtr(row, ch);
+      const float* src = v.RowPtr(row, ch);
+      if (v.pstride == 1) memcpy(dst, src, sizeof(float)*w);
+      else for (int col = 0; col < w; col++) dst[col] = src[col*v.pstride];
+    }
+  }
+}
+
+
+ImageView Image::view() const                                 { return ImageView(*this); }
+ImageView Image::crop(int x, int y, int w, int h) const       { return view().crop(x, y, w, h); }
+ImageView Image::channel(int ch) const                        { return view().channel(ch); }
+
+
+void Image::paste(const ImageView& v, int x, int y) {
+  assert(v.c == c);
+  int x0 = max(0, -x);
+  int x1 = min(v.w, w - x);
+  int y0 = max(0, -y);
+  int y1 = min(v.h, h - y);
+  if (x1 <= x0) return;
+
+  const int ps = pixel_stride();
+  if (ps == 1 && v.pstride == 1) {
+    for (int ch = 0; ch < c; ch++) {
+      for (int row = y0; row < y1; row++) {
+        memcpy(RowPtr(row + y, ch) + x + x0, v.RowPtr(row, ch) + x0, sizeof(float)*(x1 - x0));
+      }
+    }
+    return;
+  }
+  for (int ch = 0; ch < c; ch++) {
+    for (int row = y0; row < y1; row++) {
+      float* dst = RowPtr(row + y, ch) + (x + x0)*ps;
+      const float* src = v.RowPtr(row, ch) + x0*v.pstride;
+      for (int col = 0; col < x1 - x0; col++) dst[col*ps] = src[col*v.pstride];
+    }
+  }
+}
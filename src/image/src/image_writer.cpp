@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "../inc/image_writer.h"
+#include "../../utils/thread_pool.h"
+
+using namespace std;
+
+
+// MARK: - Constructor
+
+ImageWriter::ImageWriter(int capacity, int n_threads) : capacity(max(1, capacity)), unfinished(0), stopping(false) {
+  if (n_threads <= 0) n_threads = max(1, num_threads()/2);
+  for (int i = 0; i < n_threads; i++) workers.push_back(thread(&ImageWriter::run, this));
+}
+
+
+ImageWriter::~ImageWriter() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  has_job.notify_all();
+  for (auto& worker : workers) worker.join();
+}
+
+
+// MARK: - Queue
+
+void ImageWriter::push(Job&& job) {
+  unique_lock<mutex> guard(lock);
+  has_room.wait(guard, [this]() { return unfinished < capacity; });
+  unfinished++;
+  jobs.push_back(move(job));
+  guard.unlock();
+  has_job.notify_one();
+}
+
+
+void ImageWriter::save_image(const ImageView& im, const string& name) {
+  Job job = {Image(im), ImageU8(), false, false, name};
+  push(move(job));
+}
+
+
+void ImageWriter::save_png(const ImageView& im, const string& name) {
+  Job job = {Image(im), ImageU8(), false, true, name};
+  push(move(job));
+}
+
+
+void ImageWriter::save_image(ImageU8 im, const string& name) {
+  Job job = {Image(), move(im), true, false, name};
+  push(move(job));
+}
+
+
+void ImageWriter::save_png(ImageU8 im, const string& name) {
+  Job job = {Image(), move(im), true, true, name};
+  push(move(job));
+}
+
+
+void ImageWriter::flush() {
+  unique_lock<mutex> guard(lock);
+  drained.wait(guard, [this]() { return unfinished == 0; });
+}
+
+
+int ImageWriter::pending() {
+  lock_guard<mutex> guard(lock);
+  return unfinished;
+}
+
+
+// MARK: - Workers
+
+void ImageWriter::run() {
+  for (;;) {
+    unique_lock<mutex> guard(lock);
+    has_job.wait(guard, [this]() { return stopping || !jobs.empty(); });
+    // the queue is drained before stopping so nothing handed over is lost
+    if (jobs.empty()) return;
+    Job job = move(jobs.front());
+    jobs.pop_front();
+    guard.unlock();
+
+    if (job.u8) {
+      if (job.png) ::save_png(job.im8, job.name);
+      else ::save_image(job.im8, job.name);
+    } else {
+      if (job.png) ::save_png(job.im, job.name);
+      else ::save_image(job.im, job.name);
+    }
+
+    guard.lock();
+    unfinished--;
+    guard.unlock();
+    has_room.notify_one();
+    drained.notify_all();
+  }
+}
@@ -0,0 +1,86 @@
+#include <cassert>
+#include <algorithm>
+
+#include "../inc/integral_image.h"
+#include "../../utils/thread_pool.h"
+
+using namespace std;
+
+
+// the fewest rows a task sums, more bands than threads only add work
+static const int INTEGRAL_BAND = 64;
+
+
+// MARK: - IntegralImage
+
+IntegralImage::IntegralImage(const ImageView& im, int pad) : w(im.w), h(im.h), c(im.c), pad(pad) {
+  assert(pad >= 0);
+  const int tw = w + 2*pad;
+  const int th = h + 2*pad;
+  stride = tw + 1;
+  plane = stride*(th + 1);
+  table.assign(plane*c, 0.0);
+  if (w == 0 || h == 0) return;
+
+  // Bands of rows are summed on their own in one pass, every entry the one
+  // above plus the running sum along its row. The last row of every band is
+  // then made final in order, and the rows of each band above its last get
+  // the final last row of the band before added.
+  const int bands = max(1, min(th/INTEGRAL_BAND, num_threads()));
+  auto band_rows = [&](int k) { return make_pair(k*th/bands, (k + 1)*th/bands); };
+  auto row = [&](int ch, int y) { return &table[ch*plane + (y + 1)*stride]; };
+
+  parallel_for(0, c*bands, 1, [&](int a, int b) {
+    for (int q = a; q < b; q++) {
+      const int ch = q/bands;
+      pair<int, int> rows = band_rows(q % bands);
+      for (int y = rows.first; y < rows.second; y++) {
+        const float* src = im.RowPtr(min(max(y - pad, 0), h - 1), ch);
+        const double* above = (y == rows.first ? row(ch, -1) : row(ch, y - 1)) + 1;
+        double* dst = row(ch, y) + 1;
+        double sum = 0;
+        for (int x = 0; x < pad; x++) dst[x] = above[x] + (sum += src[0]);
+        for (int x = 0; x < w; x++) dst[pad + x] = above[pad + x] + (sum += src[x*im.pstride]);
+        for (int x = 0; x < pad; x++) dst[pad + w + x] = above[pad + w + x] + (sum += src[(w - 1)*im.pstride]);
+      }
+    }
+  });
+  if (bands == 1) return;
+
+  for (int ch = 0; ch < c; ch++) for (int k = 1; k < bands; k++) {
+    double* last = row(ch, band_rows(k).second - 1);
+    const double* carry = row(ch, band_rows(k - 1).second - 1);
+    for (size_t x = 0; x < stride; x++) last[x] += carry[x];
+  }
+  parallel_for(0, c*(bands - 1), 1, [&](int a, int b) {
+    for (int q = a; q < b; q++) {
+      const int ch = q/(bands - 1);
+      pair<int, int> rows = band_rows(q % (bands - 1) + 1);
+      const double* carry = row(ch, rows.first - 1);
+      for (int y = rows.first; y < rows.second - 1; y++) {
+        double* dst = row(ch, y);
+        for (size_t x = 0; x < stride; x++) dst[x] += carry[x];
+      }
+    }
+  });
+}
+
+
+IntegralImage IntegralImage::nonzero(const ImageView& im) {
+  Image count(im.w, im.h, 1);
+  for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < im.h; y++) {
+    const float* src = im.RowPtr(y, ch);
+    float* dst = count.RowPtr(y, 0);
+    for (int x = 0; x < im.w; x++) if (src[x*im.pstride]) dst[x] += 1;
+  }
+  return IntegralImage(count);
+}
+
+
+bool IntegralImage::is_nonempty_patch(int x, int y, int r) const {
+  assert(c == 1 && w > 0 && h > 0);
+  // the clamped coordinates of the patch, which is what get_pixel reads
+  int x0 = min(max(x - r, 0), w - 1), x1 = min(max(x + r, 0), w - 1);
+  int y0 = min(max(y - r, 0), h - 1), y1 = min(max(y + r, 0), h - 1);
+  return box_sum(x0, y0, x1 + 1, y1 + 1) > 0;
+}
@@ -0,0 +1,116 @@
+#include <cmath>
+
+#include "../inc/kernels.h"
+#include "../../colourspace/colourspaces.h"
+#include "simd_dispatch.h"
+
+using namespace std;
+
+
+// MARK: - Dispatch
+
+float kernel_dot(const float* a, const float* b, int n) {
+  DISPATCH(dot(a, b, n));
+  float s = 0;
+  for (int i = 0; i < n; i++) s += a[i]*b[i];
+  return s;
+}
+
+
+float kernel_l1_distance(const float* a, const float* b, int n) {
+  DISPATCH(l1_distance(a, b, n));
+  float s = 0;
+  for (int i = 0; i < n; i++) s += fabsf(a[i] - b[i]);
+  return s;
+}
+
+
+void kernel_axpy(float* y, const float* x, int n, float a) {
+  DISPATCH(axpy(y, x, n, a));
+  for (int i = 0; i < n; i++) y[i] = y[i] + a*x[i];
+}
+
+
+void kernel_blend_rows(float* out, const float* a, const float* b, float wa, float wb, int n) {
+  DISPATCH(blend_rows(out, a, b, wa, wb, n));
+  for (int i = 0; i < n; i++) out[i] = (a[i] * wa) + (b[i] * wb);
+}
+
+
+
+void kernel_resample_row(float* out, const float* src, const int* index, const float* weight, int taps, int n) {
+  DISPATCH(resample_row(out, src, index, weight, taps, n));
+  for (int i = 0; i < n; i++) {
+    float acc = src[index[i]] * weight[i];
+    for (int k = 1; k < taps; k++) acc = acc + (src[index[(size_t)k*n + i]] * weight[(size_t)k*n + i]);
+    out[i] = acc;
+  }
+}
+
+
+void kernel_convolve_row(float* out, const float* const* rows, const float* taps, int fw, int fh, int n) {
+  DISPATCH(convolve_row(out, rows, taps, fw, fh, n));
+  for (int x = 0; x < n; x++) {
+    float a = out[x];
+    const float* t = taps;
+    for (int j = 0; j < fh; j++) for (int i = 0; i < fw; i++, t++) a = a + *t * rows[j][x + i];
+    out[x] = a;
+  }
+}
+
+void kernel_rgb_to_gray(float* out, const float* r, const float* g, const float* b, int n) {
+  DISPATCH(rgb_to_gray(out, r, g, b, n));
+  for (int i = 0; i < n; i++) out[i] = (0.299f * r[i]) + (0.587f * g[i]) + (0.114f * b[i]);
+}
+
+
+void kernel_rgb_to_hsv(float* r, float* g, float* b, int n) {
+  DISPATCH(rgb_to_hsv(r, g, b, n));
+  for (int i = 0; i < n; i++) {
+    HSVcolour hsv = rgb2hsv({r[i], g[i], b[i]});
+    r[i] = hsv.h;
+    g[i] = hsv.s;
+    b[i] = hsv.v;
+  }
+}
+
+
+void kernel_hsv_to_rgb(float* h, float* s, float* v, int n) {
+  DISPATCH(hsv_to_rgb(h, s, v, n));
+  for (int i = 0; i < n; i++) {
+    RGBcolour rgb = hsv2rgb({h[i], s[i], v[i]});
+    h[i] = rgb.r;
+    s[i] = rgb.g;
+    v[i] = rgb.b;
+  }
+}
+
+
+void kernel_transpose(float* dst, size_t dst_stride, const float* src, size_t src_stride, int rows, int cols) {
+  DISPATCH(transpose(dst, dst_stride, src, src_stride, rows, cols));
+  for (int y = 0; y < rows; y++) for (int x = 0; x < cols; x++) dst[x*dst_stride + y] = src[y*src_stride + x];
+}
+
+
+void kernel_u8_to_float(float* dst, const uint8_t* src, int n) {
+  DISPATCH(u8_to_float(dst, src, n));
+  for (int i = 0; i < n; i++) dst[i] = (float)src[i]/255.f;
+}
+
+
+void kernel_u8_deinterleave(float* const* planes, int nplanes, const uint8_t* src, int c, int n) {
+  DISPATCH(u8_deinterleave(planes, nplanes, src, c, n));
+  for (int i = 0; i < n; i++) for (int k = 0; k < nplanes; k++) planes[k][i] = (float)src[(size_t)i*c + k]/255.f;
+}
+
+
+void kernel_float_to_u8(uint8_t* dst, const float* src, int n) {
+  DISPATCH(float_to_u8(dst, src, n));
+  for (int i = 0; i < n; i++) dst[i] = (unsigned char)roundf(255*src[i]);
+}
+
+
+void kernel_float_interleave_u8(uint8_t* dst, int c, const float* const* planes, int n) {
+  DISPATCH(float_interleave_u8(dst, c, planes, n));
+  for (int i = 0; i < n; i++) for (int k = 0; k < c; k++) dst[(size_t)i*c + k] = (unsigned char)roundf(255*planes[k][i]);
+}
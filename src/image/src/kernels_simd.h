@@ -0,0 +1,313 @@
+// Body of the kernels declared in kernels.h, compiled once per instruction set
+// by the simd_<isa>.cpp units on top of simd_vec.h. Kernels that produce pixels
+// do the same multiplies and adds in the same order as their scalar versions
+// so every build gives the same result.
+
+
+float dot(const float* a, const float* b, int n) {
+  int i = 0;
+  vfloat acc = vset(0.f);
+  for (; i + VN <= n; i += VN) acc = vadd(acc, vmul(vload(a + i), vload(b + i)));
+  float s = vhsum(acc);
+  for (; i < n; i++) s += a[i]*b[i];
+  return s;
+}
+
+
+float l1_distance(const float* a, const float* b, int n) {
+  int i = 0;
+  vfloat acc = vset(0.f);
+  for (; i + VN <= n; i += VN) acc = vadd(acc, vabs(vsub(vload(a + i), vload(b + i))));
+  float s = vhsum(acc);
+  for (; i < n; i++) s += fabsf(a[i] - b[i]);
+  return s;
+}
+
+
+void axpy(float* y, const float* x, int n, float a) {
+  int i = 0;
+  const vfloat va = vset(a);
+  for (; i + VN <= n; i += VN) vstore(y + i, vadd(vload(y + i), vmul(va, vload(x + i))));
+  for (; i < n; i++) y[i] = y[i] + a*x[i];
+}
+
+
+void blend_rows(float* out, const float* a, const float* b, float wa, float wb, int n) {
+  int i = 0;
+  const vfloat va = vset(wa);
+  const vfloat vb = vset(wb);
+  for (; i + VN <= n; i += VN) vstore(out + i, vadd(vmul(vload(a + i), va), vmul(vload(b + i), vb)));
+  for (; i < n; i++) out[i] = (a[i] * wa) + (b[i] * wb);
+}
+
+
+
+void resample_row(float* out, const float* src, const int* index, const float* weight, int taps, int n) {
+  int i = 0;
+  for (; i + VN <= n; i += VN) {
+    vfloat acc = vmul(vgather(src, index + i), vload(weight + i));
+    for (int k = 1; k < taps; k++) acc = vadd(acc, vmul(vgather(src, index + (size_t)k*n + i), vload(weight + (size_t)k*n + i)));
+    vstore(out + i, acc);
+  }
+  for (; i < n; i++) {
+    float acc = src[index[i]] * weight[i];
+    for (int k = 1; k < taps; k++) acc = acc + (src[index[(size_t)k*n + i]] * weight[(size_t)k*n + i]);
+    out[i] = acc;
+  }
+}
+
+
+void convolve_row(float* out, const float* const* rows, const float* taps, int fw, int fh, int n) {
+  int x = 0;
+  // two vectors of outputs stay in registers over every tap
+  for (; x + 2*VN <= n; x += 2*VN) {
+    vfloat a0 = vload(out + x);
+    vfloat a1 = vload(out + x + VN);
+    const float* t = taps;
+    for (int j = 0; j < fh; j++) {
+      const float* r = rows[j] + x;
+      for (int i = 0; i < fw; i++, t++) {
+        vfloat f = vset(*t);
+        a0 = vadd(a0, vmul(f, vload(r + i)));
+        a1 = vadd(a1, vmul(f, vload(r + i + VN)));
+      }
+    }
+    vstore(out + x, a0);
+    vstore(out + x + VN, a1);
+  }
+  for (; x + VN <= n; x += VN) {
+    vfloat a = vload(out + x);
+    const float* t = taps;
+    for (int j = 0; j < fh; j++) {
+      const float* r = rows[j] + x;
+      for (int i = 0; i < fw; i++, t++) a = vadd(a, vmul(vset(*t), vload(r + i)));
+    }
+    vstore(out + x, a);
+  }
+  for (; x < n; x++) {
+    float a = out[x];
+    const float* t = taps;
+    for (int j = 0; j < fh; j++) for (int i = 0; i < fw; i++, t++) a = a + *t * rows[j][x + i];
+    out[x] = a;
+  }
+}
+
+void rgb_to_gray(float* out, const float* r, const float* g, const float* b, int n) {
+  int i = 0;
+  const vfloat wr = vset(0.299f);
+  const vfloat wg = vset(0.587f);
+  const vfloat wb = vset(0.114f);
+  for (; i + VN <= n; i += VN) {
+    vstore(out + i, vadd(vadd(vmul(wr, vload(r + i)), vmul(wg, vload(g + i))), vmul(wb, vload(b + i))));
+  }
+  for (; i < n; i++) out[i] = (0.299f * r[i]) + (0.587f * g[i]) + (0.114f * b[i]);
+}
+
+
+void rgb_to_hsv(float* r, float* g, float* b, int n) {
+  int i = 0;
+  const vfloat zero = vset(0.f);
+  const vfloat one = vset(1.f);
+  const vfloat two = vset(2.f);
+  const vfloat four = vset(4.f);
+  const vfloat six = vset(6.f);
+  for (; i + VN <= n; i += VN) {
+    vfloat vr = vload(r + i);
+    vfloat vg = vload(g + i);
+    vfloat vb = vload(b + i);
+    vfloat max = vmax(vmax(vr, vg), vb);
+    vfloat min = vmin(vmin(vr, vg), vb);
+    vfloat diff = vsub(max, min);
+    vfloat s = vselect(veq(max, zero), zero, vdiv(diff, max));
+
+    // every lane computes the three candidate hues and keeps the one of its largest channel
+    vfloat hr = vdiv(vsub(vg, vb), diff);
+    vfloat hg = vadd(two, vdiv(vsub(vb, vr), diff));
+    vfloat hb = vadd(four, vdiv(vsub(vr, vg), diff));
+    vfloat hp = vselect(veq(max, vr), hr, vselect(veq(max, vg), hg, hb));
+    vfloat h = vselect(vlt(hp, zero), vadd(one, vdiv(hp, six)), vdiv(hp, six));
+    h = vselect(veq(diff, zero), zero, h);
+
+    vstore(r + i, h);
+    vstore(g + i, s);
+    vstore(b + i, max);
+  }
+  for (; i < n; i++) {
+    float max = fmaxf(fmaxf(r[i], g[i]), b[i]);
+    float min = fminf(fminf(r[i], g[i]), b[i]);
+    float diff = max - min;
+    float s = max == 0.f ? 0.f : diff/max;
+    float h = 0.f;
+    if (diff != 0.f) {
+      float hp = max == r[i] ? (g[i] - b[i])/diff : max == g[i] ? 2 + (b[i] - r[i])/diff : 4 + (r[i] - g[i])/diff;
+      h = hp < 0 ? 1 + hp/6 : hp/6;
+    }
+    r[i] = h;
+    g[i] = s;
+    b[i] = max;
+  }
+}
+
+
+void hsv_to_rgb(float* h, float* s, float* v, int n) {
+  int i = 0;
+  const vfloat zero = vset(0.f);
+  const vfloat one = vset(1.f);
+  const vfloat two = vset(2.f);
+  const vfloat three = vset(3.f);
+  const vfloat four = vset(4.f);
+  const vfloat five = vset(5.f);
+  const vfloat six = vset(6.f);
+  const vfloat half = vset(0.5f);
+  for (; i + VN <= n; i += VN) {
+    vfloat max = vload(v + i);
+    vfloat diff = vmul(vload(s + i), max);
+    vfloat min = vsub(max, diff);
+    vfloat hp = vmul(vload(h + i), six);
+    // 1 - |fmod(hp, 2) - 1| is min(m, 2 - m), both exact in floats, so x
+    // rounds once like the double expression of hsv2rgb
+    vfloat m = vsub(hp, vmul(two, vtrunc(vmul(hp, half))));
+    vfloat x = vmul(diff, vmin(m, vsub(two, m)));
+
+    vfloat lo = min, hi = vadd(diff, min), mid = vadd(x, min);
+    // sectors 0-1, 2-3 and 4-5 of the hexagon, picked like the branches of hsv2rgb
+    vmask s45 = vle(four, hp), s23 = vle(two, hp);
+    vfloat r = vselect(s45, vselect(vle(hp, five), mid, hi), vselect(s23, lo, vselect(vle(hp, one), hi, mid)));
+    vfloat g = vselect(s45, lo, vselect(s23, vselect(vle(hp, three), hi, mid), vselect(vle(hp, one), mid, hi)));
+    vfloat b = vselect(s45, vselect(vle(hp, five), hi, mid), vselect(s23, vselect(vle(hp, three), mid, hi), lo));
+    vmask grey = veq(diff, zero);
+    vstore(h + i, vselect(grey, max, r));
+    vstore(s + i, vselect(grey, max, g));
+    vstore(v + i, vselect(grey, max, b));
+  }
+  for (; i < n; i++) {
+    float max = v[i];
+    float diff = s[i]*max;
+    float min = max - diff;
+    float hp = h[i]*6.f;
+    float m = fmodf(hp, 2.f);
+    float x = diff*fminf(m, 2.f - m);
+    float lo = min, hi = diff + min, mid = x + min;
+    float r = max, g = max, b = max;
+    if (diff != 0.f) {
+      if (hp >= 4) { r = hp <= 5 ? mid : hi; g = lo; b = hp <= 5 ? hi : mid; }
+      else if (hp >= 2) { r = lo; g = hp <= 3 ? hi : mid; b = hp <= 3 ? mid : hi; }
+      else { r = hp <= 1 ? hi : mid; g = hp <= 1 ? mid : hi; b = lo; }
+    }
+    h[i] = r;
+    s[i] = g;
+    v[i] = b;
+  }
+}
+
+
+#if defined(SIMD_SSE42)
+
+static const int TB = 4;
+
+// transposes one 4x4 block
+static inline void transpose_block(float* dst, size_t dst_stride, const float* src, size_t src_stride) {
+  __m128 r0 = _mm_loadu_ps(src + 0*src_stride);
+  __m128 r1 = _mm_loadu_ps(src + 1*src_stride);
+  __m128 r2 = _mm_loadu_ps(src + 2*src_stride);
+  __m128 r3 = _mm_loadu_ps(src + 3*src_stride);
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_storeu_ps(dst + 0*dst_stride, r0);
+  _mm_storeu_ps(dst + 1*dst_stride, r1);
+  _mm_storeu_ps(dst + 2*dst_stride, r2);
+  _mm_storeu_ps(dst + 3*dst_stride, r3);
+}
+
+#else
+
+static const int TB = 8;
+
+// transposes one 8x8 block, avx-512 builds use the same 256 bit shuffles
+static inline void transpose_block(float* dst, size_t dst_stride, const float* src, size_t src_stride) {
+  __m256 r[8], t[8];
+  for (int k = 0; k < 8; k++) r[k] = _mm256_loadu_ps(src + k*src_stride);
+  for (int k = 0; k < 8; k += 2) {
+    t[k]     = _mm256_unpacklo_ps(r[k], r[k + 1]);
+    t[k + 1] = _mm256_unpackhi_ps(r[k], r[k + 1]);
+  }
+  for (int k = 0; k < 8; k += 4) {
+    r[k]     = _mm256_shuffle_ps(t[k],     t[k + 2], _MM_SHUFFLE(1, 0, 1, 0));
+    r[k + 1] = _mm256_shuffle_ps(t[k],     t[k + 2], _MM_SHUFFLE(3, 2, 3, 2));
+    r[k + 2] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(1, 0, 1, 0));
+    r[k + 3] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(3, 2, 3, 2));
+  }
+  for (int k = 0; k < 4; k++) {
+    _mm256_storeu_ps(dst + k*dst_stride,       _mm256_permute2f128_ps(r[k], r[k + 4], 0x20));
+    _mm256_storeu_ps(dst + (k + 4)*dst_stride, _mm256_permute2f128_ps(r[k], r[k + 4], 0x31));
+  }
+}
+
+#endif
+
+
+void transpose(float* dst, size_t dst_stride, const float* src, size_t src_stride, int rows, int cols) {
+  int y = 0;
+  for (; y + TB <= rows; y += TB) {
+    int x = 0;
+    for (; x + TB <= cols; x += TB) transpose_block(dst + x*dst_stride + y, dst_stride, src + y*src_stride + x, src_stride);
+    for (; x < cols; x++) for (int k = y; k < y + TB; k++) dst[x*dst_stride + k] = src[k*src_stride + x];
+  }
+  for (; y < rows; y++) for (int x = 0; x < cols; x++) dst[x*dst_stride + y] = src[y*src_stride + x];
+}
+
+
+void u8_to_float(float* dst, const uint8_t* src, int n) {
+  int i = 0;
+  const vfloat s = vset(255.f);
+  for (; i + VN <= n; i += VN) vstore(dst + i, vdiv(vload_u8(src + i), s));
+  for (; i < n; i++) dst[i] = (float)src[i]/255.f;
+}
+
+
+void u8_deinterleave(float* const* planes, int nplanes, const uint8_t* src, int c, int n) {
+  int i = 0;
+  if (nplanes <= 4 && c <= 4) {
+    const vfloat s = vset(255.f);
+    // per channel a byte shuffle moves the channel of four pixels into the low bytes of four 32 bit lanes
+    __m128i shuf[4];
+    for (int k = 0; k < nplanes; k++) {
+      int8_t m[16];
+      for (int j = 0; j < 16; j++) m[j] = j % 4 == 0 ? (int8_t)(j/4*c + k) : (int8_t)-128;
+      shuf[k] = _mm_loadu_si128((const __m128i*)m);
+    }
+    // every group of four pixels is read with a 16 byte load that must stay inside the row
+    for (; i + VN <= n && (size_t)(i + VN - 4)*c + 16 <= (size_t)n*c; i += VN) {
+      __m128i raw[VN/4];
+      for (int q = 0; q < VN/4; q++) raw[q] = _mm_loadu_si128((const __m128i*)(src + (size_t)(i + 4*q)*c));
+      for (int k = 0; k < nplanes; k++) {
+        __m128i g[VN/4];
+        for (int q = 0; q < VN/4; q++) g[q] = _mm_shuffle_epi8(raw[q], shuf[k]);
+        vstore(planes[k] + i, vdiv(vfrom_i32x4(g), s));
+      }
+    }
+  }
+  for (; i < n; i++) for (int k = 0; k < nplanes; k++) planes[k][i] = (float)src[(size_t)i*c + k]/255.f;
+}
+
+
+void float_to_u8(uint8_t* dst, const float* src, int n) {
+  int i = 0;
+  const vfloat s = vset(255.f);
+  for (; i + VN <= n; i += VN) vstore_u8(dst + i, vround(vmul(s, vload(src + i))));
+  for (; i < n; i++) dst[i] = (unsigned char)roundf(255*src[i]);
+}
+
+
+void float_interleave_u8(uint8_t* dst, int c, const float* const* planes, int n) {
+  int i = 0;
+  if (c <= 4) {
+    const vfloat s = vset(255.f);
+    uint8_t bytes[4][VN];
+    for (; i + VN <= n; i += VN) {
+      for (int k = 0; k < c; k++) vstore_u8(bytes[k], vround(vmul(s, vload(planes[k] + i))));
+      uint8_t* out = dst + (size_t)i*c;
+      for (int j = 0; j < VN; j++) for (int k = 0; k < c; k++) out[j*c + k] = bytes[k][j];
+    }
+  }
+  for (; i < n; i++) for (int k = 0; k < c; k++) dst[(size_t)i*c + k] = (unsigned char)roundf(255*planes[k][i]);
+}
@@ -3,20 +3,25 @@
 #include <cstdlib>
 
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "../inc/image.h"
+#include "../inc/typed_image.h"
+#include "../inc/kernels.h"
+#include "../inc/image_formats.h"
+#include "../../utils/thread_pool.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../inc/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../inc/stb_image_write.h"
 
-void save_image_stb(const Image& im, const string& name, int png)
+void save_image_stb(const ImageView& im, const string& name, int png)
   {
-  unsigned char *data = (unsigned char *)calloc(im.w*im.h*im.c, sizeof(char));
+  unsigned char *data = (unsigned char *)malloc((size_t)im.w*im.h*im.c);
   
-  for(int k = 0; k < im.c; ++k)for(int i = 0; i < im.w*im.h; ++i)
-    data[i*im.c+k] = (unsigned char) roundf((255*im.data[i + k*im.w*im.h]));
+  to_interleaved_u8(im, data);
   
   string file=name + (png?".png":".jpg");
   
@@ -29,16 +34,61 @@ void save_image_stb(const Image& im, const string& name, int png)
   if(!success) fprintf(stderr, "Failed to write image %s\n", file.c_str());
   }
 
-void save_png(const Image& im, const string& name) { save_image_stb(im, name, 1); }
+void save_png(const ImageView& im, const string& name) { save_image_stb(im, name, 1); }
+
+void save_image(const ImageView& im, const string& name) { save_image_stb(im, name, 0); }
 
-void save_image(const Image& im, const string& name) { save_image_stb(im, name, 0); }
+// 
+// Widen an interleaved 8 bit buffer from stb to a float image and free the buffer
+//
+static Image widen_stb(unsigned char* data, int w, int h, int c, Image::Layout layout)
+  {
+  //We don't like alpha channels, #YOLO
+  int oc = c == 4 ? 3 : c;
+  
+  if(layout == Image::INTERLEAVED)
+    {
+    // stb is interleaved already, just drop the alpha channel on the way
+    Image im = Image::uninitialized(w, h, oc, Image::INTERLEAVED);
+    parallel_for(0, h, 16, [&](int j0, int j1)
+      {
+      vector<float> rgba(c == oc ? 0 : (size_t)w*c);
+      for(int j = j0; j < j1; ++j)
+        {
+        float* row = im.RowPtr(j, 0);
+        const unsigned char* src = data + (size_t)c*w*j;
+        if(c == oc) { kernel_u8_to_float(row, src, w*c); continue; }
+        kernel_u8_to_float(rgba.data(), src, w*c);
+        for(int i = 0; i < w; ++i)
+          for(int k = 0; k < oc; ++k)
+            row[i*oc + k] = rgba[i*c + k];
+        }
+      });
+    free(data);
+    return im;
+    }
+  
+  Image im = Image::uninitialized(w, h, oc);
+  
+  parallel_for(0, h, 16, [&](int j0, int j1)
+    {
+    float* planes[4];
+    for(int j = j0; j < j1; ++j)
+      {
+      for(int k = 0; k < oc; ++k) planes[k] = im.RowPtr(j, k);
+      kernel_u8_deinterleave(planes, oc, data + (size_t)c*w*j, c, w);
+      }
+    });
+  free(data);
+  return im;
+  }
 
 // 
 // Load an image using stb
 // channels = [0..4]
 // channels > 0 forces the image to have that many channels
 //
-Image load_image_stb(const string& filename, int channels)
+Image load_image_stb(const string& filename, int channels, Image::Layout layout)
   {
   int w, h, c;
   unsigned char *data = stbi_load(filename.c_str(), &w, &h, &c, channels);
@@ -49,25 +99,190 @@ Image load_image_stb(const string& filename, int channels)
     }
   
   if (channels) c = channels;
+  return widen_stb(data, w, h, c, layout);
+  }
+
+// 
+// Smallest power of two scale down, at most 8, that fits w x h within max_w x max_h
+//
+int load_scale_for(int w, int h, int max_w, int max_h)
+  {
+  int s = 1;
+  while(s < 8 && ((max_w > 0 && (w + s - 1)/s > max_w) || (max_h > 0 && (h + s - 1)/s > max_h))) s *= 2;
+  return s;
+  }
+
+bool image_file_size(const string& filename, int* w, int* h)
+  {
+  if(is_fast_format(image_format_for(filename))) return fast_image_size(filename, w, h);
+  int c;
+  return stbi_info(filename.c_str(), w, h, &c) != 0;
+  }
+
+// 
+// Decode a jpeg with the reduced idcts of stb at the scale picked for max_w x max_h,
+// null if the file isn't a jpeg or needs no scaling
+//
+static unsigned char* load_jpeg_scaled(const string& filename, int max_w, int max_h, int* w, int* h, int* c)
+  {
+  if(image_format_for(filename) != FORMAT_JPG || !stbi_info(filename.c_str(), w, h, c)) return NULL;
+  int s = load_scale_for(*w, *h, max_w, max_h);
+  if(s == 1) return NULL;
+  int shift = s == 2 ? 1 : s == 4 ? 2 : 3;
+  return stbi_load_jpeg_scaled(filename.c_str(), w, h, c, 0, shift);
+  }
+
+// 
+// Decode with stb and shrink the 8 bit buffer by the scale picked for max_w x max_h.
+// Jpegs are decoded at that scale, other files are decoded at full size and
+// s x s blocks (partial ones at the right and bottom edges) averaged with rounding.
+// Returns the shrunk buffer and its size in w and h.
+//
+static unsigned char* load_stb_scaled(const string& filename, int max_w, int max_h, int* w, int* h, int* c)
+  {
+  unsigned char *data = load_jpeg_scaled(filename, max_w, max_h, w, h, c);
+  if (data) return data;
+  data = stbi_load(filename.c_str(), w, h, c, 0);
+  if (!data)
+    {
+    fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename.c_str(), stbi_failure_reason());
+    exit(0);
+    }
   
-  int i,j,k;
-  Image im(w, h, c);
+  int s = load_scale_for(*w, *h, max_w, max_h);
+  if(s == 1) return data;
   
-  for(k = 0; k < c; ++k)
-    for(j = 0; j < h; ++j)
-      for(i = 0; i < w; ++i)
+  int sw = *w, sh = *h, sc = *c;
+  int dw = (sw + s - 1)/s, dh = (sh + s - 1)/s;
+  // s is a power of two, whole blocks divide by shifting
+  int shift = 0;
+  while((1 << shift) < s*s) ++shift;
+  unsigned char *small = (unsigned char *)malloc((size_t)dw*dh*sc);
+  parallel_for(0, dh, 8, [&](int j0, int j1)
+    {
+    vector<unsigned> sums((size_t)dw*sc);
+    for(int j = j0; j < j1; ++j)
+      {
+      fill(sums.begin(), sums.end(), 0u);
+      int y1 = min(sh, (j + 1)*s);
+      for(int y = j*s; y < y1; ++y)
         {
-        int dst_index = i + w*j + w*h*k;
-        int src_index = k + c*i + c*w*j;
-        im.data[dst_index] = (float)data[src_index]/255.;
+        const unsigned char* row = data + (size_t)y*sw*sc;
+        for(int i = 0; i < dw; ++i)
+          {
+          const unsigned char* block = row + (size_t)i*s*sc;
+          unsigned* acc = &sums[(size_t)i*sc];
+          int n = min(s, sw - i*s)*sc;
+          for(int x = 0; x < n; x += sc)
+            for(int k = 0; k < sc; ++k)
+              acc[k] += block[x + k];
+          }
         }
-  //We don't like alpha channels, #YOLO
-  if(im.c == 4) im.c = 3;
+      unsigned char* dst = small + (size_t)j*dw*sc;
+      for(int i = 0; i < dw; ++i)
+        {
+        unsigned n = (unsigned)(min(sw, (i + 1)*s) - i*s) * (y1 - j*s);
+        if(n == (unsigned)(s*s)) for(int k = 0; k < sc; ++k) dst[i*sc + k] = (unsigned char)((sums[i*sc + k] + n/2) >> shift);
+        else for(int k = 0; k < sc; ++k) dst[i*sc + k] = (unsigned char)((sums[i*sc + k] + n/2)/n);
+        }
+      }
+    });
+  free(data);
+  *w = dw;
+  *h = dh;
+  return small;
+  }
+
+// 
+// Load a qoi, pfm, ppm or pgm file and shrink it by the scale picked for max_w x max_h
+//
+static Image load_fast_scaled(const string& filename, int max_w, int max_h, Image::Layout layout)
+  {
+  Image im = load_image_fast(filename, layout);
+  int s = load_scale_for(im.w, im.h, max_w, max_h);
+  if(s == 1) return im;
+  return im.area_resize((im.w + s - 1)/s, (im.h + s - 1)/s);
+  }
+
+Image load_image(const string& filename, int max_w, int max_h, Image::Layout layout)
+  {
+  if(is_fast_format(image_format_for(filename))) return load_fast_scaled(filename, max_w, max_h, layout);
+  int w, h, c;
+  unsigned char *data = load_stb_scaled(filename, max_w, max_h, &w, &h, &c);
+  return widen_stb(data, w, h, c, layout);
+  }
+
+Image load_image(const string& filename, Image::Layout layout)
+  {
+  if(is_fast_format(image_format_for(filename))) return load_image_fast(filename, layout);
+  return load_image_stb(filename,0,layout);
+  }
+
+Image load_image(const string& filename) { return load_image(filename, Image::PLANAR); }
+
+// 
+// Split an interleaved 8 bit buffer from stb into planes and free the buffer
+//
+static ImageU8 split_stb(unsigned char* data, int w, int h, int c)
+  {
+  //We don't like alpha channels here either
+  ImageU8 im(w, h, c == 4 ? 3 : c);
+  
+  for(int k = 0; k < im.c; ++k)
+    for(int j = 0; j < h; ++j)
+      {
+      uint8_t* row = im.RowPtr(j, k);
+      for(int i = 0; i < w; ++i) row[i] = data[k + c*i + c*w*j];
+      }
   free(data);
   return im;
   }
 
-Image load_image(const string& filename) { return load_image_stb(filename,0); }
+ImageU8 load_image_u8(const string& filename)
+  {
+  if(is_fast_format(image_format_for(filename))) return load_image_fast_u8(filename);
+  int w, h, c;
+  unsigned char *data = stbi_load(filename.c_str(), &w, &h, &c, 0);
+  if (!data)
+    {
+    fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename.c_str(), stbi_failure_reason());
+    exit(0);
+    }
+  return split_stb(data, w, h, c);
+  }
+
+ImageU8 load_image_u8(const string& filename, int max_w, int max_h)
+  {
+  if(is_fast_format(image_format_for(filename))) return ImageU8::from_float(load_fast_scaled(filename, max_w, max_h, Image::PLANAR));
+  int w, h, c;
+  unsigned char *data = load_stb_scaled(filename, max_w, max_h, &w, &h, &c);
+  return split_stb(data, w, h, c);
+  }
+
+void save_image_stb(const ImageU8& im, const string& name, int png)
+  {
+  unsigned char *data = (unsigned char *)calloc(im.w*im.h*im.c, sizeof(char));
+  
+  for(int k = 0; k < im.c; ++k)for(int j = 0; j < im.h; ++j)
+    {
+    const uint8_t* row = im.RowPtr(j, k);
+    for(int i = 0; i < im.w; ++i) data[(i + im.w*j)*im.c+k] = row[i];
+    }
+  
+  string file=name + (png?".png":".jpg");
+  
+  int success = 0;
+  if(png)success = stbi_write_png(file.c_str(), im.w, im.h, im.c, data, im.w*im.c);
+  else   success = stbi_write_jpg(file.c_str(), im.w, im.h, im.c, data, 100);
+  
+  free(data);
+  
+  if(!success) fprintf(stderr, "Failed to write image %s\n", file.c_str());
+  }
+
+void save_png(const ImageU8& im, const string& name) { save_image_stb(im, name, 1); }
+
+void save_image(const ImageU8& im, const string& name) { save_image_stb(im, name, 0); }
 
 // #ifdef OPENCV
 
@@ -0,0 +1,53 @@
+#include <cmath>
+
+#include "../inc/pointwise.h"
+#include "simd_dispatch.h"
+
+using namespace std;
+
+
+// MARK: - Dispatch
+
+void pointwise_add(float* p, size_t n, float v) {
+  DISPATCH(add(p, n, v));
+  for (size_t i = 0; i < n; i++) p[i] += v;
+}
+
+
+void pointwise_affine(float* p, size_t n, float a, float b) {
+  DISPATCH(affine(p, n, a, b));
+  for (size_t i = 0; i < n; i++) p[i] = p[i]*a + b;
+}
+
+
+void pointwise_clamp(float* p, size_t n, float lo, float hi) {
+  DISPATCH(clamp(p, n, lo, hi));
+  for (size_t i = 0; i < n; i++) p[i] = fmaxf(lo, fminf(hi, p[i]));
+}
+
+
+void pointwise_abs(float* dst, const float* src, size_t n) {
+  DISPATCH(abs(dst, src, n));
+  for (size_t i = 0; i < n; i++) dst[i] = fabsf(src[i]);
+}
+
+
+void pointwise_min_max(const float* p, size_t n, float* min, float* max) {
+  DISPATCH(min_max(p, n, min, max));
+  float lo = p[0];
+  float hi = p[0];
+  for (size_t i = 1; i < n; i++) {
+    lo = fminf(lo, p[i]);
+    hi = fmaxf(hi, p[i]);
+  }
+  *min = lo;
+  *max = hi;
+}
+
+
+float pointwise_sum(const float* p, size_t n) {
+  DISPATCH(sum(p, n));
+  float s = 0;
+  for (size_t i = 0; i < n; i++) s += p[i];
+  return s;
+}
@@ -0,0 +1,74 @@
+// Body of the pointwise kernels declared in pointwise.h, compiled once per
+// instruction set by the simd_<isa>.cpp units on top of simd_vec.h.
+
+
+void add(float* p, size_t n, float v) {
+  size_t i = 0;
+  const vfloat vv = vset(v);
+  for (; i + VN <= n; i += VN) vstore(p + i, vadd(vload(p + i), vv));
+  for (; i < n; i++) p[i] += v;
+}
+
+
+void affine(float* p, size_t n, float a, float b) {
+  size_t i = 0;
+  const vfloat va = vset(a);
+  const vfloat vb = vset(b);
+  for (; i + VN <= n; i += VN) vstore(p + i, vadd(vmul(vload(p + i), va), vb));
+  for (; i < n; i++) p[i] = p[i]*a + b;
+}
+
+
+void clamp(float* p, size_t n, float lo, float hi) {
+  size_t i = 0;
+  const vfloat vlo = vset(lo);
+  const vfloat vhi = vset(hi);
+  for (; i + VN <= n; i += VN) vstore(p + i, vmax(vlo, vmin(vhi, vload(p + i))));
+  for (; i < n; i++) p[i] = fmaxf(lo, fminf(hi, p[i]));
+}
+
+
+void abs(float* dst, const float* src, size_t n) {
+  size_t i = 0;
+  for (; i + VN <= n; i += VN) vstore(dst + i, vabs(vload(src + i)));
+  for (; i < n; i++) dst[i] = fabsf(src[i]);
+}
+
+
+void min_max(const float* p, size_t n, float* min, float* max) {
+  size_t i = 0;
+  float lo = p[0];
+  float hi = p[0];
+  if (n >= (size_t)VN) {
+    vfloat vlo = vload(p);
+    vfloat vhi = vlo;
+    for (i = VN; i + VN <= n; i += VN) {
+      vfloat v = vload(p + i);
+      vlo = vmin(vlo, v);
+      vhi = vmax(vhi, v);
+    }
+    float l[VN], h[VN];
+    vstore(l, vlo);
+    vstore(h, vhi);
+    for (int k = 0; k < VN; k++) {
+      lo = fminf(lo, l[k]);
+      hi = fmaxf(hi, h[k]);
+    }
+  }
+  for (; i < n; i++) {
+    lo = fminf(lo, p[i]);
+    hi = fmaxf(hi, p[i]);
+  }
+  *min = lo;
+  *max = hi;
+}
+
+
+float sum(const float* p, size_t n) {
+  size_t i = 0;
+  vfloat acc = vset(0.f);
+  for (; i + VN <= n; i += VN) acc = vadd(acc, vload(p + i));
+  float s = vhsum(acc);
+  for (; i < n; i++) s += p[i];
+  return s;
+}
@@ -2,118 +2,112 @@
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <vector>
 
 #include "../inc/image.h"
+#include "../inc/pointwise.h"
+#include "../inc/kernels.h"
 #include "../../utils/utils.h"
+#include "../../utils/thread_pool.h"
 #include "../../colourspace/colourspaces.h"
 
 using namespace std;
 
 
+// Hands the three channels of every row of im to fn(row, c0, c1, c2) on the
+// thread pool, each channel contiguous. Interleaved rows are split into scratch
+// planes first, and written back after when write_back is set, so the same row
+// kernels serve both layouts.
+template <typename F>
+static void for_each_rgb_row(const Image& im, bool write_back, F fn) {
+  parallel_for(0, im.h, 16, [&](int r0, int r1) {
+    vector<float> scratch(3*(size_t)im.w);
+    float* planes[3] = {scratch.data(), scratch.data() + im.w, scratch.data() + 2*im.w};
+    for (int row = r0; row < r1; row++) {
+      if (im.layout == Image::PLANAR) {
+        fn(row, (float*)im.RowPtr(row, 0), (float*)im.RowPtr(row, 1), (float*)im.RowPtr(row, 2));
+        continue;
+      }
+      float* p = (float*)im.RowPtr(row, 0);
+      for (int col = 0; col < im.w; col++) for (int ch = 0; ch < 3; ch++) planes[ch][col] = p[col*im.c + ch];
+      fn(row, planes[0], planes[1], planes[2]);
+      if (!write_back) continue;
+      for (int col = 0; col < im.w; col++) for (int ch = 0; ch < 3; ch++) p[col*im.c + ch] = planes[ch][col];
+    }
+  });
+}
+
+
 Image Image::rgb_to_grayscale() const {
   assert(c == 3);
-  Image&& grayscaleImg = Image(w, h);
-  for (int row = 0; row < h; row++) {
-    for (int col = 0; col < w; col++) {
-      float value = (0.299f * get_pixel(col, row, 0)) 
-                  + (0.587f * get_pixel(col, row, 1)) 
-                  + (0.114f * get_pixel(col, row, 2));
-      grayscaleImg.set_pixel(col, row, 0, value);
-    } 
-  }
+  Image&& grayscaleImg = Image::uninitialized(w, h);
+  for_each_rgb_row(*this, false, [&](int row, float* r, float* g, float* b) {
+    kernel_rgb_to_gray(grayscaleImg.RowPtr(row, 0), r, g, b, w);
+  });
   return grayscaleImg;
 }
 
 
 void Image::shift(int ch, float v) {
   assert(ch >= 0 && ch < c);
-  for (int row = 0; row < h; row++) {
-    for (int col = 0; col < w; col++) {
-      pixel(col, row, ch) += v;
+  if (layout == INTERLEAVED && c > 1) {
+    for (int row = 0; row < h; row++) {
+      float* p = RowPtr(row, ch);
+      for (int col = 0; col < w; col++) p[col*c] += v;
     }
+    return;
   }
+  for_each_span(ch, ch + 1, [v](float* p, size_t n) { pointwise_add(p, n, v); });
 }
 
 
 void Image::clamp() {
-  for (int ch = 0; ch < c; ch++) {
-    for (int row = 0; row < h; row++) {
-      for (int col = 0; col < w; col++) {
-        set_pixel(col, row, ch, fmax(0.0f, fmin(1.0f, get_pixel(col, row, ch))));
-      }
-    }
-  }
+  for_each_span(0, c, [](float* p, size_t n) { pointwise_clamp(p, n, 0.f, 1.f); });
 }
 
 
 void Image::scale(int ch, float v) {
-  for (int row = 0; row < h; row++) {
-    for (int col = 0; col < w; col++) {
-      pixel(col, row, c) *= v;
+  assert(ch >= 0 && ch < c);
+  if (layout == INTERLEAVED && c > 1) {
+    for (int row = 0; row < h; row++) {
+      float* p = RowPtr(row, ch);
+      for (int col = 0; col < w; col++) p[col*c] *= v;
     }
+    return;
   }
+  for_each_span(ch, ch + 1, [v](float* p, size_t n) { pointwise_affine(p, n, v, 0.f); });
 }
 
 
 void Image::RGBtoHSV() {
   assert(c == 3);
-  for (int row = 0; row < h; row++) {
-    for (int col = 0; col < w; col++) {
-      float red = pixel(col, row, 0);
-      float green = pixel(col, row, 1);
-      float blue = pixel(col, row, 2);
-
-      HSVcolour hsv = rgb2hsv({red, green, blue});
-      pixel(col, row, 0) = hsv.h;
-      pixel(col, row, 1) = hsv.s;
-      pixel(col, row, 2) = hsv.v;
-    }
-  }
+  for_each_rgb_row(*this, true, [this](int, float* r, float* g, float* b) { kernel_rgb_to_hsv(r, g, b, w); });
 }
 
 
 void Image::HSVtoRGB() {
-  for (int row = 0; row < h; row++) {
-    for (int col = 0; col < w; col++) {
-      float hue = pixel(col, row, 0);
-      float saturation = pixel(col, row, 1);
-      float value = pixel(col, row, 2);
-
-      RGBcolour rgb = hsv2rgb({hue, saturation, value});
-      pixel(col, row, 0) = rgb.r;
-      pixel(col, row, 1) = rgb.g;
-      pixel(col, row, 2) = rgb.b;
-    }
-  }
+  for_each_rgb_row(*this, true, [this](int, float* h, float* s, float* v) { kernel_hsv_to_rgb(h, s, v, w); });
 }
 
 
 void Image::LCHtoRGB() {
-  for (int row = 0; row < h; row++) {
+  for_each_rgb_row(*this, true, [this](int, float* l, float* c, float* h) {
     for (int col = 0; col < w; col++) {
-      float l = pixel(col, row, 0);
-      float c = pixel(col, row, 1);
-      float h = pixel(col, row, 2);
-
-      RGBcolour rgb = lch2rgb({l, c, h});
-      pixel(col, row, 0) = rgb.r;
-      pixel(col, row, 1) = rgb.g;
-      pixel(col, row, 2) = rgb.b;
+      RGBcolour rgb = lch2rgb({l[col], c[col], h[col]});
+      l[col] = rgb.r;
+      c[col] = rgb.g;
+      h[col] = rgb.b;
     }
-  }
+  });
 }
 
 void Image::RGBtoLCH() {
-  for (int row = 0; row < h; row++) {
+  for_each_rgb_row(*this, true, [this](int, float* r, float* g, float* b) {
     for (int col = 0; col < w; col++) {
-      float r = pixel(col, row, 0);
-      float g = pixel(col, row, 1);
-      float b = pixel(col, row, 2);
-
-      LCHcolour lch = rgb2lch({r, g, b});
-      pixel(col, row, 0) = lch.l;
-      pixel(col, row, 1) = lch.c;
-      pixel(col, row, 2) = lch.h;
+      LCHcolour lch = rgb2lch({r[col], g[col], b[col]});
+      r[col] = lch.l;
+      g[col] = lch.c;
+      b[col] = lch.h;
     }
-  }
+  });
 }
@@ -2,19 +2,31 @@
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #include "../inc/image.h"
+#include "../inc/kernels.h"
+#include "../inc/resample.h"
+#include "../inc/filter_image.h"
 #include "../../utils/utils.h"
+#include "../../utils/thread_pool.h"
 
 using namespace std;
 
 
-float Image::nn_interpolate(float x, float y, int ch) const {
-  return get_pixel(round(x - 0.5f), round(y - 0.5f), ch);
+// shared by Image and ImageView so both sample pixels the same way
+template <class I>
+static float nn_interpolate(const I& im, float x, float y, int ch) {
+  return im.get_pixel(round(x - 0.5f), round(y - 0.5f), ch);
 }
 
 
-float Image::bilinear_interpolate(float x, float y, int ch) const {
+template <class I>
+static float bilinear_interpolate(const I& im, float x, float y, int ch) {
   x -= 0.5f;
   y -= 0.5f;
 
@@ -23,10 +35,10 @@ float Image::bilinear_interpolate(float x, float y, int ch) const {
   int upper_x = lower_x + 1;
   int upper_y = lower_y + 1;
 
-  float v1 = get_pixel(lower_x, lower_y, ch);
-  float v2 = get_pixel(upper_x, lower_y, ch);
-  float v3 = get_pixel(lower_x, upper_y, ch);
-  float v4 = get_pixel(upper_x, upper_y, ch);
+  float v1 = im.get_pixel(lower_x, lower_y, ch);
+  float v2 = im.get_pixel(upper_x, lower_y, ch);
+  float v3 = im.get_pixel(lower_x, upper_y, ch);
+  float v4 = im.get_pixel(upper_x, upper_y, ch);
 
   float q1 = (v1 * (((float)upper_x) - x)) + (v2 * (x - ((float)lower_x)));
   float q2 = (v3 * (((float)upper_x) - x)) + (v4 * (x - ((float)lower_x)));
@@ -35,31 +47,281 @@ float Image::bilinear_interpolate(float x, float y, int ch) const {
 }
 
 
-Image Image::nn_resize(int w, int h) const {
-  float col_scale = (float)this->w/(float)w;
-  float row_scale = (float)this->h/(float)h;
-  Image resized(w, h, c);
-  for (int ch = 0; ch < c; ch++) {
-    for (int row = 0; row < h; row++) {
-      for (int col = 0; col < w; col++) {
-        resized(col, row, ch) = nn_interpolate(col_scale * ((float)col + 0.5f), row_scale * ((float)row + 0.5f), ch);
-      }
+float Image::nn_interpolate(float x, float y, int ch) const            { return ::nn_interpolate(*this, x, y, ch); }
+float Image::bilinear_interpolate(float x, float y, int ch) const      { return ::bilinear_interpolate(*this, x, y, ch); }
+float ImageView::nn_interpolate(float x, float y, int ch) const        { return ::nn_interpolate(*this, x, y, ch); }
+float ImageView::bilinear_interpolate(float x, float y, int ch) const  { return ::bilinear_interpolate(*this, x, y, ch); }
+
+
+// MARK: - Tables
+
+ResampleAxis nn_axis(int src, int dst) {
+  ResampleAxis axis;
+  axis.src = src;
+  axis.dst = dst;
+  axis.taps = 1;
+  axis.index.resize(dst);
+  axis.weight.assign(dst, 1.f);
+  float scale = (float)src/(float)dst;
+  for (int i = 0; i < dst; i++) {
+    int nearest = round(scale * ((float)i + 0.5f) - 0.5f);
+    axis.index[i] = min(max(nearest, 0), src - 1);
+  }
+  return axis;
+}
+
+
+ResampleAxis bilinear_axis(int src, int dst) {
+  ResampleAxis axis;
+  axis.src = src;
+  axis.dst = dst;
+  axis.taps = 2;
+  axis.index.resize(2*dst);
+  axis.weight.resize(2*dst);
+  float scale = (float)src/(float)dst;
+  for (int i = 0; i < dst; i++) {
+    float x = scale * ((float)i + 0.5f);
+    x -= 0.5f;
+    int lower = floor(x);
+    int upper = lower + 1;
+    axis.index[i] = min(max(lower, 0), src - 1);
+    axis.index[dst + i] = min(max(upper, 0), src - 1);
+    axis.weight[i] = ((float)upper) - x;
+    axis.weight[dst + i] = x - ((float)lower);
+  }
+  return axis;
+}
+
+
+// Packs per sample lists of (source index, weight) into tap major tables,
+// short lists are padded with zero weights on their last index.
+static ResampleAxis pack_axis(int src, const vector<vector<pair<int, float>>>& samples) {
+  ResampleAxis axis;
+  axis.src = src;
+  axis.dst = samples.size();
+  for (auto& s : samples) axis.taps = max(axis.taps, (int)s.size());
+  axis.index.resize((size_t)axis.taps*axis.dst);
+  axis.weight.resize((size_t)axis.taps*axis.dst);
+  for (int i = 0; i < axis.dst; i++) {
+    for (int k = 0; k < axis.taps; k++) {
+      size_t e = (size_t)k*axis.dst + i;
+      bool pad = k >= (int)samples[i].size();
+      axis.index[e] = samples[i][pad ? samples[i].size() - 1 : k].first;
+      axis.weight[e] = pad ? 0.f : samples[i][k].second;
     }
   }
-  return resized;
+  return axis;
 }
 
 
-Image Image::bilinear_resize(int w, int h) const {
-  float col_scale = (float)this->w/(float)w;
-  float row_scale = (float)this->h/(float)h;
-  Image resized(w, h, c);
-  for (int ch = 0; ch < c; ch++) {
-    for (int row = 0; row < h; row++) {
-      for (int col = 0; col < w; col++) {
-        resized(col, row, ch) = bilinear_interpolate(col_scale * ((float)col + 0.5f), row_scale * ((float)row + 0.5f), ch);
-      }
+ResampleAxis area_axis(int src, int dst) {
+  vector<vector<pair<int, float>>> samples(dst);
+  double scale = (double)src/(double)dst;
+  for (int i = 0; i < dst; i++) {
+    double lo = i*scale;
+    double hi = min((i + 1)*scale, (double)src);
+    for (int s = (int)floor(lo); s < hi; s++) {
+      double covered = min(hi, s + 1.0) - max(lo, (double)s);
+      if (covered > 0) samples[i].push_back({s, (float)(covered/scale)});
+    }
+  }
+  return pack_axis(src, samples);
+}
+
+
+// the windowed filters and their radius in source samples at scale 1
+static double filter_weight(ResampleFilter filter, double x) {
+  x = fabs(x);
+  switch (filter) {
+    case FILTER_BICUBIC: {
+      const double a = -0.5;
+      if (x < 1) return ((a + 2)*x - (a + 3))*x*x + 1;
+      if (x < 2) return ((a*x - 5*a)*x + 8*a)*x - 4*a;
+      return 0;
+    }
+    case FILTER_MITCHELL: {
+      const double B = 1.0/3, C = 1.0/3;
+      if (x < 1) return ((12 - 9*B - 6*C)*x*x*x + (-18 + 12*B + 6*C)*x*x + (6 - 2*B))/6;
+      if (x < 2) return ((-B - 6*C)*x*x*x + (6*B + 30*C)*x*x + (-12*B - 48*C)*x + (8*B + 24*C))/6;
+      return 0;
+    }
+    case FILTER_LANCZOS3: {
+      if (x < 1e-8) return 1;
+      if (x >= 3) return 0;
+      double px = M_PI*x;
+      return 3*sin(px)*sin(px/3)/(px*px);
+    }
+    default: assert(0 && "not a windowed filter"); return 0;
+  }
+}
+
+
+static double filter_radius(ResampleFilter filter) { return filter == FILTER_LANCZOS3 ? 3 : 2; }
+
+
+ResampleAxis windowed_axis(int src, int dst, ResampleFilter filter) {
+  vector<vector<pair<int, float>>> samples(dst);
+  vector<double> w;
+  double scale = (double)src/(double)dst;
+  double stretch = max(1.0, scale);
+  double support = filter_radius(filter)*stretch;
+  for (int i = 0; i < dst; i++) {
+    double center = (i + 0.5)*scale - 0.5;
+    int lo = (int)ceil(center - support);
+    int hi = (int)floor(center + support);
+    w.assign(hi - lo + 1, 0.0);
+    double sum = 0;
+    for (int s = lo; s <= hi; s++) sum += w[s - lo] = filter_weight(filter, (s - center)/stretch);
+    for (int s = lo; s <= hi; s++) {
+      if (w[s - lo] != 0) samples[i].push_back({min(max(s, 0), src - 1), (float)(w[s - lo]/sum)});
+    }
+  }
+  return pack_axis(src, samples);
+}
+
+
+shared_ptr<const ResampleAxis> cached_axis(int src, int dst, ResampleFilter filter) {
+  // frames of a video come in a handful of sizes, the cache is dropped
+  // rather than managed if something resizes to many different ones
+  static const size_t MAX_CACHED = 256;
+  static mutex lock;
+  static map<tuple<int, int, int>, shared_ptr<const ResampleAxis>> cache;
+
+  tuple<int, int, int> key(src, dst, filter);
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+  }
+
+  shared_ptr<ResampleAxis> axis = make_shared<ResampleAxis>();
+  switch (filter) {
+    case FILTER_NEAREST:  *axis = nn_axis(src, dst); break;
+    case FILTER_BILINEAR: *axis = bilinear_axis(src, dst); break;
+    case FILTER_AREA:     *axis = area_axis(src, dst); break;
+    default:              *axis = windowed_axis(src, dst, filter); break;
+  }
+
+  lock_guard<mutex> guard(lock);
+  if (cache.size() >= MAX_CACHED) cache.clear();
+  cache[key] = axis;
+  return axis;
+}
+
+
+ResampleAxis filtered_axis(const ResampleAxis& axis, const vector<float>& taps) {
+  assert(taps.size() % 2 == 1);
+  const int r = taps.size()/2;
+  vector<vector<pair<int, float>>> samples(axis.dst);
+  vector<double> sum;
+  for (int i = 0; i < axis.dst; i++) {
+    // the filtered source sample j is sum of taps[t]*src[clamp(j + t - r)]
+    int lo = axis.src, hi = -1;
+    for (int k = 0; k < axis.taps; k++) {
+      lo = min(lo, axis.index[(size_t)k*axis.dst + i]);
+      hi = max(hi, axis.index[(size_t)k*axis.dst + i]);
+    }
+    lo = max(lo - r, 0);
+    hi = min(hi + r, axis.src - 1);
+    sum.assign(hi - lo + 1, 0.0);
+    for (int k = 0; k < axis.taps; k++) {
+      int j = axis.index[(size_t)k*axis.dst + i];
+      double wk = axis.weight[(size_t)k*axis.dst + i];
+      for (int t = 0; t < (int)taps.size(); t++) sum[min(max(j + t - r, 0), axis.src - 1) - lo] += wk*taps[t];
     }
+    for (int s = lo; s <= hi; s++) if (sum[s - lo] != 0) samples[i].push_back({s, (float)sum[s - lo]});
+    if (samples[i].empty()) samples[i].push_back({lo, 0.f});
   }
-  return resized;
-}
\ No newline at end of file
+  return pack_axis(axis.src, samples);
+}
+
+
+// MARK: - Engine
+
+// output rows per task, the horizontal pass is shared by the rows of a band
+static const int RESAMPLE_BAND = 16;
+
+
+Image resample(const ImageView& im, const ResampleAxis& cols, const ResampleAxis& rows) {
+  assert(cols.src == im.w && rows.src == im.h);
+  bool interleaved = im.is_interleaved() && im.pstride == im.c;
+  Image out = Image::uninitialized(cols.dst, rows.dst, im.c, interleaved ? Image::INTERLEAVED : Image::PLANAR);
+  if (cols.dst == 0 || rows.dst == 0) return out;
+
+  // an interleaved image is resampled all channels at once, every row of
+  // floats has lanes values per pixel
+  const int planes = interleaved ? 1 : im.c;
+  const int lanes = interleaved ? im.c : 1;
+  const int n = cols.dst*lanes;
+
+  // the column table in floats from the start of a source row
+  vector<int> index((size_t)cols.taps*n);
+  vector<float> weight((size_t)cols.taps*n);
+  for (int k = 0; k < cols.taps; k++) for (int x = 0; x < cols.dst; x++) for (int l = 0; l < lanes; l++) {
+    size_t e = (size_t)k*n + (size_t)x*lanes + l;
+    index[e] = cols.index[(size_t)k*cols.dst + x]*im.pstride + l;
+    weight[e] = cols.weight[(size_t)k*cols.dst + x];
+  }
+
+  const int bands = (rows.dst + RESAMPLE_BAND - 1)/RESAMPLE_BAND;
+  parallel_for(0, planes*bands, 1, [&](int a, int b) {
+    vector<float> band;
+    for (int q = a; q < b; q++) {
+      int ch = q / bands;
+      int y0 = (q % bands)*RESAMPLE_BAND;
+      int y1 = min(y0 + RESAMPLE_BAND, rows.dst);
+
+      // resample the source rows the band reads horizontally
+      int s0 = rows.src, s1 = -1;
+      for (int k = 0; k < rows.taps; k++) for (int y = y0; y < y1; y++) {
+        s0 = min(s0, rows.index[(size_t)k*rows.dst + y]);
+        s1 = max(s1, rows.index[(size_t)k*rows.dst + y]);
+      }
+      band.resize((size_t)(s1 - s0 + 1)*n);
+      for (int s = s0; s <= s1; s++) kernel_resample_row(&band[(size_t)(s - s0)*n], im.RowPtr(s, ch), index.data(), weight.data(), cols.taps, n);
+
+      // and blend them vertically
+      for (int y = y0; y < y1; y++) {
+        float* dst = out.RowPtr(y, ch);
+        const float* r0 = &band[(size_t)(rows.index[y] - s0)*n];
+        float w0 = rows.weight[y];
+        if (rows.taps == 1) {
+          if (w0 == 1.f) memcpy(dst, r0, n*sizeof(float));
+          else for (int i = 0; i < n; i++) dst[i] = r0[i] * w0;
+          continue;
+        }
+        const float* r1 = &band[(size_t)(rows.index[rows.dst + y] - s0)*n];
+        kernel_blend_rows(dst, r0, r1, w0, rows.weight[rows.dst + y], n);
+        for (int k = 2; k < rows.taps; k++) {
+          size_t e = (size_t)k*rows.dst + y;
+          kernel_axpy(dst, &band[(size_t)(rows.index[e] - s0)*n], n, rows.weight[e]);
+        }
+      }
+    }
+  });
+  return out;
+}
+
+
+// MARK: - Resize
+
+Image ImageView::resize(int w, int h, ResampleFilter filter) const {
+  return resample(*this, *cached_axis(this->w, w, filter), *cached_axis(this->h, h, filter));
+}
+
+
+Image ImageView::nn_resize(int w, int h) const        { return resize(w, h, FILTER_NEAREST); }
+Image ImageView::bilinear_resize(int w, int h) const  { return resize(w, h, FILTER_BILINEAR); }
+Image ImageView::area_resize(int w, int h) const      { return resize(w, h, FILTER_AREA); }
+
+
+Image smooth_resize(const ImageView& im, float sigma, int w, int h) {
+  vector<float> taps = fast_gaussian_taps(sigma);
+  return resample(im, filtered_axis(bilinear_axis(im.w, w), taps), filtered_axis(bilinear_axis(im.h, h), taps));
+}
+
+
+Image Image::nn_resize(int w, int h) const        { return view().nn_resize(w, h); }
+Image Image::bilinear_resize(int w, int h) const  { return view().bilinear_resize(w, h); }
+Image Image::area_resize(int w, int h) const      { return view().area_resize(w, h); }
+Image Image::resize(int w, int h, ResampleFilter filter) const  { return view().resize(w, h, filter); }
\ No newline at end of file
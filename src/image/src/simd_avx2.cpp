@@ -0,0 +1,19 @@
+// AVX2 build of the vectorized kernels, compiled with -mavx2 -mfma -ffp-contract=off
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#define SIMD_AVX2
+
+namespace simd_avx2 {
+#include "simd_vec.h"
+#include "pointwise_simd.h"
+#include "kernels_simd.h"
+}
+
+#endif
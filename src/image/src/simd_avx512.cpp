@@ -0,0 +1,19 @@
+// AVX-512 build of the vectorized kernels, compiled with -mavx512f -mavx512bw -mavx512dq -mavx512vl -ffp-contract=off
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#define SIMD_AVX512
+
+namespace simd_avx512 {
+#include "simd_vec.h"
+#include "pointwise_simd.h"
+#include "kernels_simd.h"
+}
+
+#endif
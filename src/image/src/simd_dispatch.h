@@ -0,0 +1,52 @@
+// Declarations of the per instruction set kernels built by the simd_<isa>.cpp
+// units and the switch that sends a call to the widest one the cpu supports.
+// DISPATCH returns from the calling function when a vectorized version ran and
+// falls through to the scalar code after it otherwise.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../../utils/cpu_dispatch.h"
+
+
+#define DECLARE_SIMD_KERNELS(NS)                                                                      \
+namespace NS {                                                                                        \
+  void add(float* p, size_t n, float v);                                                              \
+  void affine(float* p, size_t n, float a, float b);                                                  \
+  void clamp(float* p, size_t n, float lo, float hi);                                                 \
+  void abs(float* dst, const float* src, size_t n);                                                   \
+  void min_max(const float* p, size_t n, float* min, float* max);                                     \
+  float sum(const float* p, size_t n);                                                                \
+  float dot(const float* a, const float* b, int n);                                                   \
+  float l1_distance(const float* a, const float* b, int n);                                           \
+  void axpy(float* y, const float* x, int n, float a);                                                \
+  void blend_rows(float* out, const float* a, const float* b, float wa, float wb, int n);             \
+  void resample_row(float* out, const float* src, const int* index, const float* weight, int taps, int n); \
+  void convolve_row(float* out, const float* const* rows, const float* taps, int fw, int fh, int n); \
+  void rgb_to_gray(float* out, const float* r, const float* g, const float* b, int n);                \
+  void rgb_to_hsv(float* r, float* g, float* b, int n);                                               \
+  void hsv_to_rgb(float* h, float* s, float* v, int n);                                               \
+  void transpose(float* dst, size_t dst_stride, const float* src, size_t src_stride, int rows, int cols); \
+  void u8_to_float(float* dst, const uint8_t* src, int n);                                            \
+  void u8_deinterleave(float* const* planes, int nplanes, const uint8_t* src, int c, int n);          \
+  void float_to_u8(uint8_t* dst, const float* src, int n);                                            \
+  void float_interleave_u8(uint8_t* dst, int c, const float* const* planes, int n);                   \
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+DECLARE_SIMD_KERNELS(simd_sse42)
+DECLARE_SIMD_KERNELS(simd_avx2)
+DECLARE_SIMD_KERNELS(simd_avx512)
+
+#define DISPATCH(CALL)                                                     \
+  switch (cpu_level()) {                                                   \
+    case CPU_AVX512: return simd_avx512::CALL;                             \
+    case CPU_AVX2:   return simd_avx2::CALL;                               \
+    case CPU_SSE42:  return simd_sse42::CALL;                              \
+    default: break;                                                        \
+  }
+#else
+#define DISPATCH(CALL)
+#endif
@@ -0,0 +1,19 @@
+// SSE4.2 build of the vectorized kernels, compiled with -msse4.2 -ffp-contract=off
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#define SIMD_SSE42
+
+namespace simd_sse42 {
+#include "simd_vec.h"
+#include "pointwise_simd.h"
+#include "kernels_simd.h"
+}
+
+#endif
@@ -0,0 +1,143 @@
+// Thin wrappers over the vector registers of one instruction set so kernel
+// bodies can be written once and compiled for each of them. The simd_<isa>.cpp
+// unit including this picks the set with SIMD_SSE42, SIMD_AVX2 or SIMD_AVX512,
+// is built with the matching compiler flags and includes it inside its own
+// namespace after <immintrin.h>.
+
+
+#if defined(SIMD_AVX512)
+
+typedef __m512 vfloat;
+typedef __mmask16 vmask;
+static const int VN = 16;
+static inline vfloat vload(const float* p)                { return _mm512_loadu_ps(p); }
+static inline void vstore(float* p, vfloat a)             { _mm512_storeu_ps(p, a); }
+static inline vfloat vset(float v)                        { return _mm512_set1_ps(v); }
+static inline vfloat vadd(vfloat a, vfloat b)             { return _mm512_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b)             { return _mm512_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b)             { return _mm512_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b)             { return _mm512_div_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)             { return _mm512_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)             { return _mm512_max_ps(a, b); }
+static inline vfloat vabs(vfloat a)                       { return _mm512_abs_ps(a); }
+static inline vmask veq(vfloat a, vfloat b)               { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+static inline vmask vlt(vfloat a, vfloat b)               { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+static inline vmask vle(vfloat a, vfloat b)               { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm512_mask_blend_ps(m, b, a); }
+static inline vfloat vtrunc(vfloat a)                     { return _mm512_roundscale_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+// loads p[idx[0]], ..., p[idx[VN-1]]
+static inline vfloat vgather(const float* p, const int* idx) { return _mm512_i32gather_ps(_mm512_loadu_si512((const void*)idx), p, 4); }
+
+// widens VN consecutive bytes
+static inline vfloat vload_u8(const uint8_t* p)           { return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p))); }
+
+// joins VN/4 groups of four 32 bit integers
+static inline vfloat vfrom_i32x4(const __m128i* g) {
+  __m256i lo = _mm256_set_m128i(g[1], g[0]);
+  __m256i hi = _mm256_set_m128i(g[3], g[2]);
+  return _mm512_cvtepi32_ps(_mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1));
+}
+
+// stores the low byte of each lane, which must hold an integer
+static inline void vstore_u8(uint8_t* p, vfloat a)        { _mm_storeu_si128((__m128i*)p, _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(a))); }
+
+#elif defined(SIMD_AVX2)
+
+typedef __m256 vfloat;
+typedef __m256 vmask;
+static const int VN = 8;
+static inline vfloat vload(const float* p)                { return _mm256_loadu_ps(p); }
+static inline void vstore(float* p, vfloat a)             { _mm256_storeu_ps(p, a); }
+static inline vfloat vset(float v)                        { return _mm256_set1_ps(v); }
+static inline vfloat vadd(vfloat a, vfloat b)             { return _mm256_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b)             { return _mm256_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b)             { return _mm256_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b)             { return _mm256_div_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)             { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)             { return _mm256_max_ps(a, b); }
+static inline vfloat vabs(vfloat a)                       { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+static inline vmask veq(vfloat a, vfloat b)               { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+static inline vmask vlt(vfloat a, vfloat b)               { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vmask vle(vfloat a, vfloat b)               { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+static inline vfloat vtrunc(vfloat a)                     { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+// loads p[idx[0]], ..., p[idx[VN-1]]
+static inline vfloat vgather(const float* p, const int* idx) { return _mm256_i32gather_ps(p, _mm256_loadu_si256((const __m256i*)idx), 4); }
+
+// widens VN consecutive bytes
+static inline vfloat vload_u8(const uint8_t* p)           { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+
+// joins VN/4 groups of four 32 bit integers
+static inline vfloat vfrom_i32x4(const __m128i* g)        { return _mm256_cvtepi32_ps(_mm256_set_m128i(g[1], g[0])); }
+
+// stores the low byte of each lane, which must hold an integer
+static inline void vstore_u8(uint8_t* p, vfloat a) {
+  __m256i i = _mm256_and_si256(_mm256_cvttps_epi32(a), _mm256_set1_epi32(0xff));
+  __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1));
+  _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(w, w));
+}
+
+#else
+
+typedef __m128 vfloat;
+typedef __m128 vmask;
+static const int VN = 4;
+static inline vfloat vload(const float* p)                { return _mm_loadu_ps(p); }
+static inline void vstore(float* p, vfloat a)             { _mm_storeu_ps(p, a); }
+static inline vfloat vset(float v)                        { return _mm_set1_ps(v); }
+static inline vfloat vadd(vfloat a, vfloat b)             { return _mm_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b)             { return _mm_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b)             { return _mm_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b)             { return _mm_div_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)             { return _mm_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)             { return _mm_max_ps(a, b); }
+static inline vfloat vabs(vfloat a)                       { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+static inline vmask veq(vfloat a, vfloat b)               { return _mm_cmpeq_ps(a, b); }
+static inline vmask vlt(vfloat a, vfloat b)               { return _mm_cmplt_ps(a, b); }
+static inline vmask vle(vfloat a, vfloat b)               { return _mm_cmple_ps(a, b); }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm_blendv_ps(b, a, m); }
+static inline vfloat vtrunc(vfloat a)                     { return _mm_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+// loads p[idx[0]], ..., p[idx[VN-1]], SSE has no gather instruction
+static inline vfloat vgather(const float* p, const int* idx) { return _mm_set_ps(p[idx[3]], p[idx[2]], p[idx[1]], p[idx[0]]); }
+
+// widens VN consecutive bytes
+static inline vfloat vload_u8(const uint8_t* p) {
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+}
+
+// joins VN/4 groups of four 32 bit integers
+static inline vfloat vfrom_i32x4(const __m128i* g)        { return _mm_cvtepi32_ps(g[0]); }
+
+// stores the low byte of each lane, which must hold an integer
+static inline void vstore_u8(uint8_t* p, vfloat a) {
+  __m128i i = _mm_and_si128(_mm_cvttps_epi32(a), _mm_set1_epi32(0xff));
+  __m128i w = _mm_packus_epi32(i, i);
+  int32_t v = _mm_cvtsi128_si32(_mm_packus_epi16(w, w));
+  memcpy(p, &v, sizeof(v));
+}
+
+#endif
+
+
+// rounds halfway cases away from zero like roundf
+static inline vfloat vround(vfloat a) {
+  vfloat t = vtrunc(a);
+  vfloat frac = vsub(a, t);
+  t = vselect(vle(vset(0.5f), frac), vadd(t, vset(1.f)), t);
+  return vselect(vle(frac, vset(-0.5f)), vsub(t, vset(1.f)), t);
+}
+
+
+// sum of the lanes of a vector, added in lane order
+static inline float vhsum(vfloat a) {
+  float lanes[VN];
+  vstore(lanes, a);
+  float s = 0;
+  for (int k = 0; k < VN; k++) s += lanes[k];
+  return s;
+}
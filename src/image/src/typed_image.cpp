@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+
+#include "../inc/typed_image.h"
+
+using namespace std;
+
+
+static inline uint32_t float_bits(float v)    { uint32_t u; memcpy(&u, &v, sizeof(u)); return u; }
+static inline float bits_float(uint32_t u)    { float v; memcpy(&v, &u, sizeof(v)); return v; }
+
+
+uint16_t float_to_half(float v) {
+  const uint32_t f32_infinity = 255u << 23;
+  const uint32_t f16_overflow = (127u + 16) << 23;            // smallest float that rounds to a half infinity
+  const uint32_t denorm_magic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+  uint32_t f = float_bits(v);
+  uint32_t sign = f & 0x80000000u;
+  f ^= sign;
+
+  uint16_t out;
+  if (f >= f16_overflow) {
+    // infinity stays infinity, nan becomes a quiet nan
+    out = f > f32_infinity ? 0x7e00 : 0x7c00;
+  } else if (f < (113u << 23)) {
+    // too small for a normal half, let the fpu round the mantissa into place
+    out = float_bits(bits_float(f) + bits_float(denorm_magic)) - denorm_magic;
+  } else {
+    // rebias the exponent and round the mantissa to nearest even
+    uint32_t mantissa_odd = (f >> 13) & 1;
+    f += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    f += mantissa_odd;
+    out = f >> 13;
+  }
+  return out | (sign >> 16);
+}
+
+
+float half_to_float(uint16_t h) {
+  const uint32_t shifted_exp = 0x7c00u << 13;
+  const float magic = bits_float(113u << 23);
+
+  uint32_t out = (h & 0x7fffu) << 13;
+  uint32_t exp = shifted_exp & out;
+  out += (127u - 15) << 23;
+
+  if (exp == shifted_exp) {
+    // infinity or nan
+    out += (128u - 16) << 23;
+  } else if (exp == 0) {
+    // zero or subnormal, renormalize through the fpu
+    out += 1u << 23;
+    out = float_bits(bits_float(out) - magic);
+  }
+  out |= (uint32_t)(h & 0x8000u) << 16;
+  return bits_float(out);
+}
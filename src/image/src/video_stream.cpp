@@ -0,0 +1,310 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "../inc/video_stream.h"
+#include "../inc/kernels.h"
+#include "../../utils/thread_pool.h"
+
+using namespace std;
+
+
+static const char Y4M_SIGNATURE[] = "YUV4MPEG2 ";
+static const size_t STREAM_BUFFER = 1 << 20;
+
+
+static bool ends_with(const string& s, const string& suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+static float clamp01(float v) { return fmaxf(0.f, fminf(1.f, v)); }
+
+
+StreamFormat stream_format_for(const string& path) {
+  return ends_with(path, ".rgb") || ends_with(path, ".raw") ? STREAM_RGB24 : STREAM_Y4M;
+}
+
+
+// MARK: - FrameReader
+
+FrameReader::FrameReader(const string& path, int w, int h)
+  : file(nullptr), fmt(STREAM_RGB24), w(w), h(h), fps_n(30), fps_d(1), chroma(CHROMA_420), full_range(false) {
+  file = path == "-" ? stdin : fopen(path.c_str(), "rb");
+  if (!file) {
+    fprintf(stderr, "Cannot open video stream \"%s\"\n", path.c_str());
+    exit(0);
+  }
+  setvbuf(file, nullptr, _IOFBF, STREAM_BUFFER);
+
+  // a pipe can't seek back, the bytes read to look for the signature are kept
+  // and handed out first if it turns out to be rgb24
+  char sig[sizeof(Y4M_SIGNATURE) - 1];
+  size_t got = fread(sig, 1, sizeof(sig), file);
+  if (got == sizeof(sig) && memcmp(sig, Y4M_SIGNATURE, sizeof(sig)) == 0) {
+    string header;
+    for (int ch = fgetc(file); ch != EOF && ch != '\n'; ch = fgetc(file)) header += (char)ch;
+    fmt = STREAM_Y4M;
+    parse_header(header);
+  } else {
+    peeked.assign(sig, got);
+  }
+
+  if (this->w <= 0 || this->h <= 0) {
+    fprintf(stderr, "Cannot read video stream \"%s\"\nReason: rgb24 frames need a size\n", path.c_str());
+    exit(0);
+  }
+}
+
+
+FrameReader::~FrameReader() {
+  if (file && file != stdin) fclose(file);
+}
+
+
+void FrameReader::parse_header(const string& header) {
+  size_t pos = 0;
+  while (pos < header.size()) {
+    size_t end = header.find(' ', pos);
+    if (end == string::npos) end = header.size();
+    string tag = header.substr(pos, end - pos);
+    pos = end + 1;
+    if (tag.empty()) continue;
+
+    const char* v = tag.c_str() + 1;
+    switch (tag[0]) {
+      case 'W': w = atoi(v); break;
+      case 'H': h = atoi(v); break;
+      case 'F': sscanf(v, "%d:%d", &fps_n, &fps_d); break;
+      case 'C':
+        if (!strcmp(v, "420") || !strcmp(v, "420jpeg") || !strcmp(v, "420paldv") || !strcmp(v, "420mpeg2")) chroma = CHROMA_420;
+        else if (!strcmp(v, "422")) chroma = CHROMA_422;
+        else if (!strcmp(v, "444")) chroma = CHROMA_444;
+        else if (!strcmp(v, "mono")) chroma = CHROMA_MONO;
+        else {
+          fprintf(stderr, "Cannot read video stream\nReason: unsupported Y4M colourspace %s\n", v);
+          exit(0);
+        }
+        break;
+      case 'X': if (!strcmp(v, "COLORRANGE=FULL")) full_range = true; break;
+      default: break;
+    }
+  }
+}
+
+
+size_t FrameReader::read_bytes(void* dst, size_t n) {
+  size_t from_peek = min(n, peeked.size());
+  memcpy(dst, peeked.data(), from_peek);
+  peeked.erase(0, from_peek);
+  return from_peek + fread((char*)dst + from_peek, 1, n - from_peek, file);
+}
+
+
+// reads the bytes of the next frame into raw
+bool FrameReader::read_frame() {
+  size_t bytes = (size_t)w*h*3;
+  if (fmt == STREAM_Y4M) {
+    // every frame starts with a line "FRAME" and optional parameters
+    int ch = fgetc(file);
+    if (ch == EOF) return false;
+    while (ch != EOF && ch != '\n') ch = fgetc(file);
+
+    size_t cw = chroma == CHROMA_444 ? w : (w + 1)/2;
+    size_t chh = chroma == CHROMA_420 ? (h + 1)/2 : h;
+    bytes = (size_t)w*h + (chroma == CHROMA_MONO ? 0 : 2*cw*chh);
+  }
+  raw.resize(bytes);
+  return read_bytes(raw.data(), bytes) == bytes;
+}
+
+
+// converts one row of the Y4M frame in raw to rgb in [0, 1]
+void FrameReader::yuv_row(float* r, float* g, float* b, int row) const {
+  const int cw = chroma == CHROMA_444 ? w : (w + 1)/2;
+  const int chh = chroma == CHROMA_420 ? (h + 1)/2 : h;
+  const int crow = chroma == CHROMA_420 ? row/2 : row;
+  const unsigned char* Y = raw.data() + (size_t)row*w;
+  const unsigned char* U = raw.data() + (size_t)w*h + (size_t)crow*cw;
+  const unsigned char* V = U + (size_t)cw*chh;
+
+  // BT.601
+  const float ys = full_range ? 1.f : 255.f/219.f;
+  const float yo = full_range ? 0.f : 16.f;
+  const float cs = full_range ? 1.f : 255.f/224.f;
+  for (int x = 0; x < w; x++) {
+    int cx = chroma == CHROMA_444 ? x : x/2;
+    float yy = ((float)Y[x] - yo)*ys;
+    float u = chroma == CHROMA_MONO ? 0.f : ((float)U[cx] - 128.f)*cs;
+    float v = chroma == CHROMA_MONO ? 0.f : ((float)V[cx] - 128.f)*cs;
+    r[x] = clamp01((yy + 1.402f*v)/255.f);
+    g[x] = clamp01((yy - 0.344136f*u - 0.714136f*v)/255.f);
+    b[x] = clamp01((yy + 1.772f*u)/255.f);
+  }
+}
+
+
+bool FrameReader::read(Image& frame) {
+  if (!read_frame()) return false;
+  frame = Image::uninitialized(w, h, 3);
+  parallel_for(0, h, 16, [&](int r0, int r1) {
+    for (int row = r0; row < r1; row++) {
+      if (fmt == STREAM_RGB24) {
+        float* planes[3] = {frame.RowPtr(row, 0), frame.RowPtr(row, 1), frame.RowPtr(row, 2)};
+        kernel_u8_deinterleave(planes, 3, raw.data() + (size_t)row*w*3, 3, w);
+      } else {
+        yuv_row(frame.RowPtr(row, 0), frame.RowPtr(row, 1), frame.RowPtr(row, 2), row);
+      }
+    }
+  });
+  return true;
+}
+
+
+bool FrameReader::read(ImageU8& frame) {
+  if (!read_frame()) return false;
+  frame = ImageU8(w, h, 3);
+  parallel_for(0, h, 16, [&](int r0, int r1) {
+    vector<float> rgb(fmt == STREAM_Y4M ? 3*w : 0);
+    for (int row = r0; row < r1; row++) {
+      if (fmt == STREAM_RGB24) {
+        const unsigned char* src = raw.data() + (size_t)row*w*3;
+        for (int ch = 0; ch < 3; ch++) {
+          uint8_t* dst = frame.RowPtr(row, ch);
+          for (int x = 0; x < w; x++) dst[x] = src[x*3 + ch];
+        }
+        continue;
+      }
+      yuv_row(rgb.data(), rgb.data() + w, rgb.data() + 2*w, row);
+      for (int ch = 0; ch < 3; ch++) {
+        uint8_t* dst = frame.RowPtr(row, ch);
+        for (int x = 0; x < w; x++) dst[x] = pixel_traits<uint8_t>::from_float(rgb[ch*w + x]);
+      }
+    }
+  });
+  return true;
+}
+
+
+// MARK: - FrameWriter
+
+FrameWriter::FrameWriter(const string& path, StreamFormat format, int fps_num, int fps_den)
+  : file(nullptr), fmt(format), w(0), h(0), fps_n(fps_num), fps_d(fps_den) {
+  if (path == "-") {
+    // keep the real stdout for the frames and send everything printed from now on to stderr
+    fflush(stdout);
+    int fd = dup(fileno(stdout));
+    dup2(fileno(stderr), fileno(stdout));
+    file = fd < 0 ? nullptr : fdopen(fd, "wb");
+  } else {
+    file = fopen(path.c_str(), "wb");
+  }
+  if (!file) {
+    fprintf(stderr, "Cannot open video stream \"%s\"\n", path.c_str());
+    exit(0);
+  }
+  setvbuf(file, nullptr, _IOFBF, STREAM_BUFFER);
+}
+
+
+FrameWriter::~FrameWriter() {
+  if (file) fclose(file);
+}
+
+
+void FrameWriter::start(int fw, int fh) {
+  if (w == 0) {
+    w = fw;
+    h = fh;
+    if (fmt == STREAM_Y4M) fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", w, h, fps_n, fps_d);
+  }
+  assert(fw == w && fh == h && "every frame of a stream must have the same size");
+  rgb.resize((size_t)3*w*h);
+}
+
+
+void FrameWriter::write(const ImageView& frame) {
+  assert(frame.c == 3);
+  start(frame.w, frame.h);
+  parallel_for(0, h, 16, [&](int r0, int r1) {
+    for (int ch = 0; ch < 3; ch++) {
+      for (int row = r0; row < r1; row++) {
+        const float* src = frame.RowPtr(row, ch);
+        float* dst = rgb.data() + ((size_t)ch*h + row)*w;
+        for (int x = 0; x < w; x++) dst[x] = clamp01(src[x*frame.pstride]);
+      }
+    }
+  });
+  write_rgb();
+}
+
+
+void FrameWriter::write(const ImageU8& frame) {
+  assert(frame.c == 3);
+  start(frame.w, frame.h);
+  kernel_u8_to_float(rgb.data(), frame.data.data(), 3*w*h);
+  write_rgb();
+}
+
+
+// encodes the planes in rgb and appends them to the stream
+void FrameWriter::write_rgb() {
+  const float* R = rgb.data();
+  const float* G = R + (size_t)w*h;
+  const float* B = G + (size_t)w*h;
+
+  if (fmt == STREAM_RGB24) {
+    raw.resize((size_t)3*w*h);
+    parallel_for(0, h, 16, [&](int r0, int r1) {
+      for (int row = r0; row < r1; row++) {
+        const float* planes[3] = {R + (size_t)row*w, G + (size_t)row*w, B + (size_t)row*w};
+        kernel_float_interleave_u8(raw.data() + (size_t)row*w*3, 3, planes, w);
+      }
+    });
+    fwrite(raw.data(), 1, raw.size(), file);
+    return;
+  }
+
+  // BT.601 limited range, chroma averaged over 2x2 blocks
+  const int cw = (w + 1)/2;
+  const int chh = (h + 1)/2;
+  raw.resize((size_t)w*h + 2*(size_t)cw*chh);
+  unsigned char* Y = raw.data();
+  unsigned char* U = Y + (size_t)w*h;
+  unsigned char* V = U + (size_t)cw*chh;
+  parallel_for(0, chh, 8, [&](int c0, int c1) {
+    for (int cy = c0; cy < c1; cy++) {
+      for (int row = 2*cy; row < min(2*cy + 2, h); row++) {
+        for (int x = 0; x < w; x++) {
+          size_t i = (size_t)row*w + x;
+          Y[i] = (unsigned char)roundf(16.f + 65.481f*R[i] + 128.553f*G[i] + 24.966f*B[i]);
+        }
+      }
+      for (int cx = 0; cx < cw; cx++) {
+        float r = 0, g = 0, b = 0;
+        int n = 0;
+        for (int row = 2*cy; row < min(2*cy + 2, h); row++) {
+          for (int x = 2*cx; x < min(2*cx + 2, w); x++) {
+            size_t i = (size_t)row*w + x;
+            r += R[i];
+            g += G[i];
+            b += B[i];
+            n++;
+          }
+        }
+        r /= n;
+        g /= n;
+        b /= n;
+        U[(size_t)cy*cw + cx] = (unsigned char)roundf(128.f - 37.797f*r - 74.203f*g + 112.f*b);
+        V[(size_t)cy*cw + cx] = (unsigned char)roundf(128.f + 112.f*r - 93.786f*g - 18.214f*b);
+      }
+    }
+  });
+  fputs("FRAME\n", file);
+  fwrite(raw.data(), 1, raw.size(), file);
+}
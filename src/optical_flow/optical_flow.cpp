@@ -6,22 +6,20 @@
 #include <chrono>
 
 #include "optical_flow.h"
+#include "../image/inc/resample.h"
+#include "../utils/thread_pool.h"
 #include "../colourspace/colourspaces.h"
 
 using namespace std;
 
-// Calculate the time-structure matrix of an Image pair.
-// const Image& im: the input Image.
-// const Image& prev: the previous Image in sequence.
-// float s: sigma used for Gaussian smoothing the gradients
-// returns: structure matrix. 1st channel is Ix^2, 2nd channel is Iy^2,
-//          3rd channel is IxIy, 4th channel is IxIt, 5th channel is IyIt.
-Image time_structure_matrix(const Image& im, const Image& prev, float s) {
+// The per pixel products of the derivatives the time-structure matrix sums
+// over a window, see time_structure_matrix.
+static Image structure_products(const Image& im, const Image& prev) {
   assert(im.c==1 && prev.c==1 && "Only for grayscale images");
 
-  Image S(im.w,im.h,5);
+  Image S=Image::uninitialized(im.w,im.h,5);
 
-  // TODO: calculate gradients, structure components, and smooth them
+  // calculate gradients and structure components
   Image x_derivative_fiter(3, 1, 1);
   x_derivative_fiter(0, 0, 0) = -1;
   x_derivative_fiter(1, 0, 0) = 0;
@@ -35,18 +33,42 @@ Image time_structure_matrix(const Image& im, const Image& prev, float s) {
   Image ix = convolve_image(prev, x_derivative_fiter, 0);
   Image iy = convolve_image(prev, y_derivative_fiter, 0);
 
-  for (int y = 0; y < im.h; y++) {
-    for (int x = 0; x < im.w; x++) {
-      S(x, y, 0) = ix(x, y, 0) * ix(x, y, 0);
-      S(x, y, 1) = iy(x, y, 0) * iy(x, y, 0);
-      S(x, y, 2) = ix(x, y, 0) * iy(x, y, 0);
-      float it = im(x, y, 0) - prev(x, y, 0);
-      S(x, y, 3) = -(ix(x, y, 0) * it);
-      S(x, y, 4) = -(iy(x, y, 0) * it);
+  parallel_for(0, im.h, 16, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = 0; x < im.w; x++) {
+        S(x, y, 0) = ix(x, y, 0) * ix(x, y, 0);
+        S(x, y, 1) = iy(x, y, 0) * iy(x, y, 0);
+        S(x, y, 2) = ix(x, y, 0) * iy(x, y, 0);
+        float it = im(x, y, 0) - prev(x, y, 0);
+        S(x, y, 3) = -(ix(x, y, 0) * it);
+        S(x, y, 4) = -(iy(x, y, 0) * it);
+      }
     }
-  }
+  });
+
+  return S;
+}
+
+
+// Calculate the time-structure matrix of an Image pair.
+// const Image& im: the input Image.
+// const Image& prev: the previous Image in sequence.
+// float s: sigma used for Gaussian smoothing the gradients
+// returns: structure matrix. 1st channel is Ix^2, 2nd channel is Iy^2,
+//          3rd channel is IxIy, 4th channel is IxIt, 5th channel is IyIt.
+Image time_structure_matrix(const Image& im, const Image& prev, float s) {
+  return fast_smooth_image(structure_products(im, prev), s);
+}
+
 
-  return fast_smooth_image(S, s);
+// Calculate the time-structure matrix of an Image pair averaging over a
+// window x window box, the same cost for any window.
+// const Image& im: the input Image.
+// const Image& prev: the previous Image in sequence.
+// int window: the side of the window
+// returns: structure matrix, channels as in time_structure_matrix.
+Image time_structure_window(const Image& im, const Image& prev, int window) {
+  return box_filter_image(structure_products(im, prev), window, window);
 }
 
 // Compute the eigenvalues of the structure matrix
@@ -56,25 +78,27 @@ Image time_structure_matrix(const Image& im, const Image& prev, float s) {
 //                           1-st channel : smallest
 Image eigenvalue_matrix(const Image& ts) {
 
-  Image im(ts.w,ts.h,2);
-
-  for (int j = 0; j < ts.h; j++) {
-    for (int i = 0; i < ts.w; i++) {
-      float b = (-ts(i, j, 0) - ts(i, j, 1));
-      float a = 1;
-      float c = ((ts(i, j, 0) * ts(i, j, 1)) - (ts(i, j, 2) * ts(i, j, 2)));
-      float e1 = (-b + sqrt((b * b) - 4 * a * c))/(2 * a);
-      float e2 = (-b - sqrt((b * b) - 4 * a * c))/(2 * a);
-
-      if (e1 < e2) {
-        im(i, j, 0) = e2;
-        im(i, j, 1) = e1;
-      } else {
-        im(i, j, 0) = e1;
-        im(i, j, 1) = e2;
+  Image im=Image::uninitialized(ts.w,ts.h,2);
+
+  parallel_for(0, ts.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = 0; i < ts.w; i++) {
+        float b = (-ts(i, j, 0) - ts(i, j, 1));
+        float a = 1;
+        float c = ((ts(i, j, 0) * ts(i, j, 1)) - (ts(i, j, 2) * ts(i, j, 2)));
+        float e1 = (-b + sqrt((b * b) - 4 * a * c))/(2 * a);
+        float e2 = (-b - sqrt((b * b) - 4 * a * c))/(2 * a);
+
+        if (e1 < e2) {
+          im(i, j, 0) = e2;
+          im(i, j, 1) = e1;
+        } else {
+          im(i, j, 0) = e1;
+          im(i, j, 1) = e2;
+        }
       }
     }
-  }
+  });
 
   return im;
 }
@@ -82,20 +106,44 @@ Image eigenvalue_matrix(const Image& ts) {
 
 vector<Image> make_image_pyramid(const Image& a, float factor, int levels) {
   assert(a.c==1 && "Only for grayscale");
+  return ImagePyramid(a,factor,levels).gaussian_levels();
+}
 
 
-  vector<Image> imgs(levels);
-  imgs[0]=a;
+vector<Image> make_image_pyramid(const string& filename, float factor, int levels, int max_w, int max_h) {
+  return make_image_pyramid(load_image(filename, max_w, max_h).rgb_to_grayscale(), factor, levels);
+}
 
-  for(int l=1;l<levels;l++) {
-    Image f=fast_smooth_image(imgs[l-1],factor/1.5);
 
-    int bw=max(1,(int)(f.w/factor));
-    int bh=max(1,(int)(f.h/factor));
-    imgs[l]=f.bilinear_resize(bw,bh);
+Image load_flow_frame(const string& filename, float subsample_input) {
+  int w, h;
+  if (!image_file_size(filename, &w, &h)) {
+    fprintf(stderr, "Cannot load image \"%s\"\nReason: unknown image format\n", filename.c_str());
+    exit(0);
   }
+  const int fw = max(1, (int)roundf(w/subsample_input));
+  const int fh = max(1, (int)roundf(h/subsample_input));
+  int s = 1;
+  while (s < 8 && 2*s <= subsample_input) s *= 2;
+  Image im = load_image(filename, (w + s - 1)/s, (h + s - 1)/s);
+  Image gray = im.c == 1 ? im : im.rgb_to_grayscale();
+  if (gray.w == fw && gray.h == fh) return gray;
+  return gray.area_resize(fw, fh);
+}
 
-  return imgs;
+
+void push_frame(LKIterPyramid& lk, const Image& frame) {
+  push_frame(lk, Image(frame));
+}
+
+
+void push_frame(LKIterPyramid& lk, Image&& frame) {
+  assert(frame.c==1 && "Only for grayscale");
+  lk.pyramid0=move(lk.pyramid1);
+  lk.pyramid1=ImagePyramid(move(frame),lk.pyramid_factor,lk.pyramid_levels);
+  // level 0 is never rebuilt, the views stay valid while a copy of the pyramid lives
+  lk.t0=lk.pyramid0.empty() ? ImageView() : ImageView(lk.pyramid0[0]);
+  lk.t1=lk.pyramid1[0];
 }
 
 
@@ -107,7 +155,7 @@ vector<Image> make_image_pyramid(const Image& a, float factor, int levels) {
 // Return: 2 channel (u,v) image  : the x and y
 // velocities computed by inv(S'S)*(S'T)
 Image velocity_image(const Image& S,const Image& ev) {
-  Image v(S.w, S.h, 2);
+  Image v = Image::uninitialized(S.w, S.h, 2);
 
   // TODO: compute velocity for each pixel using (S'S)(S'T) formula
   // Use the class Matrix2x2 and Vector2 insted of Matrix
@@ -116,22 +164,24 @@ Image velocity_image(const Image& S,const Image& ev) {
   // if the smallest eigenvalue is smaller than 1e-5
   // In that case just set it to (0,0)
   float threshold = 1e-5f;
-  for (int j = 0; j < S.h; j++) {
-    for (int i = 0; i < S.w; i++) {
-      if (ev(i, j, 1) < threshold) {
-        v(i, j, 0) = 0;
-        v(i, j, 1) = 0;
-      } else {
-        Matrix2x2 sts(S(i, j, 0), S(i, j, 2), S(i, j, 2), S(i, j, 1));
-        sts = sts.inverse();
-        Vector2 st(S(i, j, 3), S(i, j, 4));
-        float x = sts.a * st.a + sts.b * st.b;
-        float y = sts.c * st.a + sts.d * st.b;
-        v(i, j, 0) = x;
-        v(i, j, 1) = y;
+  parallel_for(0, S.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = 0; i < S.w; i++) {
+        if (ev(i, j, 1) < threshold) {
+          v(i, j, 0) = 0;
+          v(i, j, 1) = 0;
+        } else {
+          Matrix2x2 sts(S(i, j, 0), S(i, j, 2), S(i, j, 2), S(i, j, 1));
+          sts = sts.inverse();
+          Vector2 st(S(i, j, 3), S(i, j, 4));
+          float x = sts.a * st.a + sts.b * st.b;
+          float y = sts.c * st.a + sts.d * st.b;
+          v(i, j, 0) = x;
+          v(i, j, 1) = y;
+        }
       }
     }
-  }
+  });
 
   return v;
 }
@@ -140,9 +190,13 @@ Image velocity_image(const Image& S,const Image& ev) {
 // const Image& im: Image to constrain
 // float v: each pixel will be in range [-v, v]
 void constrain_image(const Image& im, float v) {
-  for(int i = 0; i < im.w*im.h*im.c; ++i) {
-    if (im.data[i] < -v) im.data[i] = -v;
-    if (im.data[i] >  v) im.data[i] =  v;
+  ImageView view(im);
+  for(int ch = 0; ch < view.c; ++ch) for(int y = 0; y < view.h; ++y) {
+    float* row = view.RowPtr(y, ch);
+    for(int x = 0; x < view.w*view.pstride; x += view.pstride) {
+      if (row[x] < -v) row[x] = -v;
+      if (row[x] >  v) row[x] =  v;
+    }
   }
 }
 
@@ -160,18 +214,17 @@ Image warp_flow(const Image& im, const Image& v) {
   // create sum_weight and sum_weighted_value
   Image sum_weight(im.w, im.h, 1);
   Image sum_weighted_value(im.w, im.h, 1);
-  int sum_total = 0;
-  int sum_weighted_total = 0;
-  for (int j = 0; j < im.h; j++) {
-    for (int i = 0; i < im.w; i++) {
-      sum_weight(i, j, 0) = old_weight;
-      sum_weighted_value(i, j, 0) = im(i, j, 0) * old_weight;
-      sum_weighted_total += im(i, j, 0) * old_weight;
-      sum_total += old_weight;
+  parallel_for(0, im.h, 32, [&](int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = 0; i < im.w; i++) {
+        sum_weight(i, j, 0) = old_weight;
+        sum_weighted_value(i, j, 0) = im(i, j, 0) * old_weight;
+      }
     }
-  }
+  });
 
   // TODO: Warp image "im" according to flow "v"
+  // the splat scatters into neighbouring rows of arbitrary distance so it stays on one thread
   for (int j = 0; j < im.h; j++) {
     for (int i = 0; i < im.w; i++) {
       float new_x = i + v(i, j, 0);
@@ -201,11 +254,13 @@ Image warp_flow(const Image& im, const Image& v) {
   }
 
   // now need to normalize the pixels in the resulting image based on sum_weighted_value and sum_weight
-  for (int j = 0; j < im.h; j++) {
-    for (int i = 0; i < im.w; i++) {
-      result(i, j, 0) = sum_weighted_value(i, j, 0) / sum_weight(i, j, 0);
+  parallel_for(0, im.h, 32, [&](int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = 0; i < im.w; i++) {
+        result(i, j, 0) = sum_weighted_value(i, j, 0) / sum_weight(i, j, 0);
+      }
     }
-  }
+  });
   return result;
 }
 
@@ -254,7 +309,8 @@ void compute_iterative_pyramid_LK(LKIterPyramid& lk) {
     }
 
     for(int q1=0;q1<lk.lk_iterations;q1++) {
-      S = time_structure_matrix(lk.pyramid1[q2], lk.warped, lk.smooth_structure);
+      if(lk.structure_window>0)S = time_structure_window(lk.pyramid1[q2], lk.warped, lk.structure_window);
+      else S = time_structure_matrix(lk.pyramid1[q2], lk.warped, lk.smooth_structure);
       ev = eigenvalue_matrix(S);
       v2 = velocity_image(S, ev);
 
@@ -274,15 +330,15 @@ void compute_iterative_pyramid_LK(LKIterPyramid& lk) {
 
   if(lk.compute_all) {
     lk.all=Image(w*2,h*2,3);
-    for(int c=0;c<3;c++)for(int q2=0;q2<h;q2++)for(int q1=0;q1<w;q1++)lk.all(q1+0,q2+0,c)=lk.t1(q1,q2,c);
-    for(int c=0;c<3;c++)for(int q2=0;q2<h;q2++)for(int q1=0;q1<w;q1++)lk.all(q1+w,q2+0,c)=lk.colorflow(q1,q2,c);
+    lk.all.paste(lk.t1,0,0);
+    lk.all.paste(lk.colorflow,w,0);
     for(int c=0;c<3;c++)for(int q2=0;q2<h;q2++)for(int q1=0;q1<w;q1++)lk.all(q1+0,q2+h,c)=lk.warped(q1,q2);
     for(int c=0;c<3;c++)for(int q2=0;q2<h;q2++)for(int q1=0;q1<w;q1++)lk.all(q1+w,q2+h,c)=lk.error(q1,q2);
   }
 
   if(lk.compute_colored_ev) {
     lk.ev3=Image(ev.w,ev.h,3);
-    memcpy(lk.ev3.data,ev.data,ev.size()*sizeof(float));
+    for(int c=0;c<ev.c;c++)for(int q2=0;q2<ev.h;q2++)memcpy(lk.ev3.RowPtr(q2,c),ev.RowPtr(q2,c),ev.w*sizeof(float));
   }
 
 }
@@ -308,18 +364,20 @@ Image vel2rgb(const Image& v, float thres) {
   assert(v.c==2 && "velocity must contain 2 channels");
   Image ret(v.w,v.h,3);
   
-  for(int q2=0;q2<v.h;q2++)for(int q1=0;q1<v.w;q1++) {
-    float dx=v(q1,q2,0);
-    float dy=v(q1,q2,1);
-    //printf("%f %f %f\n",dx,dy,sqrtf(dx*dx+dy*dy));
-    float mag=min(sqrtf(dx*dx+dy*dy)/thres,1.f);
-    float hue=(atan2f(dy,dx)+M_PI)/2/M_PI;
-    if(hue<0)hue=0;
-    if(hue>1)hue=1;
-    Color c=Color::HSV(hue,mag,mag);
-    ret(q1,q2,0)=c.c[0];
-    ret(q1,q2,1)=c.c[1];
-    ret(q1,q2,2)=c.c[2];
-  }
+  parallel_for(0,v.h,16,[&](int a,int b){
+    for(int q2=a;q2<b;q2++)for(int q1=0;q1<v.w;q1++) {
+      float dx=v(q1,q2,0);
+      float dy=v(q1,q2,1);
+      //printf("%f %f %f\n",dx,dy,sqrtf(dx*dx+dy*dy));
+      float mag=min(sqrtf(dx*dx+dy*dy)/thres,1.f);
+      float hue=(atan2f(dy,dx)+M_PI)/2/M_PI;
+      if(hue<0)hue=0;
+      if(hue>1)hue=1;
+      Color c=Color::HSV(hue,mag,mag);
+      ret(q1,q2,0)=c.c[0];
+      ret(q1,q2,1)=c.c[1];
+      ret(q1,q2,2)=c.c[2];
+    }
+  });
   return ret;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "../image/inc/image.h"
 #include "../matrix/matrix.h"
 #include "../image/inc/filter_image.h"
+#include "../image/inc/image_pyramid.h"
 #include "../feature_detection/harris_detector.h"
 
 
@@ -11,10 +12,10 @@ using namespace std;
 
 struct LKIterPyramid {
   // INPUT
-  vector<Image> pyramid1;
-  vector<Image> pyramid0;
-  Image t0;
-  Image t1;
+  ImagePyramid pyramid1;
+  ImagePyramid pyramid0;
+  ImageView t0;   // level 0 of pyramid0, shared rather than copied
+  ImageView t1;   // level 0 of pyramid1
 
   // OUTPUT
   Image v;  // resulting velocity
@@ -27,6 +28,7 @@ struct LKIterPyramid {
   // OPTIONS
   float subsample_input=2;    // how much to reduce input image size
   float smooth_structure=1;   // how much to smooth structure matrix
+  int structure_window=0;     // side of a box window to average the structure matrix over instead (0 - smooth)
   float smooth_vel=1;         // how much to smooth resulting velocity
   int lk_iterations=2;        // LK iterations to run (0 -  no flow, 1 - standard version)
   int pyramid_levels=6;       // pyramid levels (1 - standard algo)
@@ -48,6 +50,15 @@ struct LKIterPyramid {
 Image time_structure_matrix(const Image& im, const Image& prev, float s);
 
 
+// Calculate the time-structure matrix of an Image pair averaging over a
+// window x window box with an IntegralImage, the same cost for any window.
+// const Image& im: the input Image.
+// const Image& prev: the previous Image in sequence.
+// int window: the side of the window
+// returns: structure matrix, channels as in time_structure_matrix.
+Image time_structure_window(const Image& im, const Image& prev, int window);
+
+
 // Compute the eigenvalues of the structure matrix
 // Compute the eigenvalues only of S'S (the first three channels only)
 // const Image& ts: the time-structure matrix
@@ -59,6 +70,34 @@ Image eigenvalue_matrix(const Image& ts);
 vector<Image> make_image_pyramid(const Image& a, float factor, int levels);
 
 
+// Load an image file as the grayscale pyramid of make_image_pyramid, shrunk
+// to fit max_w x max_h while loading, see load_image.
+// const string& filename: the image to load
+// float factor, int levels: as in make_image_pyramid
+// int max_w, max_h: the largest size of level 0, 0 or less for any
+vector<Image> make_image_pyramid(const string& filename, float factor, int levels, int max_w, int max_h);
+
+
+// Load an image file as a grayscale frame for the flow, reduced by
+// subsample_input. The largest power of two up to it is taken off while
+// loading, what is left by area_resize.
+// const string& filename: the frame to load
+// float subsample_input: how much to reduce the frame, see LKIterPyramid
+// returns: the grayscale frame
+Image load_flow_frame(const string& filename, float subsample_input);
+
+
+// Moves the current frame of lk (t1 and pyramid1) to the previous one and
+// makes frame the current one. The previous frame's pyramid is kept, so over
+// a sequence every frame's pyramid is built once. The frame is stored once, as
+// level 0 of pyramid1, which t1 views.
+// LKIterPyramid& lk: the state of the flow, its options give the pyramid shape
+// const Image& frame: the next grayscale frame, copied, or moved in when it is
+// a temporary
+void push_frame(LKIterPyramid& lk, const Image& frame);
+void push_frame(LKIterPyramid& lk, Image&& frame);
+
+
 // Calculate the velocity given a structure Image
 // const Image& S: time-structure Image
 // const Image& ev: eigenvalue image
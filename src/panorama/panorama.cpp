@@ -5,6 +5,8 @@
 #include <cassert>
 
 #include "panorama.h"
+#include "../utils/thread_pool.h"
+#include "../image/inc/kernels.h"
 
 #include <set>
 
@@ -17,16 +19,8 @@ using namespace std;
 Image both_images(const Image& a, const Image& b) {
   assert(a.c==b.c);
   Image both(a.w + b.w, a.h > b.h ? a.h : b.h, a.c);
-
-  for(int k = 0; k < both.c; ++k)
-    for(int j = 0; j < a.h; ++j)
-      for(int i = 0; i < a.w; ++i)
-        both(i, j, k) = a(i, j, k);
-
-  for(int k = 0; k < both.c; ++k)
-    for(int j = 0; j < b.h; ++j)
-      for(int i = 0; i < b.w; ++i)
-        both(i+a.w, j, k) = b(i, j, k);
+  both.paste(a, 0, 0);
+  both.paste(b, a.w, 0);
   return both;
 }
 
@@ -104,13 +98,7 @@ Image find_and_draw_matches(const Image& a, const Image& b, float sigma, float t
 float l1_distance(const vector<float>& a,const vector<float>& b) {
   assert(a.size()==b.size() && "Arrays must have same size\n");
 
-  // TODO: return the correct number.
-  float sum = 0;
-  for (int i = 0; i < a.size(); i++) {
-    sum += abs(a[i] - b[i]);
-  }
-
-  return sum;
+  return kernel_l1_distance(a.data(), b.data(), (int)a.size());
 }
 
 
@@ -118,23 +106,25 @@ float l1_distance(const vector<float>& a,const vector<float>& b) {
 // const vector<Descriptor>& a, b: array of descriptors for pixels in two images.
 // returns: best matches found. For each element in a[] find the index of best match in b[]
 vector<int> match_descriptors_a2b(const vector<Descriptor>& a, const vector<Descriptor>& b) {
-  vector<int> ind;
-  for(int j=0;j<(int)a.size();j++) {
-    int bind = -1; // <- find the best match (-1: no match)
-    float best_distance=1e10f;  // <- best distance
-
-    // TODO: find the best 'bind' descriptor in b that best matches a[j]
-    // TODO: put your code here:
-    for (int i = 0; i < b.size(); i++) {
-      float distance = l1_distance(a[j].data, b[i].data);
-      if (distance < best_distance) {
-        best_distance = distance;
-        bind = i;
+  vector<int> ind(a.size());
+  parallel_for(0, (int)a.size(), 16, [&](int j0, int j1) {
+    for(int j=j0;j<j1;j++) {
+      int bind = -1; // <- find the best match (-1: no match)
+      float best_distance=1e10f;  // <- best distance
+
+      // TODO: find the best 'bind' descriptor in b that best matches a[j]
+      // TODO: put your code here:
+      for (int i = 0; i < b.size(); i++) {
+        float distance = l1_distance(a[j].data, b[i].data);
+        if (distance < best_distance) {
+          best_distance = distance;
+          bind = i;
+        }
       }
-    }
 
-    ind.push_back(bind);
-  }
+      ind[j] = bind;
+    }
+  });
   return ind;
 }
 
@@ -332,7 +322,7 @@ Matrix RANSAC(vector<Match> m, float thresh, int k, int cutoff) {
 }
 
 
-Image trim_image(const Image& a) {
+ImageView trim_image_view(const Image& a) {
   int minx=a.w-1;
   int maxx=0;
   int miny=a.h-1;
@@ -345,14 +335,14 @@ Image trim_image(const Image& a) {
     maxy=max(maxy,q2);
   }
 
-  if(maxx<minx || maxy<miny)return a;
+  if(maxx<minx || maxy<miny)return a.view();
 
-  Image b(maxx-minx+1,maxy-miny+1,a.c);
+  return a.crop(minx,miny,maxx-minx+1,maxy-miny+1);
+}
 
-  for(int q3=0;q3<a.c;q3++)for(int q2=miny;q2<=maxy;q2++)for(int q1=minx;q1<=maxx;q1++)
-    b(q1-minx,q2-miny,q3)=a(q1,q2,q3);
 
-  return b;
+Image trim_image(const Image& a) {
+  return Image(trim_image_view(a));
 }
 
 
@@ -412,27 +402,29 @@ Image combine_images(const Image& a, const Image& b, const Matrix& Hba, float ab
   // and see if their projection from a coordinates to b coordinates falls
   // inside of the bounds of image b. If so, use bilinear interpolation to
   // estimate the value of b at that projection, then fill in image c.
-  for (int channel = 0; channel < a.c; channel++) {
-    for (int j = topleft.y; j < botright.y; j++) {
-      for (int i = topleft.x; i < botright.x; i++) {
-        Point projected = project_point(Hba, Point(i, j));
-        if (projected.x >= 0 && projected.x < b.w && projected.y >= 0 && projected.y < b.h) {
-          float value = b.nn_interpolate(projected.x, projected.y, channel);
-          float total_for_channel_b = value + b.nn_interpolate(projected.x, projected.y, 1) + b.nn_interpolate(projected.x, projected.y, 2);
-          if (i >= 0 && i < a.w && j >= 0 && j < a.h) {
-            float curr_val = a.get_pixel(i, j, channel);
-            float total_for_channel_a = a.get_pixel(i, j, 0) + a.get_pixel(i, j, 1) + a.get_pixel(i, j, 2);
-            if (total_for_channel_b != 0 && total_for_channel_a != 0) {
-              value = (value * (1-ablendcoeff)) + (curr_val * ablendcoeff);
-            } else if (total_for_channel_b == 0) {
-              value = curr_val;
+  parallel_for((int)topleft.y, (int)ceilf(botright.y), 4, [&](int j0, int j1) {
+    for (int channel = 0; channel < a.c; channel++) {
+      for (int j = j0; j < j1; j++) {
+        for (int i = topleft.x; i < botright.x; i++) {
+          Point projected = project_point(Hba, Point(i, j));
+          if (projected.x >= 0 && projected.x < b.w && projected.y >= 0 && projected.y < b.h) {
+            float value = b.nn_interpolate(projected.x, projected.y, channel);
+            float total_for_channel_b = value + b.nn_interpolate(projected.x, projected.y, 1) + b.nn_interpolate(projected.x, projected.y, 2);
+            if (i >= 0 && i < a.w && j >= 0 && j < a.h) {
+              float curr_val = a.get_pixel(i, j, channel);
+              float total_for_channel_a = a.get_pixel(i, j, 0) + a.get_pixel(i, j, 1) + a.get_pixel(i, j, 2);
+              if (total_for_channel_b != 0 && total_for_channel_a != 0) {
+                value = (value * (1-ablendcoeff)) + (curr_val * ablendcoeff);
+              } else if (total_for_channel_b == 0) {
+                value = curr_val;
+              }
             }
+            c.set_pixel(i - dx, j - dy, channel, value);
           }
-          c.set_pixel(i - dx, j - dy, channel, value);
         }
       }
     }
-  }
+  });
   // When doing cylindrical and spherical, how do we cope with the missing
   // image values due to the warping process?
   return trim_image(c);
@@ -473,22 +465,24 @@ Image cylindrical_project(const Image& im, float f) {
   int xc = im.w/2;
   int yc = im.h/2;
 
-  for (int j = 0; j < im.h; j++) {
-    for (int i = 0; i < im.w; i++) {
-      float theta = (i - xc)/f;
-      float h = (j - yc)/f;
-      float x_prime = sin(theta);
-      float y_prime = h;
-      float z_prime = cos(theta);
-      float new_x = ((f * x_prime)/z_prime) + xc;
-      float new_y = ((f * y_prime)/z_prime) + yc;
-      if (new_x >= 0 && new_x < im.w && new_y >= 0 && new_y < im.h) {
-        res.set_pixel(i, j, 0, im.get_pixel(new_x, new_y, 0));
-        res.set_pixel(i, j, 1, im.get_pixel(new_x, new_y, 1));
-        res.set_pixel(i, j, 2, im.get_pixel(new_x, new_y, 2));
+  parallel_for(0, im.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = 0; i < im.w; i++) {
+        float theta = (i - xc)/f;
+        float h = (j - yc)/f;
+        float x_prime = sin(theta);
+        float y_prime = h;
+        float z_prime = cos(theta);
+        float new_x = ((f * x_prime)/z_prime) + xc;
+        float new_y = ((f * y_prime)/z_prime) + yc;
+        if (new_x >= 0 && new_x < im.w && new_y >= 0 && new_y < im.h) {
+          res.set_pixel(i, j, 0, im.get_pixel(new_x, new_y, 0));
+          res.set_pixel(i, j, 1, im.get_pixel(new_x, new_y, 1));
+          res.set_pixel(i, j, 2, im.get_pixel(new_x, new_y, 2));
+        }
       }
     }
-  }
+  });
   return res;
 }
 
@@ -502,21 +496,23 @@ Image spherical_project(const Image& im, float f) {
   int xc = im.w/2;
   int yc = im.h/2;
 
-  for (int j = 0; j < im.h; j++) {
-    for (int i = 0; i < im.w; i++) {
-      float theta = (i - xc)/f;
-      float h = (j - yc)/f;
-      float x_prime = sin(theta) * cos(h);
-      float y_prime = sin(h);
-      float z_prime = cos(theta) * cos(h);
-      float new_x = f * (x_prime/z_prime) + xc;
-      float new_y = f * (y_prime/z_prime) + yc;
-      if (new_x >= 0 && new_x < im.w && new_y >= 0 && new_y < im.h) {
-        res.set_pixel(i, j, 0, im.get_pixel(new_x, new_y, 0));
-        res.set_pixel(i, j, 1, im.get_pixel(new_x, new_y, 1));
-        res.set_pixel(i, j, 2, im.get_pixel(new_x, new_y, 2));
+  parallel_for(0, im.h, 16, [&](int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = 0; i < im.w; i++) {
+        float theta = (i - xc)/f;
+        float h = (j - yc)/f;
+        float x_prime = sin(theta) * cos(h);
+        float y_prime = sin(h);
+        float z_prime = cos(theta) * cos(h);
+        float new_x = f * (x_prime/z_prime) + xc;
+        float new_y = f * (y_prime/z_prime) + yc;
+        if (new_x >= 0 && new_x < im.w && new_y >= 0 && new_y < im.h) {
+          res.set_pixel(i, j, 0, im.get_pixel(new_x, new_y, 0));
+          res.set_pixel(i, j, 1, im.get_pixel(new_x, new_y, 1));
+          res.set_pixel(i, j, 2, im.get_pixel(new_x, new_y, 2));
+        }
       }
     }
-  }
+  });
   return res;
 }
\ No newline at end of file
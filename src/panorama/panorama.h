@@ -125,4 +125,13 @@ Image spherical_project(const Image& im, float f);
 
 
 
+// Find the smallest window of an image that holds all of its non-empty pixels.
+// const Image& a: image to trim.
+// returns: view of the trimmed region sharing the pixels of a.
+ImageView trim_image_view(const Image& a);
+
+
+// Copy the smallest window of an image that holds all of its non-empty pixels.
+// const Image& a: image to trim.
+// returns: new image holding the trimmed region.
 Image trim_image(const Image& a);
\ No newline at end of file
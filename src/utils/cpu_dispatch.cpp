@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+
+#include "cpu_dispatch.h"
+
+using namespace std;
+
+
+static const char* LEVEL_NAMES[] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+
+static CpuLevel probe() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  // the avx512 kernels use F plus the BW/DQ/VL extensions every avx512 cpu we target has
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) return CPU_AVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return CPU_AVX2;
+  if (__builtin_cpu_supports("sse4.2")) return CPU_SSE42;
+#endif
+  return CPU_SCALAR;
+}
+
+
+static CpuLevel env_cap(CpuLevel level) {
+  const char* env = getenv("DDIMG_CPU");
+  if (!env) return level;
+  for (int l = CPU_SCALAR; l <= CPU_AVX512; l++) {
+    if (!strcmp(env, LEVEL_NAMES[l])) return l < level ? (CpuLevel)l : level;
+  }
+  return level;
+}
+
+
+static atomic<int> current_level(-1);
+
+
+CpuLevel cpu_detected_level() {
+  static const CpuLevel detected = probe();
+  return detected;
+}
+
+
+CpuLevel cpu_level() {
+  int level = current_level.load(memory_order_relaxed);
+  if (level < 0) {
+    level = env_cap(cpu_detected_level());
+    current_level = level;
+  }
+  return (CpuLevel)level;
+}
+
+
+void set_cpu_level(CpuLevel level) {
+  current_level = level < cpu_detected_level() ? level : cpu_detected_level();
+}
+
+
+const char* cpu_level_name(CpuLevel level) {
+  return LEVEL_NAMES[level];
+}
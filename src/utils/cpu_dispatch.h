@@ -0,0 +1,26 @@
+// Runtime selection of the widest instruction set the cpu supports
+
+#pragma once
+
+
+// instruction set levels kernels are compiled for, each one implies the ones before it
+enum CpuLevel { CPU_SCALAR, CPU_SSE42, CPU_AVX2, CPU_AVX512 };
+
+
+// The level kernels dispatch on. Probed from cpuid the first time it is asked
+// for and capped by the DDIMG_CPU environment variable (scalar, sse4.2, avx2
+// or avx512) so a slower path can be forced.
+CpuLevel cpu_level();
+
+
+// The level supported by the cpu regardless of any cap.
+CpuLevel cpu_detected_level();
+
+
+// Caps the level kernels dispatch on, a level above what the cpu supports is
+// lowered to the supported one. Used by tests to run every path.
+void set_cpu_level(CpuLevel level);
+
+
+// Human readable name of a level, e.g. "avx2".
+const char* cpu_level_name(CpuLevel level);
@@ -0,0 +1,165 @@
+#include <cstdlib>
+#include <memory>
+#include <algorithm>
+
+#include "thread_pool.h"
+
+using namespace std;
+
+
+// the pool and deque index of the worker running on this thread
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int current_index = -1;
+
+
+static int default_threads() {
+  const char* env = getenv("DDIMG_NUM_THREADS");
+  int n = env ? atoi(env) : 0;
+  if (n <= 0) n = thread::hardware_concurrency();
+  return max(1, n);
+}
+
+
+// MARK: - ThreadPool
+
+ThreadPool::ThreadPool(int n_threads) : pending(0), next_queue(0), stopping(false) {
+  int n_workers = max(1, n_threads) - 1;
+  for (int i = 0; i < n_workers; i++) queues.push_back(new Worker());
+  for (int i = 0; i < n_workers; i++) workers.push_back(thread(&ThreadPool::run, this, i));
+}
+
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(idle_lock);
+    stopping = true;
+  }
+  idle.notify_all();
+  for (auto& worker : workers) worker.join();
+  for (Worker* queue : queues) delete queue;
+}
+
+
+ThreadPool& ThreadPool::instance() {
+  static ThreadPool pool(default_threads());
+  return pool;
+}
+
+
+void ThreadPool::submit(function<void()> task) {
+  if (workers.empty()) {
+    task();
+    return;
+  }
+
+  int index = current_pool == this ? current_index : (int)(next_queue++ % queues.size());
+  {
+    lock_guard<mutex> lock(queues[index]->lock);
+    queues[index]->tasks.push_back(move(task));
+  }
+  {
+    lock_guard<mutex> lock(idle_lock);
+    pending++;
+  }
+  idle.notify_one();
+}
+
+
+bool ThreadPool::pop(int index, function<void()>& task) {
+  // newest task from our own deque first, it is the most likely to be in cache
+  {
+    Worker* own = queues[index];
+    lock_guard<mutex> lock(own->lock);
+    if (!own->tasks.empty()) {
+      task = move(own->tasks.back());
+      own->tasks.pop_back();
+      pending--;
+      return true;
+    }
+  }
+
+  // then the oldest task of any other worker
+  for (size_t i = 1; i < queues.size(); i++) {
+    Worker* victim = queues[(index + i) % queues.size()];
+    lock_guard<mutex> lock(victim->lock);
+    if (!victim->tasks.empty()) {
+      task = move(victim->tasks.front());
+      victim->tasks.pop_front();
+      pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void ThreadPool::run(int index) {
+  current_pool = this;
+  current_index = index;
+
+  for (;;) {
+    function<void()> task;
+    if (pop(index, task)) {
+      task();
+      continue;
+    }
+
+    unique_lock<mutex> lock(idle_lock);
+    idle.wait(lock, [this]() { return stopping || pending > 0; });
+    if (stopping && pending == 0) return;
+  }
+}
+
+
+void ThreadPool::parallel_for(int begin, int end, int grain, const function<void(int, int)>& fn) {
+  if (end <= begin) return;
+  grain = max(1, grain);
+
+  // a few chunks per thread so that threads finishing early can pick up the slack
+  int n = end - begin;
+  int chunks = min((n + grain - 1) / grain, 4 * size());
+  if (chunks <= 1 || workers.empty()) {
+    fn(begin, end);
+    return;
+  }
+
+  // the state outlives this call for helpers that get scheduled after every
+  // chunk has already been taken, they find nothing left and return
+  struct State {
+    atomic<int> next;
+    atomic<int> done;
+    int chunks, begin, n;
+    const function<void(int, int)>* fn;
+    mutex lock;
+    condition_variable finished;
+  };
+  shared_ptr<State> state = make_shared<State>();
+  state->next = 0;
+  state->done = 0;
+  state->chunks = chunks;
+  state->begin = begin;
+  state->n = n;
+  state->fn = &fn;
+
+  auto work = [state]() {
+    for (;;) {
+      int i = state->next++;
+      if (i >= state->chunks) return;
+      int a = state->begin + (int)((long long)state->n * i / state->chunks);
+      int b = state->begin + (int)((long long)state->n * (i + 1) / state->chunks);
+      (*state->fn)(a, b);
+      if (++state->done == state->chunks) {
+        lock_guard<mutex> lock(state->lock);
+        state->finished.notify_all();
+      }
+    }
+  };
+
+  int helpers = min(chunks - 1, (int)workers.size());
+  for (int i = 0; i < helpers; i++) submit(work);
+  work();
+
+  // every chunk is taken, wait for the ones still running on other threads
+  unique_lock<mutex> lock(state->lock);
+  state->finished.wait(lock, [&state]() { return state->done == state->chunks; });
+}
@@ -0,0 +1,131 @@
+// Process wide pool of worker threads shared by the image kernels
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+
+/**
+ * @brief A fixed set of worker threads that lives for the whole process. Every
+ * worker owns a deque of tasks: it pops its own work from the back and when it
+ * runs dry it steals from the front of the other workers' deques. Tasks pushed
+ * from a worker go to its own deque, tasks pushed from any other thread are
+ * spread round robin.
+ *
+ * The number of threads is taken from the DDIMG_NUM_THREADS environment
+ * variable when set, otherwise from the hardware concurrency. The thread that
+ * calls parallel_for always takes part in the work so the pool only starts
+ * size()-1 workers.
+ *
+ */
+class ThreadPool
+{
+
+public:
+
+  /**
+   * @brief Constructs a pool that runs parallel_for on n threads, the calling one included
+   *
+   * @param n_threads total number of threads work is spread over, at least 1
+   */
+  explicit ThreadPool(int n_threads);
+
+
+  /**
+   * @brief Finishes the queued tasks and joins the workers
+   *
+   */
+  ~ThreadPool();
+
+
+  /**
+   * @brief Gets the pool shared by every kernel in the library, it is created on first use
+   *
+   * @return ThreadPool& the process wide pool
+   */
+  static ThreadPool& instance();
+
+
+  /**
+   * @brief the number of threads work is spread over, the calling one included
+   *
+   * @return int the number of threads
+   */
+  int size() const { return (int)workers.size() + 1; }
+
+
+  /**
+   * @brief Queues a task to run on one of the workers
+   *
+   * @param task the task to run
+   */
+  void submit(function<void()> task);
+
+
+  /**
+   * @brief Splits [begin, end) into chunks of at least grain indices and runs
+   * fn(chunk_begin, chunk_end) on every chunk, returning once all chunks are
+   * done. The calling thread runs chunks too so nested calls from inside a
+   * task can't deadlock.
+   *
+   * @param begin first index of the range
+   * @param end one past the last index of the range
+   * @param grain the smallest number of indices worth handing to another thread
+   * @param fn the body, called with a sub range of [begin, end)
+   */
+  void parallel_for(int begin, int end, int grain, const function<void(int, int)>& fn);
+
+private:
+
+  struct Worker {
+    mutex lock;
+    deque<function<void()>> tasks;
+  };
+
+  vector<thread> workers;
+  vector<Worker*> queues;
+
+  mutex idle_lock;
+  condition_variable idle;
+  atomic<int> pending;
+  atomic<unsigned> next_queue;
+  bool stopping;
+
+  void run(int index);
+  bool pop(int index, function<void()>& task);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+};
+
+
+/**
+ * @brief Runs fn over [begin, end) on the shared pool, see ThreadPool::parallel_for
+ *
+ * @param begin first index of the range
+ * @param end one past the last index of the range
+ * @param grain the smallest number of indices worth handing to another thread
+ * @param fn the body, called with a sub range of [begin, end)
+ */
+inline void parallel_for(int begin, int end, int grain, const function<void(int, int)>& fn) {
+  ThreadPool::instance().parallel_for(begin, end, grain, fn);
+}
+
+
+/**
+ * @brief the number of threads the shared pool spreads work over
+ *
+ * @return int the number of threads
+ */
+inline int num_threads() {
+  return ThreadPool::instance().size();
+}
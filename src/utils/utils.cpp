@@ -3,6 +3,7 @@
 #include <cstring>
 
 #include "utils.h"
+#include "../image/inc/kernels.h"
 
 
 float three_way_max(float a, float b, float c) {
@@ -16,7 +17,5 @@ float three_way_min(float a, float b, float c) {
 
 
 float dot_product(const float* a, const float* b, int n) {
-  float sum=0;
-  for(int q1=0;q1<n;q1++)sum+=a[q1]*b[q1];
-  return sum;
+  return kernel_dot(a, b, n);
 }
\ No newline at end of file
@@ -13,7 +13,14 @@ void test_func()
   printf("we got em lads\n");
 }
 
-vector<Image> smooth_frames(vector<Image> input)
+vector<ImageU8> smooth_frames(const vector<ImageU8>& input)
+{
+  vector<ImageU8> output(input.size());
+  smooth_frames(input, [&](int t, ImageU8 frame) { output[t] = move(frame); });
+  return output;
+}
+
+void smooth_frames(const vector<ImageU8>& input, const FrameSink& sink)
 {
   Video video;
   video.input_frames = input;                                            // N frames
@@ -22,7 +29,6 @@ vector<Image> smooth_frames(vector<Image> input)
   video.smoothed_descriptors = vector<vector<Descriptor>>(input.size()); // N lists of smoothed descriptors
   video.timewise_homographies = vector<Matrix>(input.size() - 1);        // N - 1 timewise homographies
   video.smoothing_homographies = vector<Matrix>(input.size());           // N smoothing homographies
-  video.output_frames = vector<Image>(input.size());
 
   // PHASE 1
   // get all features for all frames
@@ -47,18 +53,18 @@ vector<Image> smooth_frames(vector<Image> input)
   printf("computing smoothing homography\n");
   compute_smoothing_homography(video);
 
+  // the frames go to the sink one by one instead of video.output_frames
   printf("smoothing images\n");
-  smooth_images(video);
+  smooth_images(video, sink);
 
   printf("completed\n");
-  return video.output_frames;
 }
 
 void get_features_per_frame(Video &video)
 {
   for (int i = 0; i < video.input_frames.size(); i++)
   {
-    vector<Descriptor> features = harris_corner_detector(video.input_frames[i], 0.7, 0.25, 10, 3, 0); // im, sigma, thresh, window, nms, corner_method
+    vector<Descriptor> features = harris_corner_detector(video.input_frames[i].to_float(), 0.7, 0.25, 10, 3, 0); // im, sigma, thresh, window, nms, corner_method
     video.features[i] = features;
     printf("feature size %lu\n", features.size());
   }
@@ -179,10 +185,17 @@ void compute_smoothing_homography(Video &video)
 }
 
 void smooth_images(Video &video)
+{
+  video.output_frames = vector<ImageU8>(video.input_frames.size());
+  smooth_images(video, [&](int t, ImageU8 frame) { video.output_frames[t] = move(frame); });
+}
+
+void smooth_images(Video &video, const FrameSink& sink)
 {
   for (int t = 0; t < video.input_frames.size(); t++)
   {
-    Image current_frame = video.input_frames[t];
+    // warp on the interleaved form so the three channels of a sample are read together
+    Image current_frame = video.input_frames[t].to_float().to_interleaved();
     Matrix smoothing_homography = video.smoothing_homographies[t];    // from raw to smooth
     Matrix smoothing_homography_inv = smoothing_homography.inverse(); // from smooth to raw
 
@@ -215,7 +228,7 @@ void smooth_images(Video &video)
     int w = max(current_frame.w, (int)botright.x) - dx;
     int h = max(current_frame.h, (int)botright.y) - dy;
 
-    Image output_frame(w, h, current_frame.c);
+    Image output_frame(w, h, current_frame.c, Image::INTERLEAVED);
 
     for (int j = topleft.y; j < botright.y; j++)
     {
@@ -233,6 +246,6 @@ void smooth_images(Video &video)
         }
       }
     }
-    video.output_frames[t] = trim_image(output_frame).bilinear_resize(current_frame.w, current_frame.h);
+    sink(t, ImageU8::from_float(trim_image_view(output_frame).bilinear_resize(current_frame.w, current_frame.h)));
   }
 }
\ No newline at end of file
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <functional>
+
 #include "../image/inc/image.h"
+#include "../image/inc/typed_image.h"
 #include "../feature_detection/feature_detector_types.h"
 #include "../matrix/matrix.h"
 #include "../utils/utils.h"
 
 
+// frames are kept as 8 bit images and only widened to float one at a time
+// while they are being processed
 struct Video {
-  vector<Image> input_frames;
-  vector<Image> output_frames;
+  vector<ImageU8> input_frames;
+  vector<ImageU8> output_frames;
   vector<vector<Descriptor>> features;
   vector<Matrix> timewise_homographies;
   vector<vector<Point>> smoothed_features;
@@ -17,13 +22,20 @@ struct Video {
 };
 
 
+// receives every stabilized frame t as soon as it is warped, in order, so it
+// can be encoded while the next one is worked on
+typedef function<void(int t, ImageU8 frame)> FrameSink;
+
+
 // void test_func();
 void test_func();
 vector<vector<Descriptor>> parse_features();
 vector<vector<Match>> parse_matches();
-vector<Image> smooth_frames(vector<Image> input);
+vector<ImageU8> smooth_frames(const vector<ImageU8>& input);
+void smooth_frames(const vector<ImageU8>& input, const FrameSink& sink);
 void get_features_per_frame(Video& video);
 void compute_timewise_homogrpahies(Video& video);
 void smooth_feature_points(Video& video, float sigma);
 void compute_smoothing_homography(Video& video);
-void smooth_images(Video& video);
\ No newline at end of file
+void smooth_images(Video& video);
+void smooth_images(Video& video, const FrameSink& sink);
\ No newline at end of file
@@ -1,46 +1,49 @@
 #include "video.h"
+#include "../image/inc/image_pool.h"
+#include "../image/inc/image_sequence.h"
+#include "../image/inc/image_writer.h"
+#include "../image/inc/video_stream.h"
+#include <cstdio>
 #include <vector>
 
 using namespace std;
 
+// VideoStabilizer                      frames_train/*.jpg -> smooth_train/*.jpg
+// VideoStabilizer <in> <out> [WxH]     Y4M or rgb24 streams, "-" for stdin/stdout,
+//                                      rgb24 input needs the frame size
 int main(int argc, char **argv) {
-  test_func();
-  vector<Image> test_im(1000); // 1000 for train 973 for car
-  for (int i = 1; i <= 1000; i++) {
-    char filename[26] = "frames_train/frame";
-    char buf[4];
-    sprintf(buf, "%04d", i);
-    filename[18] = buf[0];
-    filename[19] = buf[1];
-    filename[20] = buf[2];
-    filename[21] = buf[3];
-    filename[22] = '.';
-    filename[23] = 'j';
-    filename[24] = 'p';
-    filename[25] = 'g';
-    string fn(filename, 26);
-
-    Image img = load_image(fn);
-    test_im[i - 1] = img;
+  // every frame allocates the same set of pyramid and flow images
+  ImagePool::set_enabled(true);
+
+  if (argc >= 3) {
+    int w = 0, h = 0;
+    if (argc >= 4) sscanf(argv[3], "%dx%d", &w, &h);
+    FrameReader reader(argv[1], w, h);
+    // opened before anything is printed, writing to stdout moves the messages to stderr
+    FrameWriter writer(argv[2], stream_format_for(argv[2]), reader.fps_num(), reader.fps_den());
+
+    vector<ImageU8> frames;
+    ImageU8 frame;
+    while (reader.read(frame)) frames.push_back(move(frame));
+    printf("read %d frames\n", (int)frames.size());
+
+    // every frame is written as soon as it is stabilized
+    smooth_frames(frames, [&](int, ImageU8 im) { writer.write(im); });
+    return 0;
   }
+
+  test_func();
+  // 1000 for train 973 for car
+  vector<ImageU8> test_im = load_image_sequence_u8("frames_train/frame%04d.jpg", FrameRange(1, 1001));
   printf("loading images complete\n");
 
-  vector<Image> output = smooth_frames(test_im);
-  for (int i = 0; i < output.size(); i++) {
-    char filename[26] = "smooth_train/frame";
-    char buf[4];
-    sprintf(buf, "%04d", i);
-    filename[18] = buf[0];
-    filename[19] = buf[1];
-    filename[20] = buf[2];
-    filename[21] = buf[3];
-    filename[22] = '.';
-    filename[23] = 'j';
-    filename[24] = 'p';
-    filename[25] = 'g';
-    string fn(filename, 26);
-    save_image(output[i], filename);
-  }
+  // encoding runs in the background while the next frame is warped, the frames
+  // are moved into the queue as they come out
+  ImageWriter writer;
+  smooth_frames(test_im, [&](int t, ImageU8 im) {
+    writer.save_image(move(im), sequence_filename("smooth_train/frame%04d", t));
+  });
+  writer.flush();
 
   test_func();
   return 0;
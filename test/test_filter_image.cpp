@@ -1,5 +1,8 @@
 #include "test_common.h"
 #include "../src/image/inc/filter_image.h"
+#include "../src/image/inc/fft.h"
+#include "../src/image/inc/integral_image.h"
+#include "../src/utils/cpu_dispatch.h"
 
 using namespace std;
 
@@ -117,6 +120,42 @@ void test_frequency_image() {
 }
 
 
+void test_image_expressions() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  Image f = make_gaussian_filter(2);
+  Image lfreq = convolve_image(im, f, 1);
+  
+  // a fused chain matches the same steps done one image at a time
+  Image fused = ((im - lfreq) * 2.f + 0.5f).clamp();
+  Image steps = sub_image(im, lfreq);
+  steps.scale(0, 2.f); steps.scale(1, 2.f); steps.scale(2, 2.f);
+  steps.shift(0, .5f); steps.shift(1, .5f); steps.shift(2, .5f);
+  steps.clamp();
+  TEST((fused == steps));
+  
+  Image diff = (lfreq - im).abs();
+  Image gt_diff = sub_image(lfreq, im).abs();
+  TEST((diff == gt_diff));
+  
+  // in place updates may read the image they write
+  Image acc = im;
+  acc += lfreq;
+  acc -= im;
+  TEST((acc == lfreq));
+  acc *= 0.f;
+  Image zero(im.w, im.h, im.c);
+  TEST((acc == zero));
+  
+  // mixed layouts take the per pixel path
+  Image il = load_image("data/dog.jpg", Image::INTERLEAVED);
+  Image mixed = il - lfreq;
+  Image gt_mixed = im - lfreq;
+  TEST(mixed.layout == Image::INTERLEAVED);
+  TEST((mixed == gt_mixed));
+}
+
+
 void test_sobel() {
   printf("%s\n", __func__);
   Image im = load_image("data/dog.jpg");
@@ -166,15 +205,255 @@ void test_bilateral() {
 }
 
 
+// the plain per pixel cross correlation convolve_image has to match exactly
+static Image reference_convolve(const Image& im, const Image& filter, int preserve) {
+  Image ret(im.w, im.h, preserve ? im.c : 1);
+  for (int c = 0; c < im.c; c++) for (int y = 0; y < im.h; y++) for (int x = 0; x < im.w; x++) {
+    for (int j = 0; j < filter.h; j++) for (int i = 0; i < filter.w; i++) {
+      float value = filter.get_pixel(i, j, 0) * im.get_pixel(x + (i - filter.w/2), y + (j - filter.h/2), c);
+      ret(x, y, preserve ? c : 0) = ret(x, y, preserve ? c : 0) + value;
+    }
+  }
+  return ret;
+}
+
+
+static bool same_image(const Image& a, const Image& b) {
+  if (a.w != b.w || a.h != b.h || a.c != b.c) return false;
+  for (int ch = 0; ch < a.c; ch++) for (int y = 0; y < a.h; y++) for (int x = 0; x < a.w; x++) if (a(x, y, ch) != b(x, y, ch)) return false;
+  return true;
+}
+
+
+void test_convolve_engine() {
+  printf("%s\n", __func__);
+  Image dog = load_image("data/dog.jpg");
+  Image im(dog.crop(100, 50, 157, 61));
+  Image dog_inter = load_image("data/dog.jpg", Image::INTERLEAVED);
+  ImageView inter = dog_inter.crop(100, 50, 157, 61);
+  Image narrow(dog.crop(0, 0, 5, 9));
+  Image uneven(4, 6, 1);
+  for (int j = 0; j < uneven.h; j++) for (int i = 0; i < uneven.w; i++) uneven(i, j, 0) = 0.1f*i - 0.07f*j + 0.013f*i*j;
+  Image row = make_1d_gaussian(1.5f);
+  Image col(1, row.w, 1);
+  for (int j = 0; j < row.w; j++) col(0, j, 0) = row(j, 0, 0);
+  Image filters[] = {make_box_filter(7), make_emboss_filter(), make_gaussian_filter(2), make_gx_filter(), uneven, row, col};
+
+  CpuLevel level = cpu_level();
+  bool same = true;
+  for (int lv = CPU_SCALAR; lv <= cpu_detected_level(); lv++) {
+    set_cpu_level((CpuLevel)lv);
+    for (Image& f : filters) for (int preserve = 0; preserve < 2; preserve++) {
+      same = same && same_image(convolve_image_direct(im, f, preserve), reference_convolve(im, f, preserve));
+      same = same && same_image(convolve_image_direct(inter, f, preserve), reference_convolve(im, f, preserve));
+      same = same && same_image(convolve_image_direct(narrow, f, preserve), reference_convolve(narrow, f, preserve));
+    }
+  }
+  set_cpu_level(level);
+  TEST(same);
+}
+
+
+void test_separable_filters() {
+  printf("%s\n", __func__);
+  vector<vector<float>> cols, rows;
+  TEST(separate_filter(make_gaussian_filter(2), cols, rows) == 1 && cols[0].size() == 13 && rows[0].size() == 13);
+  TEST(separate_filter(make_gx_filter(), cols, rows) == 1);
+  TEST(separate_filter(make_box_filter(5), cols, rows) == 1);
+  TEST(separate_filter(make_highpass_filter(), cols, rows) == 2);
+  TEST(separate_filter(Image(3, 3, 1), cols, rows) == 0);
+
+  // a sum of two separable filters is rank 2
+  Image f(9, 7, 1);
+  for (int j = 0; j < f.h; j++) for (int i = 0; i < f.w; i++) f(i, j, 0) = sinf(0.3f*i)*cosf(0.2f*j) + 0.5f*(i - 4)*(j - 3)/12.f;
+  TEST(separate_filter(f, cols, rows) == 2);
+  float worst = 0;
+  for (int j = 0; j < f.h; j++) for (int i = 0; i < f.w; i++) worst = max(worst, fabsf(cols[0][j]*rows[0][i] + cols[1][j]*rows[1][i] - f(i, j, 0)));
+  TEST(worst < 1e-5f);
+
+  // separated filters agree with applying every tap
+  Image im = load_image("data/dog.jpg");
+  Image filters[] = {make_gaussian_filter(2), make_gy_filter(), make_box_filter(7), f};
+  for (Image& filter : filters) {
+    for (int preserve = 0; preserve < 2; preserve++) {
+      Image separated = convolve_image(im, filter, preserve);
+      Image direct = convolve_image_direct(im, filter, preserve);
+      TEST((separated == direct));
+    }
+  }
+}
+
+
+void test_fft() {
+  printf("%s\n", __func__);
+  TEST(fft_good_size(1) == 1 && fft_good_size(7) == 8 && fft_good_size(97) == 100 && fft_good_size(121) == 125);
+  TEST(fft_plan(60) == fft_plan(60) && fft_plan(60)->size() == 60);
+
+  // every size up to 100 with a factor of 2, 3 or 5 against a plain dft
+  float worst = 0;
+  for (int n = 1; n <= 100; n++) {
+    if (fft_good_size(n) != n) continue;
+    vector<complex<float>> in(2*n), out(n), back(n);
+    for (int k = 0; k < 2*n; k++) in[k] = complex<float>(sinf(0.7f*k) + 0.1f*k, cosf(1.3f*k));
+    fft_plan(n)->transform(out.data(), in.data(), 2);
+    for (int k = 0; k < n; k++) {
+      complex<double> sum = 0;
+      for (int j = 0; j < n; j++) sum += complex<double>(in[2*j]) * polar(1.0, -2*M_PI*j*k/n);
+      worst = max(worst, (float)abs(sum - complex<double>(out[k]))/n);
+    }
+    fft_plan(n)->transform(back.data(), out.data(), 1, true);
+    for (int k = 0; k < n; k++) worst = max(worst, abs(back[k]/(float)n - in[2*k]));
+  }
+  TEST(worst < 1e-5f);
+
+  // a filter with too many taps to separate cheaply agrees with applying every tap
+  Image dog = load_image("data/dog.jpg");
+  Image im(dog.crop(40, 30, 300, 170));
+  Image dog_inter = load_image("data/dog.jpg", Image::INTERLEAVED);
+  ImageView inter = dog_inter.crop(40, 30, 300, 170);
+  Image small(dog.crop(0, 0, 9, 14));
+  Image odd(31, 29, 1), even(26, 18, 1);
+  for (Image* f : {&odd, &even}) {
+    for (int j = 0; j < f->h; j++) for (int i = 0; i < f->w; i++) (*f)(i, j, 0) = sinf(0.9f*i*j + 0.3f*i) + 0.2f*cosf(1.7f*j);
+    f->l1_normalize();
+  }
+  for (Image* f : {&odd, &even}) for (int preserve = 0; preserve < 2; preserve++) {
+    Image direct = convolve_image_direct(im, *f, preserve);
+    Image fft = convolve_image_fft(im, *f, preserve);
+    Image fft_inter = convolve_image_fft(inter, *f, preserve);
+    Image small_direct = convolve_image_direct(small, *f, preserve);
+    Image small_fft = convolve_image_fft(small, *f, preserve);
+    TEST((fft == direct));
+    TEST((fft_inter == direct));
+    TEST((small_fft == small_direct));
+  }
+  Image picked = convolve_image(im, odd, 1);
+  Image fft = convolve_image_fft(im, odd, 1);
+  TEST(same_image(picked, fft));
+}
+
+
+void test_recursive_gaussian() {
+  printf("%s\n", __func__);
+  // the impulse response is close to the sampled Gaussian at small and large sigmas
+  for (float sigma : {0.5f, 1.5f, 6.f, 18.f}) {
+    Image impulse(121, 121, 1);
+    impulse(60, 60, 0) = 1;
+    Image iir = recursive_smooth_image(impulse, sigma);
+    Image fir = fast_smooth_image(impulse, sigma, SMOOTH_FIR);
+    float worst = 0;
+    for (int y = 0; y < fir.h; y++) for (int x = 0; x < fir.w; x++) worst = max(worst, fabsf(iir(x, y, 0) - fir(x, y, 0)));
+    TEST(worst < 0.01f*fir(60, 60, 0));
+  }
+
+  // clamped borders keep a flat image flat
+  Image flat(40, 30, 2);
+  for (int c = 0; c < flat.c; c++) for (int y = 0; y < flat.h; y++) for (int x = 0; x < flat.w; x++) flat(x, y, c) = 0.25f + 0.5f*c;
+  Image smoothed_flat = recursive_smooth_image(flat, 10);
+  float drift = 0;
+  for (int c = 0; c < flat.c; c++) for (int y = 0; y < flat.h; y++) for (int x = 0; x < flat.w; x++) drift = max(drift, fabsf(smoothed_flat(x, y, c) - flat(x, y, c)));
+  TEST(drift < 1e-5f);
+
+  // the same on every cpu and for an interleaved image, close to the taps
+  Image dog = load_image("data/dog.jpg");
+  Image dog_inter = load_image("data/dog.jpg", Image::INTERLEAVED);
+  CpuLevel level = cpu_level();
+  set_cpu_level(CPU_SCALAR);
+  Image scalar = recursive_smooth_image(dog, 4);
+  bool same = true;
+  for (int lv = CPU_SCALAR; lv <= cpu_detected_level(); lv++) {
+    set_cpu_level((CpuLevel)lv);
+    same = same && same_image(recursive_smooth_image(dog, 4), scalar);
+    same = same && same_image(recursive_smooth_image(dog_inter, 4), scalar);
+  }
+  set_cpu_level(level);
+  TEST(same);
+  Image fir = fast_smooth_image(dog, 4, SMOOTH_FIR);
+  TEST((scalar == fir));
+  Image blurred = smooth_image(dog, 4, SMOOTH_IIR);
+  Image blurred_fir = smooth_image(dog, 4, SMOOTH_FIR);
+  TEST((blurred == blurred_fir));
+
+  // SMOOTH_AUTO only takes the recursive filter for large sigmas
+  TEST(same_image(fast_smooth_image(dog, 4), scalar));
+  TEST(same_image(fast_smooth_image(dog, 1), fast_smooth_image(dog, 1, SMOOTH_FIR)));
+}
+
+
+void test_integral_image() {
+  printf("%s\n", __func__);
+  Image dog = load_image("data/dog.jpg");
+  Image im(dog.crop(30, 20, 90, 150));
+  Image dog_inter = load_image("data/dog.jpg", Image::INTERLEAVED);
+  ImageView inter = dog_inter.crop(30, 20, 90, 150);
+
+  // rectangles anywhere in the padded table against adding up get_pixel
+  IntegralImage sums(im, 5);
+  IntegralImage inter_sums(inter, 5);
+  TEST(sums.w == im.w && sums.h == im.h && sums.c == im.c && sums.pad == 5);
+  double worst = 0;
+  bool same = true;
+  for (int k = 0; k < 200; k++) {
+    int x0 = rand() % (im.w + 10) - 5, x1 = rand() % (im.w + 11) - 5;
+    int y0 = rand() % (im.h + 10) - 5, y1 = rand() % (im.h + 11) - 5;
+    int ch = rand() % im.c;
+    double expected = 0;
+    for (int y = y0; y < y1; y++) for (int x = x0; x < x1; x++) expected += im.get_pixel(x, y, ch);
+    worst = max(worst, fabs(sums.box_sum(x0, y0, x1, y1, ch) - expected));
+    same = same && sums.box_sum(x0, y0, x1, y1, ch) == inter_sums.box_sum(x0, y0, x1, y1, ch);
+  }
+  TEST(worst < 1e-9);
+  TEST(same);
+
+  // patch checks agree with looking at every pixel
+  Image sparse(50, 40, 2);
+  for (int k = 0; k < 6; k++) sparse(rand() % sparse.w, rand() % sparse.h, rand() % 2) = k % 2 ? 1.f : -1.f;
+  IntegralImage counts = IntegralImage::nonzero(sparse);
+  bool agree = true;
+  for (int y = -3; y < sparse.h + 3; y++) for (int x = -3; x < sparse.w + 3; x++) for (int r : {0, 1, 4}) {
+    agree = agree && counts.is_nonempty_patch(x, y, r) == sparse.is_nonempty_patch(x, y, r);
+  }
+  TEST(agree);
+
+  // box filters of any shape against applying every tap
+  Image wide(7, 2, 1);
+  for (int j = 0; j < wide.h; j++) for (int i = 0; i < wide.w; i++) wide(i, j, 0) = 1.f/14;
+  Image boxes[] = {make_box_filter(3), make_box_filter(4), wide};
+  for (Image& f : boxes) {
+    Image direct = convolve_image_direct(im, f, 1);
+    Image box = box_filter_image(im, f.w, f.h);
+    Image box_inter = box_filter_image(inter, f.w, f.h);
+    TEST((box == direct));
+    TEST((box_inter == direct));
+  }
+
+  // convolve_image takes large boxes through the table
+  Image large = make_box_filter(17);
+  Image doubled(15, 15, 1);
+  for (int j = 0; j < doubled.h; j++) for (int i = 0; i < doubled.w; i++) doubled(i, j, 0) = 0.01f;
+  for (Image* f : {&large, &doubled}) for (int preserve = 0; preserve < 2; preserve++) {
+    Image picked = convolve_image(im, *f, preserve);
+    Image direct = convolve_image_direct(im, *f, preserve);
+    TEST((picked == direct));
+  }
+}
+
+
 void run_tests() {
   test_gaussian_filter();
   test_sharpen_filter();
   test_emboss_filter();
   test_highpass_filter();
   test_convolution();
+  test_convolve_engine();
+  test_separable_filters();
+  test_fft();
+  test_recursive_gaussian();
+  test_integral_image();
   test_gaussian_blur();
   test_hybrid_image();
   test_frequency_image();
+  test_image_expressions();
   test_sobel();
   test_bilateral();
 
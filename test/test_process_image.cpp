@@ -1,4 +1,20 @@
+#include <atomic>
+#include <thread>
+
 #include "test_common.h"
+#include "../src/image/inc/typed_image.h"
+#include "../src/image/inc/image_pool.h"
+#include "../src/utils/thread_pool.h"
+#include "../src/utils/cpu_dispatch.h"
+#include "../src/image/inc/pointwise.h"
+#include "../src/image/inc/kernels.h"
+#include "../src/image/inc/filter_image.h"
+#include "../src/image/inc/image_file.h"
+#include "../src/image/inc/image_sequence.h"
+#include "../src/image/inc/image_writer.h"
+#include "../src/image/inc/video_stream.h"
+#include "../src/image/inc/image_formats.h"
+#include "../src/colourspace/colourspaces.h"
 
 using namespace std;
 
@@ -55,6 +71,703 @@ void test_copy() {
 }
 
 
+void test_padded() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  Image p(im.w, im.h, im.c, true);
+  for (int ch = 0; ch < im.c; ch++) p.set_channel(ch, im.get_channel(ch));
+  TEST(p.stride % (Image::ALIGNMENT/sizeof(float)) == 0 && p.stride >= p.w);
+  TEST(((size_t)p.RowPtr(p.h-1, p.c-1)) % Image::ALIGNMENT == 0);
+  TEST((p == im));
+  
+  Image c = p;
+  TEST(c.stride == p.stride);
+  TEST((c == im));
+  
+  Image t = p.transpose().transpose();
+  TEST((t == im));
+  
+  save_png(p, "output/padded-dog");
+  Image s = load_image("output/padded-dog.png");
+  TEST((s == im));
+}
+
+
+void test_view() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  ImageView crop = im.crop(10, 20, 64, 48);
+  TEST(crop.data == &im(10, 20, 0));
+  TEST(within_eps(crop.get_pixel(5, 7, 2), im(15, 27, 2)));
+  TEST(within_eps(crop.get_pixel(-3, 100, 1), im(10, 67, 1)));
+  
+  Image copy(crop);
+  TEST(copy.w == 64 && copy.h == 48 && copy.c == im.c);
+  TEST(within_eps(copy(63, 47, 1), im(73, 67, 1)));
+  
+  Image resized = crop.bilinear_resize(128, 96);
+  Image gt = copy.bilinear_resize(128, 96);
+  TEST((resized == gt));
+  
+  Image green = im.get_channel(1);
+  Image green_view(im.channel(1));
+  TEST((green_view == green));
+  
+  Image pasted(im.w, im.h, im.c);
+  pasted.paste(crop, 10, 20);
+  TEST(within_eps(pasted(40, 40, 2), im(40, 40, 2)));
+  TEST(within_eps(pasted(0, 0, 0), 0));
+}
+
+
+void test_typed_images() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  ImageU8 u8 = load_image_u8("data/dog.jpg");
+  TEST(u8.w == im.w && u8.h == im.h && u8.c == im.c);
+  Image widened = u8.to_float();
+  TEST((widened == im));
+  TEST(ImageU8::from_float(im).data == u8.data);
+  
+  Image gray = rgb_to_grayscale(u8);
+  Image gt_gray = im.rgb_to_grayscale();
+  TEST((gray == gt_gray));
+  
+  Image resized = bilinear_resize(u8, 713, 467);
+  Image gt_resized = im.bilinear_resize(713, 467);
+  TEST((resized == gt_resized));
+  
+  Image from_half = convert_image<half>(u8).to_float();
+  Image from_u16 = ImageU16::from_float(im).to_float();
+  TEST((from_half == im));
+  TEST((from_u16 == im));
+  
+  TEST(half_to_float(float_to_half(1.f)) == 1.f);
+  TEST(half_to_float(float_to_half(-0.333251953125f)) == -0.333251953125f);
+  TEST(half_to_float(float_to_half(65504.f)) == 65504.f);
+  TEST(isinf(half_to_float(float_to_half(1e6f))));
+  TEST(half_to_float(float_to_half(5.9604645e-8f)) == 5.9604645e-8f);
+}
+
+
+void test_interleaved() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  Image il = load_image("data/dog.jpg", Image::INTERLEAVED);
+  TEST(il.layout == Image::INTERLEAVED && il.pixel_stride() == 3 && il.channel_stride() == 1);
+  TEST((il == im));
+  TEST(within_eps(il.data[3*(7*il.w + 5) + 2], im(5, 7, 2)));
+  
+  Image converted = im.to_interleaved();
+  TEST((converted == im));
+  Image back = converted.to_planar();
+  TEST(back.layout == Image::PLANAR);
+  TEST((back == im));
+  
+  Image t = il.transpose();
+  TEST(t.layout == Image::INTERLEAVED);
+  Image gt_t = im.transpose();
+  TEST((t == gt_t));
+  
+  Image resized = il.bilinear_resize(713, 467);
+  TEST(resized.layout == Image::INTERLEAVED);
+  Image gt_resized = im.bilinear_resize(713, 467);
+  TEST((resized == gt_resized));
+  
+  Image green(il.channel(1));
+  Image gt_green = im.get_channel(1);
+  Image il_green = il.get_channel(1);
+  TEST((green == gt_green));
+  TEST((il_green == gt_green));
+  
+  Image hsv = il;
+  hsv.RGBtoHSV();
+  Image gt = load_image("data/dog.hsv.png");
+  TEST((hsv == gt));
+  
+  save_png(il, "output/interleaved-dog");
+  Image saved = load_image("output/interleaved-dog.png");
+  TEST((saved == im));
+}
+
+
+void test_image_pool() {
+  printf("%s\n", __func__);
+  ImagePool::set_enabled(true);
+  TEST(ImagePool::cached_bytes() == 0);
+  
+  float* first;
+  {
+    Image a(640, 480, 3);
+    first = a.data;
+  }
+  TEST(ImagePool::cached_bytes() == ImagePool::bucket_size(640*480*3*sizeof(float)));
+  
+  // a slightly smaller image falls in the same bucket and gets the same buffer back
+  Image b = Image::uninitialized(639, 480, 3);
+  TEST(b.data == first);
+  TEST(ImagePool::cached_bytes() == 0);
+  
+  // recycled buffers are still zero'd for regular construction
+  b.data[0] = 1;
+  b = Image();
+  Image c(639, 480, 3);
+  TEST(c.data == first && c.data[0] == 0);
+  
+  Image im = load_image("data/dog.jpg");
+  Image copy = im;
+  Image gt = load_image("data/dog.jpg");
+  TEST((copy == gt));
+  
+  ImagePool::set_enabled(false);
+  TEST(ImagePool::cached_bytes() == 0);
+  
+  // another thread drops what it parked once the pool is trimmed, and frees
+  // its cache on exit instead of handing it over while the pool is off
+  ImagePool::set_enabled(true);
+  atomic<int> stage(0);
+  size_t parked = 0, trimmed = 1;
+  thread worker([&]() {
+    { Image a(64, 64, 1); }
+    parked = ImagePool::cached_bytes();
+    stage = 1;
+    while (stage != 2) this_thread::yield();
+    trimmed = ImagePool::cached_bytes();
+    { Image a(64, 64, 1); }
+    stage = 3;
+    while (stage != 4) this_thread::yield();
+  });
+  while (stage != 1) this_thread::yield();
+  ImagePool::trim();
+  stage = 2;
+  while (stage != 3) this_thread::yield();
+  ImagePool::set_enabled(false);
+  stage = 4;
+  worker.join();
+  TEST(parked == ImagePool::bucket_size(64*64*sizeof(float)) && trimmed == 0);
+  ImagePool::set_enabled(true);
+  TEST(ImagePool::cached_bytes() == 0);
+  ImagePool::set_enabled(false);
+}
+
+
+void test_parallel_for() {
+  printf("%s\n", __func__);
+  TEST(num_threads() >= 1);
+  
+  // every index is visited exactly once
+  vector<int> hits(10007, 0);
+  parallel_for(0, (int)hits.size(), 64, [&](int a, int b) {
+    for (int i = a; i < b; i++) hits[i]++;
+  });
+  bool once = true;
+  for (int v : hits) once = once && v == 1;
+  TEST(once);
+  
+  // nested calls from inside a task finish without deadlocking
+  vector<int> rows(64, 0);
+  parallel_for(0, 64, 1, [&](int a, int b) {
+    for (int r = a; r < b; r++) {
+      vector<int> cols(256, 0);
+      parallel_for(0, 256, 16, [&](int c0, int c1) { for (int c = c0; c < c1; c++) cols[c] = c; });
+      int sum = 0;
+      for (int c : cols) sum += c;
+      rows[r] = sum;
+    }
+  });
+  bool nested = true;
+  for (int v : rows) nested = nested && v == 255*256/2;
+  TEST(nested);
+  
+  // a threaded kernel matches its result at any split
+  Image im = load_image("data/dog.jpg");
+  Image t = im.transpose().transpose();
+  TEST((t == im));
+}
+
+
+void test_pointwise() {
+  printf("%s\n", __func__);
+  // odd length so every vector width leaves a tail
+  const int n = 1001;
+  vector<float> src(n);
+  for (int i = 0; i < n; i++) src[i] = sinf(i*0.37f) * 3.f;
+  
+  for (int level = CPU_SCALAR; level <= cpu_detected_level(); level++) {
+    set_cpu_level((CpuLevel)level);
+    TEST(cpu_level() == level);
+    
+    vector<float> p = src;
+    pointwise_add(p.data(), n, 1.5f);
+    bool add = true;
+    for (int i = 0; i < n; i++) add = add && p[i] == src[i] + 1.5f;
+    TEST(add);
+    
+    pointwise_clamp(p.data(), n, 0.f, 1.f);
+    bool clamped = true;
+    for (int i = 0; i < n; i++) clamped = clamped && p[i] == fmaxf(0.f, fminf(1.f, src[i] + 1.5f));
+    TEST(clamped);
+    
+    pointwise_abs(p.data(), src.data(), n);
+    bool abs = true;
+    for (int i = 0; i < n; i++) abs = abs && p[i] == fabsf(src[i]);
+    TEST(abs);
+    
+    float min, max;
+    pointwise_min_max(src.data() + 3, n - 3, &min, &max);
+    float gt_min = src[3], gt_max = src[3];
+    for (int i = 3; i < n; i++) { gt_min = fminf(gt_min, src[i]); gt_max = fmaxf(gt_max, src[i]); }
+    TEST(min == gt_min && max == gt_max);
+    
+    double gt_sum = 0;
+    for (int i = 0; i < n; i++) gt_sum += src[i];
+    TEST(fabs(pointwise_sum(src.data(), n) - gt_sum) < 1e-3);
+    
+    Image im = load_image("data/dog.jpg");
+    im.shift(1, -.4);
+    im.scale(2, 2);
+    im.feature_normalize();
+    Image il = load_image("data/dog.jpg", Image::INTERLEAVED);
+    il.shift(1, -.4);
+    il.scale(2, 2);
+    il.feature_normalize();
+    TEST((im == il));
+    float lo, hi;
+    pointwise_min_max(im.RowPtr(0, 1), im.w*im.h, &lo, &hi);
+    TEST(within_eps(lo, 0) && within_eps(hi, 1));
+  }
+  set_cpu_level(cpu_detected_level());
+}
+
+
+// exact comparison, the vectorized kernels must not change a single bit
+static bool same_pixels(const Image& a, const Image& b) {
+  if (a.w != b.w || a.h != b.h || a.c != b.c) return false;
+  for (int ch = 0; ch < a.c; ch++) for (int y = 0; y < a.h; y++) for (int x = 0; x < a.w; x++) {
+    if (a.get_pixel(x, y, ch) != b.get_pixel(x, y, ch)) return false;
+  }
+  return true;
+}
+
+
+void test_kernels() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  Image il = load_image("data/dog.jpg", Image::INTERLEAVED);
+  Image f = make_gaussian_filter(2);
+  
+  // strided views take the generic loops, which are the reference
+  Image conv_ref = convolve_image(il.view(), f, 1);
+  Image resize_ref = il.bilinear_resize(331, 217);
+  
+  set_cpu_level(CPU_SCALAR);
+  Image load_ref = load_image("data/dog.jpg");
+  Image gray_ref = im.rgb_to_grayscale();
+  Image hsv_ref = im;
+  hsv_ref.RGBtoHSV();
+  Image rgb_ref = hsv_ref;
+  rgb_ref.HSVtoRGB();
+  Image transpose_ref = im.transpose();
+  
+  // the kernel keeps every branch of hsv2rgb, hues on the sector edges included
+  Image edges(13, 1, 3);
+  for (int x = 0; x < 13; x++) {
+    edges(x, 0, 0) = x/12.f;
+    edges(x, 0, 1) = 0.75f;
+    edges(x, 0, 2) = 0.5f;
+  }
+  Image edges_ref = edges;
+  for (int x = 0; x < 13; x++) {
+    RGBcolour rgb = hsv2rgb({edges(x, 0, 0), edges(x, 0, 1), edges(x, 0, 2)});
+    edges_ref(x, 0, 0) = rgb.r;
+    edges_ref(x, 0, 1) = rgb.g;
+    edges_ref(x, 0, 2) = rgb.b;
+  }
+  
+  for (int level = CPU_SCALAR; level <= cpu_detected_level(); level++) {
+    set_cpu_level((CpuLevel)level);
+    TEST(same_pixels(load_image("data/dog.jpg"), load_ref));
+    TEST(same_pixels(load_image("data/dog.jpg", Image::INTERLEAVED), load_ref));
+    TEST(same_pixels(convolve_image(im, f, 1), conv_ref));
+    TEST(same_pixels(im.bilinear_resize(331, 217), resize_ref));
+    TEST(same_pixels(im.rgb_to_grayscale(), gray_ref));
+    Image hsv = im;
+    hsv.RGBtoHSV();
+    TEST(same_pixels(hsv, hsv_ref));
+    hsv.HSVtoRGB();
+    TEST(same_pixels(hsv, rgb_ref));
+    Image edges_rgb = edges;
+    edges_rgb.HSVtoRGB();
+    TEST(same_pixels(edges_rgb, edges_ref));
+    
+    // interleaved rows go through the same kernels
+    TEST(same_pixels(il.rgb_to_grayscale(), gray_ref));
+    Image il_hsv = il;
+    il_hsv.RGBtoHSV();
+    TEST(il_hsv.layout == Image::INTERLEAVED && same_pixels(il_hsv, hsv_ref));
+    il_hsv.HSVtoRGB();
+    TEST(same_pixels(il_hsv, rgb_ref));
+    TEST(same_pixels(im.transpose(), transpose_ref));
+    
+    vector<float> a(203), b(203);
+    for (int i = 0; i < 203; i++) { a[i] = sinf(i*0.1f); b[i] = cosf(i*0.3f); }
+    double gt_dot = 0, gt_l1 = 0;
+    for (int i = 0; i < 203; i++) { gt_dot += a[i]*b[i]; gt_l1 += fabs(a[i] - b[i]); }
+    TEST(fabs(kernel_dot(a.data(), b.data(), 203) - gt_dot) < 1e-3);
+    TEST(fabs(kernel_l1_distance(a.data(), b.data(), 203) - gt_l1) < 1e-3);
+    
+    // halfway cases and values outside [0, 1] round and wrap like the scalar cast
+    vector<float> v(601);
+    for (int i = 0; i < 601; i++) v[i] = (i - 50)/510.f;
+    vector<uint8_t> bytes(601), planar(3*200);
+    kernel_float_to_u8(bytes.data(), v.data(), 601);
+    const float* planes[3] = {v.data(), v.data() + 200, v.data() + 400};
+    kernel_float_interleave_u8(planar.data(), 3, planes, 200);
+    bool rounded = true;
+    for (int i = 0; i < 601; i++) rounded = rounded && bytes[i] == (unsigned char)roundf(255*v[i]);
+    for (int i = 0; i < 200; i++) for (int k = 0; k < 3; k++) rounded = rounded && planar[i*3 + k] == (unsigned char)roundf(255*planes[k][i]);
+    TEST(rounded);
+  }
+  set_cpu_level(cpu_detected_level());
+}
+
+
+void test_image_file() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  Image padded(im.w, im.h, im.c, true);
+  for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < im.h; y++) for (int x = 0; x < im.w; x++) padded(x, y, ch) = im(x, y, ch);
+  Image il = load_image("data/dog.jpg", Image::INTERLEAVED);
+  
+  im.save("output/dog.bin");
+  padded.save("output/dog-padded.bin");
+  il.save("output/dog-interleaved.bin");
+  
+  Image loaded = Image::load("output/dog.bin");
+  TEST(same_pixels(loaded, im));
+  Image loaded_padded = Image::load("output/dog-padded.bin");
+  TEST(same_pixels(loaded_padded, im) && loaded_padded.stride == padded.stride);
+  Image loaded_il = Image::load("output/dog-interleaved.bin");
+  TEST(same_pixels(loaded_il, im) && loaded_il.layout == Image::INTERLEAVED);
+  
+  MappedImage mapped("output/dog-padded.bin");
+  TEST(mapped.valid() && mapped.header().version == IMAGE_FILE_VERSION);
+  ImageView v = mapped.view();
+  TEST(((uintptr_t)v.data % Image::ALIGNMENT) == 0 && v.stride == padded.stride);
+  TEST(same_pixels(mapped.copy(), im));
+  v(0, 0, 0) = 5;
+  TEST(Image::load("output/dog-padded.bin")(0, 0, 0) == im(0, 0, 0));
+  
+  MappedImage mapped_il("output/dog-interleaved.bin");
+  TEST(same_pixels(mapped_il.copy(), im) && mapped_il.view().pstride == 3);
+  
+  // files from before the header still load
+  FILE* fn = fopen("output/dog-legacy.bin", "wb");
+  fwrite(&im.w, sizeof(int), 1, fn);
+  fwrite(&im.h, sizeof(int), 1, fn);
+  fwrite(&im.c, sizeof(int), 1, fn);
+  fwrite(im.data, sizeof(float), im.size(), fn);
+  fclose(fn);
+  TEST(same_pixels(Image::load("output/dog-legacy.bin"), im));
+
+  // headers whose geometry doesn't fit the pixels they come with
+  ImageFileHeader hd;
+  fn = fopen("output/dog-padded.bin", "rb");
+  TEST(fread(&hd, sizeof(hd), 1, fn) == 1);
+  fclose(fn);
+  const uint64_t file_bytes = hd.data_offset + hd.data_bytes;
+  TEST(image_file_problem(hd, file_bytes) == nullptr);
+  TEST(image_file_problem(hd, file_bytes - 4) != nullptr);
+  ImageFileHeader bad = hd;
+  bad.stride = hd.w - 1;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+  bad = hd;
+  bad.cstride = (uint64_t)hd.h*hd.stride - 1;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+  bad = hd;
+  bad.h = hd.h + 1;
+  bad.cstride = (uint64_t)bad.h*hd.stride;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+  bad = hd;
+  bad.c = 4;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+  bad = hd;
+  bad.cstride = ~(uint64_t)0/2;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+  bad = hd;
+  bad.data_offset = ~(uint64_t)0 - 63;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+  bad = hd;
+  bad.layout = Image::INTERLEAVED;
+  TEST(image_file_problem(bad, file_bytes) != nullptr);
+}
+
+
+void test_image_sequence() {
+  printf("%s\n", __func__);
+  TEST(sequence_filename("frames/frame%04d.jpg", 7) == "frames/frame0007.jpg");
+  
+  Image im = load_image("data/dog.jpg").bilinear_resize(64, 48);
+  vector<Image> written;
+  for (int i = 0; i < 6; i++) {
+    Image frame = im;
+    frame.scale(0, 1.f - i*0.1f);
+    save_png(frame, sequence_filename("output/sequence%02d", i));
+    written.push_back(load_image(sequence_filename("output/sequence%02d.png", i)));
+  }
+  
+  vector<Image> frames = load_image_sequence("output/sequence%02d.png", FrameRange(1, 6), 3);
+  bool same = frames.size() == 5;
+  for (size_t i = 0; same && i < frames.size(); i++) same = same_pixels(frames[i], written[i + 1]);
+  TEST(same);
+  
+  vector<ImageU8> frames_u8 = load_image_sequence_u8("output/sequence%02d.png", FrameRange(0, 6));
+  Image widened = frames_u8.size() == 6 ? frames_u8[5].to_float() : Image();
+  TEST(widened == written[5]);
+  
+  ImageSequenceReader reader("output/sequence%02d.png", FrameRange(0, 6), 2);
+  Image frame;
+  int count = 0;
+  bool in_order = true;
+  while (reader.next(frame)) in_order = in_order && same_pixels(frame, written[count++]);
+  TEST(in_order && count == 6 && reader.position() == 6);
+  
+  // dropping a reader cancels the queued decodes and waits for the running ones
+  { ImageSequenceReaderU8 early("output/sequence%02d.png", FrameRange(0, 6), 4); }
+  
+  // readers used from pool work with every worker busy decode the frames
+  // their queued tasks can't get to instead of waiting on them
+  atomic<int> read_all(0), started(0);
+  parallel_for(0, num_threads(), 1, [&](int a, int b) {
+    for (int t = a; t < b; t++) {
+      // hold every thread of the pool in here for a moment
+      started++;
+      auto until = chrono::steady_clock::now() + chrono::milliseconds(200);
+      while (started < num_threads() && chrono::steady_clock::now() < until) this_thread::yield();
+      ImageSequenceReaderU8 nested("output/sequence%02d.png", FrameRange(0, 6), 3);
+      ImageU8 frame8;
+      int n = 0;
+      while (nested.next(frame8)) n++;
+      if (n == 6) read_all++;
+    }
+  });
+  TEST(read_all == num_threads());
+}
+
+
+void test_image_writer() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg").bilinear_resize(64, 48);
+  ImageU8 im8 = ImageU8::from_float(im);
+  {
+    ImageWriter writer(2, 2);
+    for (int i = 0; i < 6; i++) {
+      Image frame = im;
+      frame.scale(1, 1.f - i*0.1f);
+      writer.save_png(frame, sequence_filename("output/writer%02d", i));
+      TEST(writer.pending() <= 2);
+    }
+    writer.flush();
+    TEST(writer.pending() == 0);
+    bool written = true;
+    for (int i = 0; i < 6; i++) {
+      Image frame = im;
+      frame.scale(1, 1.f - i*0.1f);
+      Image loaded = load_image(sequence_filename("output/writer%02d.png", i));
+      written = written && loaded == frame;
+    }
+    TEST(written);
+    
+    // 8 bit images queued and left for the destructor
+    writer.save_png(im8, "output/writer-u8");
+  }
+  ImageU8 loaded = load_image_u8("output/writer-u8.png");
+  TEST(loaded.data == im8.data);
+}
+
+
+void test_video_stream() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg").bilinear_resize(65, 47);
+  ImageU8 im8 = ImageU8::from_float(im);
+  Image quantized = im8.to_float();
+  
+  {
+    FrameWriter rgb("output/stream.rgb", stream_format_for("output/stream.rgb"));
+    FrameWriter y4m("output/stream.y4m", stream_format_for("output/stream.y4m"), 25, 1);
+    for (int i = 0; i < 3; i++) {
+      rgb.write(im);
+      y4m.write(im8);
+    }
+  }
+  
+  FrameReader rgb("output/stream.rgb", 65, 47);
+  Image frame;
+  int count = 0;
+  bool same = true;
+  while (rgb.read(frame)) { same = same && frame == quantized; count++; }
+  TEST(rgb.format() == STREAM_RGB24 && count == 3 && same);
+  
+  // 4:2:0 chroma loses detail, the colours have to stay close
+  FrameReader y4m("output/stream.y4m");
+  TEST(y4m.format() == STREAM_Y4M && y4m.width() == 65 && y4m.height() == 47 && y4m.fps_num() == 25);
+  ImageU8 frame8;
+  count = 0;
+  double err = 0;
+  while (y4m.read(frame8)) {
+    for (size_t i = 0; i < frame8.data.size(); i++) err += fabs((double)frame8.data[i] - im8.data[i]);
+    count++;
+  }
+  TEST(count == 3 && err/(3.0*im8.data.size()) < 8);
+}
+
+
+// mean absolute difference of a from the rounded block means of full
+static double block_mean_error(const ImageU8& full, const ImageU8& a, int s, bool* exact) {
+  double err = 0;
+  *exact = true;
+  for (int ch = 0; ch < full.c; ch++) for (int y = 0; y < a.h; y++) for (int x = 0; x < a.w; x++) {
+    unsigned sum = 0, n = 0;
+    for (int j = y*s; j < min(full.h, (y + 1)*s); j++) for (int i = x*s; i < min(full.w, (x + 1)*s); i++, n++) sum += full(i, j, ch);
+    unsigned mean = (sum + n/2)/n;
+    *exact = *exact && a(x, y, ch) == mean;
+    err += fabs((double)a(x, y, ch) - mean);
+  }
+  return err/a.data.size();
+}
+
+void test_load_scaled() {
+  printf("%s\n", __func__);
+  ImageU8 full = load_image_u8("data/dog.jpg");
+  TEST(load_scale_for(full.w, full.h, 0, 0) == 1);
+  TEST(load_scale_for(1000, 800, 300, 0) == 4);
+  TEST(load_scale_for(1000, 800, 10, 10) == 8);
+  int fw = 0, fh = 0;
+  TEST(image_file_size("data/dog.jpg", &fw, &fh) && fw == full.w && fh == full.h);
+  
+  int s = load_scale_for(full.w, full.h, full.w/3, full.h/3);
+  ImageU8 small = load_image_u8("data/dog.jpg", full.w/3, full.h/3);
+  TEST(s == 4 && small.w == (full.w + 3)/4 && small.h == (full.h + 3)/4);
+  
+  // formats decoded at full size: every pixel is the rounded mean of its block
+  bool exact = false;
+  ImageU8 png = load_image_u8("data/dog-box7.png");
+  ImageU8 png_small = load_image_u8("data/dog-box7.png", png.w/3, png.h/3);
+  TEST(png_small.w == (png.w + 3)/4 && block_mean_error(png, png_small, 4, &exact) == 0 && exact);
+  
+  // jpegs come from the reduced idcts, the block means of the full idct up to
+  // rounding and chroma upsampling
+  for (int k = 1; k <= 3; k++) {
+    int sk = 1 << k;
+    ImageU8 scaled = load_image_u8("data/dog.jpg", full.w/sk, full.h/sk);
+    TEST(scaled.w == (full.w + sk - 1)/sk && scaled.h == (full.h + sk - 1)/sk);
+    TEST(block_mean_error(full, scaled, sk, &exact) < 2.5);
+  }
+  
+  // and skip the full size decode: 1/8 has to beat it clearly
+  auto best_ms = [](int max_w) {
+    double best = 1e9;
+    for (int r = 0; r < 5; r++) {
+      auto t0 = chrono::steady_clock::now();
+      ImageU8 im = load_image_u8("data/dog.jpg", max_w, 0);
+      best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+    }
+    return best;
+  };
+  TEST(best_ms(full.w/8) < 0.85*best_ms(0));
+  
+  Image smallf = load_image("data/dog.jpg", full.w/3, 0);
+  Image smalli = load_image("data/dog.jpg", full.w/3, 0, Image::INTERLEAVED);
+  TEST(smallf.w == (full.w + 3)/4 && smalli.layout == Image::INTERLEAVED && same_pixels(smallf, smalli));
+  Image widened = small.to_float();
+  TEST(widened == smallf);
+  
+  // fast formats load whole and are area resized
+  Image im = load_image("data/dog.jpg");
+  save_image_file(full, "output/dog_scaled.qoi");
+  save_image_file(im, "output/dog_scaled.pfm");
+  TEST(image_file_size("output/dog_scaled.qoi", &fw, &fh) && fw == full.w && fh == full.h);
+  TEST(image_file_size("output/dog_scaled.pfm", &fw, &fh) && fw == full.w && fh == full.h);
+  Image qoi = load_image("output/dog_scaled.qoi", full.w/3, 0);
+  Image pfm = load_image("output/dog_scaled.pfm", full.w/3, 0, Image::INTERLEAVED);
+  TEST(same_pixels(qoi, im.area_resize(small.w, small.h)));
+  TEST(pfm.layout == Image::INTERLEAVED && same_pixels(pfm, im.area_resize(small.w, small.h)));
+  TEST(load_image_u8("output/dog_scaled.qoi", full.w/3, 0).w == small.w);
+}
+
+
+void test_image_formats() {
+  printf("%s\n", __func__);
+  TEST(image_format_for("a/b.QOI") == FORMAT_QOI && image_format_for("x.jpeg") == FORMAT_JPG);
+  TEST(image_format_for("x.pgm") == FORMAT_PGM && image_format_for("dir.pfm/x") == FORMAT_UNKNOWN);
+  TEST(is_fast_format(FORMAT_PFM) && !is_fast_format(FORMAT_PNG));
+
+  ImageU8 im8 = load_image_u8("data/dog.jpg");
+  Image im = load_image("data/dog.jpg");
+
+  // 8 bit formats keep every byte
+  save_image_file(im8, "output/dog.qoi");
+  save_image_file(im8, "output/dog.ppm");
+  TEST(load_image_u8("output/dog.qoi").data == im8.data);
+  TEST(load_image_fast_u8("output/dog.ppm").data == im8.data);
+  TEST(same_pixels(load_image("output/dog.qoi"), im));
+  TEST(same_pixels(load_image("output/dog.ppm", Image::INTERLEAVED), load_image("data/dog.jpg", Image::INTERLEAVED)));
+
+  // float images round the way save_image does
+  Image shifted = im;
+  shifted.shift(0, 0.013f);
+  save_image_file(shifted, "output/dog_shifted.qoi");
+  save_png(shifted, "output/dog_shifted");
+  TEST(load_image_u8("output/dog_shifted.qoi").data == load_image_u8("output/dog_shifted.png").data);
+
+  // pfm is exact, also for values outside [0, 1]
+  save_image_file(shifted, "output/dog.pfm");
+  TEST(same_pixels(load_image("output/dog.pfm"), shifted));
+  Image gray = im.rgb_to_grayscale();
+  save_image_file(gray, "output/dog_gray.pfm");
+  TEST(same_pixels(load_image_fast("output/dog_gray.pfm"), gray));
+  
+  // two channels come back with a third channel of 0
+  Image two(shifted.w, shifted.h, 2);
+  for (int ch = 0; ch < 2; ch++) for (int y = 0; y < two.h; y++) for (int x = 0; x < two.w; x++) two(x, y, ch) = shifted(x, y, ch);
+  save_image_file(two, "output/dog_two.pfm");
+  Image three = load_image("output/dog_two.pfm");
+  TEST(three.c == 3 && same_pixels(three.get_channel(0), shifted.get_channel(0)) && same_pixels(three.get_channel(1), shifted.get_channel(1)));
+  TEST(same_pixels(three.get_channel(2), Image(two.w, two.h, 1)));
+  ImageU8 two8 = ImageU8::from_float(two);
+  save_image_file(two8, "output/dog_two.ppm");
+  ImageU8 three8 = load_image_u8("output/dog_two.ppm");
+  TEST(three8.c == 3 && three8(two.w - 1, two.h - 1, 1) == two8(two.w - 1, two.h - 1, 1) && three8(two.w - 1, two.h - 1, 2) == 0);
+
+  save_image_file(gray, "output/dog_gray.pgm");
+  Image gray8 = load_image("output/dog_gray.pgm");
+  TEST(gray8.c == 1 && gray8.w == gray.w && (gray8 == gray));
+
+  // rgb saved as pgm is grey with the rgb_to_grayscale weights, not red
+  save_image_file(im8, "output/dog_rgb.pgm");
+  ImageU8 from_rgb = load_image_u8("output/dog_rgb.pgm");
+  ImageU8 expected = ImageU8::from_float(rgb_to_grayscale(im8));
+  int off = 0;
+  bool red = true;
+  for (int y = 0; y < im8.h; y++) for (int x = 0; x < im8.w; x++) {
+    off = max(off, abs((int)from_rgb(x, y, 0) - (int)expected(x, y, 0)));
+    red = red && from_rgb(x, y, 0) == im8(x, y, 0);
+  }
+  TEST(from_rgb.c == 1 && from_rgb.w == im8.w && off <= 1 && !red);
+
+  // a 16 bit grey file with a comment in its header
+  FILE* fn = fopen("output/wide.pgm", "wb");
+  fprintf(fn, "P5\n# written by hand\n2 1\n1000\n");
+  const unsigned char samples[4] = {0x01, 0xf4, 0x03, 0xe8};
+  fwrite(samples, 1, 4, fn);
+  fclose(fn);
+  Image wide = load_image("output/wide.pgm");
+  TEST(wide.w == 2 && wide.h == 1 && wide.c == 1 && within_eps(0.5f, wide(0, 0, 0)) && within_eps(1.f, wide(1, 0, 0)));
+  ImageU8 wide8 = load_image_u8("output/wide.pgm");
+  TEST(wide8(0, 0, 0) == 128 && wide8(1, 0, 0) == 255);
+}
+
+
 void test_shift() {
   printf("%s\n", __func__);
   Image im = load_image("data/dog.jpg");
@@ -100,6 +813,20 @@ void run_tests() {
   test_get_pixel();
   test_set_pixel();
   test_copy();
+  test_padded();
+  test_view();
+  test_typed_images();
+  test_interleaved();
+  test_image_pool();
+  test_parallel_for();
+  test_pointwise();
+  test_kernels();
+  test_image_file();
+  test_image_sequence();
+  test_image_writer();
+  test_video_stream();
+  test_load_scaled();
+  test_image_formats();
   test_shift();
   test_grayscale();
   test_rgb_to_hsv();
@@ -1,7 +1,21 @@
 #include "test_common.h"
+#include "../src/image/inc/resample.h"
+#include "../src/image/inc/filter_image.h"
+#include "../src/image/inc/image_pyramid.h"
+#include "../src/image/inc/image_formats.h"
+#include "../src/optical_flow/optical_flow.h"
+#include "../src/utils/cpu_dispatch.h"
 
 using namespace std;
 
+// exact pixel compare, operator== allows some error
+static bool same_image(const Image& a, const Image& b) {
+  if (a.w != b.w || a.h != b.h || a.c != b.c) return false;
+  for (int ch = 0; ch < a.c; ch++) for (int y = 0; y < a.h; y++) for (int x = 0; x < a.w; x++) if (a(x, y, ch) != b(x, y, ch)) return false;
+  return true;
+}
+
+
 void test_nn_resize() {
   printf("%s\n", __func__);
   Image im = load_image("data/dogsmall.jpg");
@@ -46,10 +60,174 @@ void test_multiple_resize() {
 }
 
 
+void test_resample_tables() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dogsmall.jpg");
+  Image inter = load_image("data/dogsmall.jpg", Image::INTERLEAVED);
+  ResampleAxis axis = bilinear_axis(10, 4);
+  TEST(axis.taps == 2 && axis.index.size() == 8 && axis.index[0] == 0 && axis.index[4 + 3] == 9);
+
+  // the tables give exactly what sampling every pixel gives, on every cpu
+  const int sizes[][2] = {{im.w*3, im.h*2}, {im.w/3, im.h/5}, {7, 131}, {1, 1}};
+  CpuLevel level = cpu_level();
+  bool same_bl = true, same_nn = true, same_layouts = true;
+  for (int lv = CPU_SCALAR; lv <= cpu_detected_level(); lv++) {
+    set_cpu_level((CpuLevel)lv);
+    for (auto& sz : sizes) {
+      int w = sz[0], h = sz[1];
+      Image bl = im.bilinear_resize(w, h);
+      Image nn = im.nn_resize(w, h);
+      float sx = (float)im.w/(float)w, sy = (float)im.h/(float)h;
+      for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) {
+        same_bl = same_bl && bl(x, y, ch) == im.bilinear_interpolate(sx * ((float)x + 0.5f), sy * ((float)y + 0.5f), ch);
+        same_nn = same_nn && nn(x, y, ch) == im.nn_interpolate(sx * ((float)x + 0.5f), sy * ((float)y + 0.5f), ch);
+      }
+      Image bli = inter.bilinear_resize(w, h);
+      same_layouts = same_layouts && bli.layout == Image::INTERLEAVED && same_image(bli, bl);
+    }
+  }
+  set_cpu_level(level);
+  TEST(same_bl);
+  TEST(same_nn);
+  TEST(same_layouts);
+}
+
+
+void test_area_resize() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  ResampleAxis axis = area_axis(10, 4);
+  TEST(axis.taps == 3 && within_eps(0.4f, axis.weight[0]) && axis.index[1] == 2 && within_eps(0.2f, axis.weight[1]));
+
+  // an exact factor averages blocks
+  Image half = im.area_resize(im.w/2, im.h/2);
+  bool averaged = true;
+  for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < half.h; y++) for (int x = 0; x < half.w; x++) {
+    float mean = (im(2*x, 2*y, ch) + im(2*x + 1, 2*y, ch) + im(2*x, 2*y + 1, ch) + im(2*x + 1, 2*y + 1, ch))/4;
+    averaged = averaged && within_eps(mean, half(x, y, ch));
+  }
+  TEST(averaged);
+  Image same = im.area_resize(im.w, im.h);
+  TEST((same == im));
+
+  // shrinking keeps the mean of the image
+  Image small = im.area_resize(im.w/7 + 1, im.h/5 - 2);
+  double a = 0, b = 0;
+  for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < im.h; y++) for (int x = 0; x < im.w; x++) a += im(x, y, ch);
+  for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < small.h; y++) for (int x = 0; x < small.w; x++) b += small(x, y, ch);
+  TEST(fabs(a/((double)im.w*im.h) - b/((double)small.w*small.h)) < 1e-3);
+}
+
+
+void test_smooth_resize() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg").rgb_to_grayscale();
+  for (float factor : {2.f, 4.f, 1.7f}) {
+    int w = im.w/factor, h = im.h/factor;
+    Image fused = smooth_resize(im, factor/1.5f, w, h);
+    Image steps = fast_smooth_image(im, factor/1.5f).bilinear_resize(w, h);
+    TEST((fused == steps));
+  }
+}
+
+
+void test_windowed_resize() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg");
+  const ResampleFilter filters[] = {FILTER_BICUBIC, FILTER_MITCHELL, FILTER_LANCZOS3};
+
+  // the weights of every sample sum to 1, shrinking widens the filter
+  bool normalized = true;
+  for (ResampleFilter f : filters) for (int dst : {3, 40, 97, 250}) {
+    ResampleAxis axis = windowed_axis(97, dst, f);
+    for (int i = 0; i < dst; i++) {
+      float sum = 0;
+      for (int k = 0; k < axis.taps; k++) sum += axis.weight[(size_t)k*dst + i];
+      normalized = normalized && within_eps(1.f, sum);
+    }
+  }
+  TEST(normalized);
+  TEST(windowed_axis(100, 25, FILTER_LANCZOS3).taps >= 24 && windowed_axis(100, 200, FILTER_LANCZOS3).taps <= 7);
+
+  // interpolating filters give the image back at the same size
+  TEST((im.resize(im.w, im.h, FILTER_BICUBIC) == im));
+  TEST((im.resize(im.w, im.h, FILTER_LANCZOS3) == im));
+
+  // and agree with an area average when shrinking a lot
+  Image area = im.area_resize(im.w/6, im.h/6);
+  for (ResampleFilter f : filters) {
+    Image small = im.resize(im.w/6, im.h/6, f);
+    double err = 0;
+    for (int ch = 0; ch < im.c; ch++) for (int y = 0; y < small.h; y++) for (int x = 0; x < small.w; x++) err += fabs(small(x, y, ch) - area(x, y, ch));
+    TEST(err/((double)small.w*small.h*small.c) < 0.03);
+  }
+
+  // the tables are worked out once per sizes and filter
+  shared_ptr<const ResampleAxis> a = cached_axis(640, 213, FILTER_MITCHELL);
+  TEST(a == cached_axis(640, 213, FILTER_MITCHELL) && a != cached_axis(640, 213, FILTER_LANCZOS3));
+  Image inter = load_image("data/dog.jpg", Image::INTERLEAVED);
+  Image li = inter.resize(213, 301, FILTER_LANCZOS3);
+  TEST(li.layout == Image::INTERLEAVED && same_image(li, im.resize(213, 301, FILTER_LANCZOS3)));
+}
+
+
+void test_image_pyramid() {
+  printf("%s\n", __func__);
+  Image im = load_image("data/dog.jpg").rgb_to_grayscale();
+  ImagePyramid pyr(im, 2);
+  int expect = 1;
+  for (int w = im.w, h = im.h; min(w, h) > 1; w /= 2, h /= 2) expect++;
+  TEST(pyr.levels() == expect && pyr[pyr.levels() - 1].h == 1);
+
+  // levels are the smoothed and shrunk level above, built once
+  const Image& l2 = pyr.gaussian(2);
+  Image by_hand = smooth_resize(smooth_resize(im, 2/1.5f, im.w/2, im.h/2), 2/1.5f, im.w/4, im.h/4);
+  TEST(l2.w == im.w/4 && same_image(l2, by_hand));
+  ImagePyramid copy = pyr;
+  TEST(&copy.gaussian(2) == &l2 && &pyr[2] == &l2);
+  TEST(make_image_pyramid(im, 2, 3)[2] == by_hand);
+
+  // the Laplacian levels add back up to the image
+  ImagePyramid small(im, 2, 4);
+  Image rebuilt = small.laplacian(3);
+  for (int l = 2; l >= 0; l--) rebuilt = small.laplacian(l) + rebuilt.bilinear_resize(small[l].w, small[l].h);
+  TEST((rebuilt == im));
+
+  // a frame pushed into the flow keeps its pyramid as the previous one
+  LKIterPyramid lk;
+  lk.pyramid_levels = 3;
+  push_frame(lk, im);
+  const Image* coarse = &lk.pyramid1[2];
+  push_frame(lk, im);
+  TEST(&lk.pyramid0[2] == coarse && lk.pyramid1.levels() == 3 && &lk.pyramid1[2] != coarse);
+  TEST(lk.t1.data == lk.pyramid1[0].data && lk.t0.data == lk.pyramid0[0].data && lk.t0.data != lk.t1.data);
+
+  // frames loaded for the flow lose the power of two of subsample_input while decoding
+  Image dog = load_image("data/dog.jpg");
+  Image frame = load_flow_frame("data/dog.jpg", 3);
+  Image halved = load_image("data/dog.jpg", (dog.w + 1)/2, (dog.h + 1)/2).rgb_to_grayscale();
+  TEST(frame.c == 1 && frame.w == (int)roundf(dog.w/3.f) && frame.h == (int)roundf(dog.h/3.f));
+  TEST(same_image(frame, halved.area_resize(frame.w, frame.h)));
+  TEST(same_image(load_flow_frame("data/dog.jpg", 2), halved));
+  lk.subsample_input = 4;
+  push_frame(lk, load_flow_frame("data/dog.jpg", lk.subsample_input));
+  TEST(lk.t1.w == (int)roundf(dog.w/4.f) && lk.pyramid1[0].w == lk.t1.w);
+  save_image_file(dog, "output/flow_frame.pfm");
+  TEST(same_image(load_flow_frame("output/flow_frame.pfm", 3), dog.area_resize((dog.w + 1)/2, (dog.h + 1)/2).rgb_to_grayscale().area_resize(frame.w, frame.h)));
+  vector<Image> loaded = make_image_pyramid("data/dog.jpg", 2, 3, dog.w/3, 0);
+  TEST(loaded.size() == 3 && loaded[0].w == (dog.w + 3)/4 && loaded[0].c == 1);
+}
+
+
 void run_tests() {
   test_nn_resize();
   test_bl_resize();
   test_multiple_resize();
+  test_resample_tables();
+  test_area_resize();
+  test_smooth_resize();
+  test_windowed_resize();
+  test_image_pyramid();
   printf("%d tests, %d passed, %d failed\n", tests_total, tests_total-tests_fail, tests_fail);
 }
 